@@ -0,0 +1,438 @@
+#ifndef _PIXEL_CONVERTER_H_
+#define _PIXEL_CONVERTER_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2/opencv.hpp>
+
+// 変換の途中の 1 ピクセル(各 0 - 255。グレーは r = g = b)
+struct PixelValue
+{
+  int r, g, b;
+};
+
+// 変換元のピクセルフォーマット
+// PIXELS ピクセル分(BYTES バイト)ずつ読む
+template<openni::PixelFormat Format>
+struct PixelSource;
+
+// RGB888 は R G B の順に並ぶ
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_RGB888>
+{
+  enum { PIXELS = 1, BYTES = 3 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = s[0];
+    p[0].g = s[1];
+    p[0].b = s[2];
+  }
+};
+
+// YUV は 2 ピクセル 4 バイトで色を共有する(Y0, U, Y1, V はバイトの位置)
+// 係数は cv::cvtColor と同じ ITU-R BT.601(20bit の固定小数点)
+template<int Y0, int U, int Y1, int V>
+struct YuvPixelSource
+{
+  enum { PIXELS = 2, BYTES = 4 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    int u = s[U] - 128;
+    int v = s[V] - 128;
+    int r = (1 << 19) + (1673527 * v);
+    int g = (1 << 19) - (852492 * v) - (409993 * u);
+    int b = (1 << 19) + (2116026 * u);
+
+    store( p[0], s[Y0], r, g, b );
+    store( p[1], s[Y1], r, g, b );
+  }
+
+  static void store( PixelValue& p, int y, int r, int g, int b )
+  {
+    int luma = ((y > 16) ? (y - 16) : 0) * 1220542;
+    p.r = clamp( (luma + r) >> 20 );
+    p.g = clamp( (luma + g) >> 20 );
+    p.b = clamp( (luma + b) >> 20 );
+  }
+
+  static int clamp( int value )
+  {
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+  }
+};
+
+// YUV422 は U Y0 V Y1 の順
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_YUV422> : YuvPixelSource<1, 0, 3, 2>
+{
+};
+
+// YUYV は Y0 U Y1 V の順
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_YUYV> : YuvPixelSource<0, 1, 2, 3>
+{
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_GRAY8>
+{
+  enum { PIXELS = 1, BYTES = 1 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = p[0].g = p[0].b = s[0];
+  }
+};
+
+// 16bit のフォーマット(値は LinearScale で 0 - 255 にする)
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+  enum { PIXELS = 1, BYTES = 2 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = *(const unsigned short*)s;
+  }
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_DEPTH_1_MM>
+  : PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_DEPTH_100_UM>
+  : PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+};
+
+// フレームを 8bit の画像(BGR またはグレー)に変換する
+//
+// 変換は、変換元のピクセルフォーマット、変換先の並び、左右の反転、値の縮小をテンプレートの
+// 引数にした関数で行い、組み合わせごとにコンパイル時に作っておく(ループの中に分岐がない)。
+// 反転しない RGB、YUV、グレーは、SIMD で最適化されている cv::cvtColor を使う関数にする。
+// 使う関数は表から選び、選びなおすのはビデオモードや設定が変わったときだけ。
+// 表示を小さくするときは、変換しながら間引く(読むピクセルも書くピクセルも減る)。
+// 新しいフォーマットは、PixelSource を特殊化して表に追加すれば使える
+class PixelConverter
+{
+public:
+
+  // type : 変換先の画像の型(CV_8UC3 なら BGR、CV_8UC1 ならグレー)
+  PixelConverter( int type = CV_8UC3 )
+    : type( type )
+    , mirror( false )
+    , range( 10000 )
+    , decimation( 1 )
+    , kernel( 0 )
+    , factor( 0 )
+  {
+  }
+
+  // 左右を反転して変換するかどうか
+  void setMirror( bool mirror )
+  {
+    this->mirror = mirror;
+    kernel = 0;
+  }
+
+  bool isMirror() const
+  {
+    return mirror;
+  }
+
+  // 16bit のフォーマットで 255 にする値(Depth は mm。255 以上)
+  void setRange( int range )
+  {
+    this->range = range;
+    kernel = 0;
+  }
+
+  // 縦横とも decimation ピクセルごとに 1 ピクセルだけ変換する(1 なら間引かない)
+  // JPEG は展開してからでないと間引けないので、元の大きさのまま変換する
+  void setDecimation( int decimation )
+  {
+    decimation = (std::max)( decimation, 1 );
+    if ( decimation != this->decimation ) {
+      this->decimation = decimation;
+      kernel = 0;
+    }
+  }
+
+  // フレームを変換する(結果は次の呼び出しまで有効)
+  const cv::Mat& convert( const openni::VideoFrameRef& frame )
+  {
+    if ( !frame.isValid() ) {
+      return image;
+    }
+
+    // ビデオモードが変わったときだけ、変換の関数を選びなおす
+    const openni::VideoMode& videoMode = frame.getVideoMode();
+    if ( (kernel == 0) || (videoMode.getPixelFormat() != pixelFormat) ) {
+      select( videoMode.getPixelFormat() );
+    }
+
+    kernel( frame, image, factor, decimation );
+    return image;
+  }
+
+  // 変換できるピクセルフォーマットか
+  bool isSupported( openni::PixelFormat pixelFormat ) const
+  {
+    return find( pixelFormat ) != 0;
+  }
+
+private:
+
+  // 変換の関数(factor は値の縮小の倍率、16bit の固定小数点。decimation は間引く間隔)
+  typedef void (*Kernel)( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation );
+
+  // 値の縮小をしない
+  struct NoScale
+  {
+    static void apply( PixelValue&, int )
+    {
+    }
+  };
+
+  // 1 チャンネルの値を縮小して 0 - 255 にする
+  struct LinearScale
+  {
+    static void apply( PixelValue& p, int factor )
+    {
+      unsigned int value = ((unsigned int)p.r * factor) >> 16;
+      p.r = p.g = p.b = (value > 255) ? 255 : (int)value;
+    }
+  };
+
+  // 変換先の並び
+  struct BgrLayout
+  {
+    enum { TYPE = CV_8UC3, CHANNELS = 3, JPEG_FLAG = CV_LOAD_IMAGE_COLOR };
+
+    static void write( unsigned char* d, const PixelValue& p )
+    {
+      d[0] = (unsigned char)p.b;
+      d[1] = (unsigned char)p.g;
+      d[2] = (unsigned char)p.r;
+    }
+  };
+
+  struct GrayLayout
+  {
+    enum { TYPE = CV_8UC1, CHANNELS = 1, JPEG_FLAG = CV_LOAD_IMAGE_GRAYSCALE };
+
+    // 係数の合計は 256 なので、グレーのピクセルはそのままの値になる
+    static void write( unsigned char* d, const PixelValue& p )
+    {
+      d[0] = (unsigned char)(((p.r * 77) + (p.g * 150) + (p.b * 29)) >> 8);
+    }
+  };
+
+  // 変換の関数(反転するときは右から書き込むので、反転のための処理は増えない)
+  template<openni::PixelFormat Format, typename Layout, bool Mirror, typename Scale>
+  static void convertPixels( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation )
+  {
+    if ( decimation > 1 ) {
+      decimatePixels<Format, Layout, Mirror, Scale>( frame, dst, factor, decimation );
+      return;
+    }
+
+    typedef PixelSource<Format> Source;
+    const int step = Mirror ? -Layout::CHANNELS : Layout::CHANNELS;
+
+    int width = frame.getWidth();
+    int height = frame.getHeight();
+    dst.create( height, width, Layout::TYPE );
+
+    const unsigned char* data = (const unsigned char*)frame.getData();
+    int stride = frame.getStrideInBytes();
+    for ( int y = 0; y < height; ++y ) {
+      const unsigned char* s = data + (y * stride);
+      unsigned char* d = dst.ptr( y ) + (Mirror ? ((width - 1) * Layout::CHANNELS) : 0);
+      for ( int x = 0; (x + Source::PIXELS) <= width; x += Source::PIXELS, s += Source::BYTES ) {
+        PixelValue p[Source::PIXELS];
+        Source::read( s, p );
+        for ( int i = 0; i < Source::PIXELS; ++i, d += step ) {
+          Scale::apply( p[i], factor );
+          Layout::write( d, p[i] );
+        }
+      }
+    }
+  }
+
+  // 間引いて変換する関数(PIXELS ピクセルで 1 組のフォーマットは、組を読んで使う 1 つを取り出す)
+  template<openni::PixelFormat Format, typename Layout, bool Mirror, typename Scale>
+  static void decimatePixels( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation )
+  {
+    typedef PixelSource<Format> Source;
+    const int step = Mirror ? -Layout::CHANNELS : Layout::CHANNELS;
+
+    int width = frame.getWidth() / decimation;
+    int height = frame.getHeight() / decimation;
+    dst.create( height, width, Layout::TYPE );
+
+    const unsigned char* data = (const unsigned char*)frame.getData();
+    int stride = frame.getStrideInBytes();
+    for ( int y = 0; y < height; ++y ) {
+      const unsigned char* s = data + ((y * decimation) * stride);
+      unsigned char* d = dst.ptr( y ) + (Mirror ? ((width - 1) * Layout::CHANNELS) : 0);
+      for ( int x = 0, sx = 0; x < width; ++x, sx += decimation, d += step ) {
+        PixelValue p[Source::PIXELS];
+        Source::read( s + ((sx / Source::PIXELS) * Source::BYTES), p );
+        PixelValue& value = p[sx % Source::PIXELS];
+        Scale::apply( value, factor );
+        Layout::write( d, value );
+      }
+    }
+  }
+
+  // cv::cvtColor での変換(SourceType は変換元の画像の型、Code は cvtColor の変換の種類)
+  template<int SourceType, int Code>
+  static void convertColor( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int )
+  {
+    cv::cvtColor( cv::Mat( frame.getHeight(), frame.getWidth(), SourceType,
+                           (void*)frame.getData(), frame.getStrideInBytes() ), dst, Code );
+  }
+
+  // JPEG は 1 フレームが 1 枚の JPEG 画像なので、展開してから反転する
+  template<typename Layout, bool Mirror>
+  static void decodeJpeg( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int )
+  {
+    cv::imdecode( cv::Mat( 1, frame.getDataSize(), CV_8UC1, (void*)frame.getData() ),
+                  Layout::JPEG_FLAG, &dst );
+    if ( Mirror ) {
+      cv::flip( dst, dst, 1 );
+    }
+  }
+
+  // 対応していないフォーマットは黒にする
+  template<typename Layout>
+  static void fillBlack( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int decimation )
+  {
+    dst.create( frame.getHeight() / decimation, frame.getWidth() / decimation, Layout::TYPE );
+    dst = cv::Scalar::all( 0 );
+  }
+
+  // 表の 1 行(unit は 16bit のフォーマットで range の単位 1 つあたりの値。縮小しないものは 0、
+  // decimate は間引いて変換できるか)
+  struct Entry
+  {
+    openni::PixelFormat pixelFormat;
+    int type;
+    bool mirror;
+    int unit;
+    bool decimate;
+    Kernel kernel;
+  };
+
+  static void addEntry( std::vector<Entry>& table, openni::PixelFormat pixelFormat, int type,
+                        bool mirror, int unit, bool decimate, Kernel kernel )
+  {
+    Entry entry = { pixelFormat, type, mirror, unit, decimate, kernel };
+    table.push_back( entry );
+  }
+
+  // フォーマットごとに、変換先の並びと反転の組み合わせを表に追加する
+  template<openni::PixelFormat Format, typename Scale>
+  static void addFormat( std::vector<Entry>& table, int unit )
+  {
+    addEntry( table, Format, CV_8UC3, false, unit, true, &convertPixels<Format, BgrLayout, false, Scale> );
+    addEntry( table, Format, CV_8UC3, true, unit, true, &convertPixels<Format, BgrLayout, true, Scale> );
+    addEntry( table, Format, CV_8UC1, false, unit, true, &convertPixels<Format, GrayLayout, false, Scale> );
+    addEntry( table, Format, CV_8UC1, true, unit, true, &convertPixels<Format, GrayLayout, true, Scale> );
+  }
+
+  // 反転しないときは cv::cvtColor を使う(表は先頭から探すので、先に追加したほうが使われる。
+  // cv::cvtColor では間引けないので、間引くときは後の関数が使われる)
+  template<openni::PixelFormat Format, int SourceType, int BgrCode, int GrayCode>
+  static void addColorFormat( std::vector<Entry>& table )
+  {
+    addEntry( table, Format, CV_8UC3, false, 0, false, &convertColor<SourceType, BgrCode> );
+    addEntry( table, Format, CV_8UC1, false, 0, false, &convertColor<SourceType, GrayCode> );
+    addFormat<Format, NoScale>( table, 0 );
+  }
+
+  static std::vector<Entry> makeTable()
+  {
+    std::vector<Entry> table;
+    addColorFormat<openni::PIXEL_FORMAT_RGB888, CV_8UC3, CV_RGB2BGR, CV_RGB2GRAY>( table );
+    addColorFormat<openni::PIXEL_FORMAT_YUV422, CV_8UC2, CV_YUV2BGR_UYVY, CV_YUV2GRAY_UYVY>( table );
+    addColorFormat<openni::PIXEL_FORMAT_YUYV, CV_8UC2, CV_YUV2BGR_YUY2, CV_YUV2GRAY_YUY2>( table );
+
+    // グレーからグレーは cv::cvtColor にないので、BGR への変換だけ cv::cvtColor を使う
+    addEntry( table, openni::PIXEL_FORMAT_GRAY8, CV_8UC3, false, 0, false, &convertColor<CV_8UC1, CV_GRAY2BGR> );
+    addFormat<openni::PIXEL_FORMAT_GRAY8, NoScale>( table, 0 );
+    addFormat<openni::PIXEL_FORMAT_GRAY16, LinearScale>( table, 1 );
+    addFormat<openni::PIXEL_FORMAT_DEPTH_1_MM, LinearScale>( table, 1 );
+    addFormat<openni::PIXEL_FORMAT_DEPTH_100_UM, LinearScale>( table, 10 );
+
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC3, false, 0, false, &decodeJpeg<BgrLayout, false> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC3, true, 0, false, &decodeJpeg<BgrLayout, true> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC1, false, 0, false, &decodeJpeg<GrayLayout, false> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC1, true, 0, false, &decodeJpeg<GrayLayout, true> );
+    return table;
+  }
+
+  static const std::vector<Entry>& getTable()
+  {
+    static const std::vector<Entry> table = makeTable();
+    return table;
+  }
+
+  // 間引くときは、間引いて変換できる関数を優先する(なければ間引かない関数)
+  const Entry* find( openni::PixelFormat pixelFormat ) const
+  {
+    const Entry* found = 0;
+    const std::vector<Entry>& table = getTable();
+    for ( size_t i = 0; i < table.size(); ++i ) {
+      if ( (table[i].pixelFormat == pixelFormat) && (table[i].type == type) &&
+           (table[i].mirror == mirror) ) {
+        if ( (decimation == 1) || table[i].decimate ) {
+          return &table[i];
+        }
+
+        if ( found == 0 ) {
+          found = &table[i];
+        }
+      }
+    }
+
+    return found;
+  }
+
+  void select( openni::PixelFormat pixelFormat )
+  {
+    this->pixelFormat = pixelFormat;
+
+    const Entry* entry = find( pixelFormat );
+    if ( entry == 0 ) {
+      kernel = (type == CV_8UC1) ? &fillBlack<GrayLayout> : &fillBlack<BgrLayout>;
+      factor = 0;
+      return;
+    }
+
+    kernel = entry->kernel;
+    factor = (entry->unit != 0) ? ((255 << 16) / (range * entry->unit)) : 0;
+  }
+
+private:
+
+  int type;                           // 変換先の画像の型
+  bool mirror;                        // 左右を反転して変換するか
+  int range;                          // 16bit のフォーマットで 255 にする値
+  int decimation;                     // 間引く間隔(1 なら間引かない)
+
+  openni::PixelFormat pixelFormat;    // 変換の関数を選んだときのピクセルフォーマット
+  Kernel kernel;                      // 選んだ変換の関数(設定が変わったら 0)
+  int factor;                         // 値の縮小の倍率(16bit の固定小数点)
+  cv::Mat image;                      // 変換先の画像(フレーム間で使いまわす)
+};
+
+#endif
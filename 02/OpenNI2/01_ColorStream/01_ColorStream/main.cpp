@@ -4,6 +4,8 @@
 #include <OpenNI.h>
 #include <opencv2/opencv.hpp>
 
+#include "PixelConverter.h"
+
 class DepthSensor
 {
 public:
@@ -18,7 +20,7 @@ public:
     
     // カラーストリームを有効にする
     colorStream.create( device, openni::SENSOR_COLOR );
-    changeResolution( colorStream );
+    changeResolution( colorStream, 640, 480 );
     colorStream.start();
   }
   
@@ -37,28 +39,56 @@ public:
     cv::imshow( "Color Stream", colorImage );
   }
   
+  // カラーストリームの解像度を VGA(640x480) と SXGA(1280x1024) で切り替える
+  void changeColorResolution()
+  {
+    int width = (colorStream.getVideoMode().getResolutionX() == 640) ? 1280 : 640;
+    int height = (width == 640) ? 480 : 1024;
+    
+    // 動作中に解像度を変更できないデバイスがあるので、一度止める
+    colorStream.stop();
+    changeResolution( colorStream, width, height );
+    colorStream.start();
+  }
+  
 private:
   
-  void changeResolution( openni::VideoStream& stream )
+  // 指定した解像度のビデオモードのうち、最もフレームレートの高いものに変更する
+  // (対応していない解像度なら、今のモードのまま使う)
+  void changeResolution( openni::VideoStream& stream, int width, int height )
   {
-    openni::VideoMode mode = stream.getVideoMode();
-    mode.setResolution( 640, 480 );
-    mode.setFps( 30 );
-    stream.setVideoMode( mode );
+    openni::VideoMode current = stream.getVideoMode();
+    const openni::Array<openni::VideoMode>& modes =
+      stream.getSensorInfo().getSupportedVideoModes();
+    
+    int found = -1;
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      if ( (modes[i].getResolutionX() == width) &&
+           (modes[i].getResolutionY() == height) &&
+           (modes[i].getPixelFormat() == current.getPixelFormat()) &&
+           ((found < 0) || (modes[i].getFps() > modes[found].getFps())) ) {
+        found = i;
+      }
+    }
+    
+    if ( found < 0 ) {
+      std::cout << "Unsupported resolution : " << width << "x" << height << std::endl;
+      return;
+    }
+    
+    openni::Status ret = stream.setVideoMode( modes[found] );
+    if ( ret != openni::STATUS_OK ) {
+      std::cout << "openni::VideoStream::setVideoMode() failed : "
+                << openni::OpenNI::getExtendedError() << std::endl;
+    }
   }
   
   // カラーストリームを表示できる形に変換する
   cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
   {
-    // OpenCV の形に変換する
-    cv::Mat colorImage = cv::Mat( colorFrame.getHeight(),
-                                 colorFrame.getWidth(),
-                                 CV_8UC3, (unsigned char*)colorFrame.getData() );
-    
-    // BGR の並びを RGB に変換する
-    cv::cvtColor( colorImage, colorImage, CV_RGB2BGR );
-    
-    return colorImage;
+    // ピクセルフォーマットに合わせて BGR の画像に変換する
+    // (変換先はフレーム間で使いまわすので、次のフレームまで有効)
+    return colorConverter.convert( colorFrame );
   }
   
 private:
@@ -67,6 +97,8 @@ private:
   openni::VideoStream colorStream;  // カラーストリーム
   
   cv::Mat colorImage;               // 表示用データ
+  
+  PixelConverter colorConverter;    // カラーの BGR への変換
 };
 
 int main(int argc, const char * argv[])
@@ -88,6 +120,10 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // カラーの解像度を切り替える
+      else if ( key == 'h' ) {
+        sensor.changeColorResolution();
+      }
     }
   }
   catch ( std::exception& ) {
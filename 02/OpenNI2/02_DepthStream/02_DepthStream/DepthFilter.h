@@ -0,0 +1,381 @@
+#ifndef _DEPTH_FILTER_H_
+#define _DEPTH_FILTER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "ThreadPool.h"
+
+// Depth データ(16bit)の前処理
+//
+// 次の処理を順に行う。どれも結果はフレーム間で使いまわすバッファに書き込み、
+// 行(または列)のバンドごとにスレッドプールで並列に処理する
+//  ・時間方向のメディアン : 直近 N フレームの、距離のある値の中央値をとる
+//  ・穴埋め               : 距離のない(0 の)ピクセルを、横と縦の両隣の遠いほうの値で埋める
+//  ・エッジを残す平滑化   : 距離の近いピクセルだけを平均する(横と縦に分けて処理する)
+class DepthFilter
+{
+public:
+
+  // 処理の種類
+  enum {
+    FILTER_TEMPORAL = 1,    // 時間方向のメディアン
+    FILTER_INPAINT = 2,     // 穴埋め
+    FILTER_SMOOTH = 4,      // エッジを残す平滑化
+    FILTER_ALL = FILTER_TEMPORAL | FILTER_INPAINT | FILTER_SMOOTH,
+  };
+
+  DepthFilter( ThreadPool& threadPool )
+    : threadPool( threadPool )
+    , filters( FILTER_ALL )
+    , historySize( 5 )
+    , historyHead( 0 )
+    , historyCount( 0 )
+    , maxGap( 8 )
+  {
+    setSmoothing( 2, 40 );
+  }
+
+  // 行う処理(FILTER_XXX の組み合わせ)
+  void setFilters( int filters )
+  {
+    this->filters = filters;
+  }
+
+  int getFilters() const
+  {
+    return filters;
+  }
+
+  // メディアンをとるフレーム数(1-9)
+  void setHistorySize( int size )
+  {
+    historySize = (std::min)( (std::max)( size, 1 ), 9 );
+    resetHistory();
+  }
+
+  // 穴埋めする最大の幅(ピクセル)
+  void setMaxGap( int gap )
+  {
+    maxGap = gap;
+  }
+
+  // 平滑化の半径(1-3 ピクセル)と、平均に含める距離の差の目安(mm)
+  void setSmoothing( int radius, int sigmaRange )
+  {
+    // 重みを掛けた合計が 32bit に収まるよう、半径は 3 までにする
+    radius = (std::min)( (std::max)( radius, 1 ), 3 );
+    this->radius = radius;
+
+    // 距離の重みは固定小数点(256 が 1.0)の表にしておく。3 シグマより先は 0
+    rangeWeights.resize( (3 * sigmaRange) + 1 );
+    for ( size_t i = 0; i < rangeWeights.size(); ++i ) {
+      double d = (double)i / sigmaRange;
+      rangeWeights[i] = (int)(256 * std::exp( -0.5 * d * d ));
+    }
+    rangeWeights.back() = 0;
+
+    // 位置の重み(16 が 1.0)
+    spatialWeights.resize( (2 * radius) + 1 );
+    for ( int k = -radius; k <= radius; ++k ) {
+      double d = (double)k / radius;
+      spatialWeights[k + radius] = (std::max)( (int)(16 * std::exp( -d * d )), 1 );
+    }
+  }
+
+  // 時間方向のメディアンの履歴を捨てる
+  void resetHistory()
+  {
+    historyHead = 0;
+    historyCount = 0;
+  }
+
+  // Depth データを処理する(結果は次の呼び出しまで有効)
+  const cv::Mat& apply( const cv::Mat& depth )
+  {
+    // 解像度が変わったら履歴を捨てる
+    if ( depth.size() != work.size() ) {
+      resetHistory();
+    }
+    work.create( depth.rows, depth.cols, CV_16UC1 );
+
+    if ( filters & FILTER_TEMPORAL ) {
+      pushHistory( depth );
+      median( work );
+    }
+    else {
+      depth.copyTo( work );
+    }
+
+    if ( filters & FILTER_INPAINT ) {
+      inpaint( work );
+    }
+
+    if ( filters & FILTER_SMOOTH ) {
+      smooth( work );
+    }
+
+    return work;
+  }
+
+  // 処理ごとの速度を計測する
+  void benchmark( const cv::Mat& depth, std::ostream& out, int count = 100 )
+  {
+    cv::Mat src;
+    depth.copyTo( src );
+    work.create( src.rows, src.cols, CV_16UC1 );
+
+    int64 temporal = 0;
+    int64 fill = 0;
+    int64 smoothing = 0;
+    for ( int i = 0; i < count; ++i ) {
+      int64 start = cv::getTickCount();
+      pushHistory( src );
+      median( work );
+      temporal += cv::getTickCount() - start;
+
+      // 穴埋めと平滑化は処理前のデータで計測する
+      src.copyTo( work );
+      start = cv::getTickCount();
+      inpaint( work );
+      fill += cv::getTickCount() - start;
+
+      src.copyTo( work );
+      start = cv::getTickCount();
+      smooth( work );
+      smoothing += cv::getTickCount() - start;
+    }
+
+    resetHistory();
+
+    double pixels = (double)src.total() * count;
+    out << "  temporal(" << historySize << ") : " << toMegaPixels( pixels, temporal ) << " Mpixel/s"
+        << "  inpaint : " << toMegaPixels( pixels, fill ) << " Mpixel/s"
+        << "  smooth : " << toMegaPixels( pixels, smoothing ) << " Mpixel/s" << std::endl;
+  }
+
+private:
+
+  static double toMegaPixels( double pixels, int64 ticks )
+  {
+    double seconds = ticks / cv::getTickFrequency();
+    return (seconds > 0) ? (pixels / seconds / 1000000) : 0;
+  }
+
+  // 履歴にフレームを追加する(古いフレームのバッファを使いまわす)
+  void pushHistory( const cv::Mat& depth )
+  {
+    if ( (int)history.size() != historySize ) {
+      history.resize( historySize );
+      resetHistory();
+    }
+
+    depth.copyTo( history[historyHead] );
+    historyHead = (historyHead + 1) % historySize;
+    historyCount = (std::min)( historyCount + 1, historySize );
+  }
+
+  // 時間方向のメディアン
+  void median( cv::Mat& dst )
+  {
+    threadPool.parallelFor( dst.rows, ThreadPool::getBandRows( dst.cols * 2 * (historyCount + 1) ),
+                            MedianBand( history, historyCount, dst ) );
+  }
+
+  // 穴埋め(横方向の穴を埋めてから、残った縦方向の穴を埋める)
+  void inpaint( cv::Mat& depth )
+  {
+    threadPool.parallelFor( depth.rows, ThreadPool::getBandRows( depth.cols * 2 ),
+                            FillBand( depth, maxGap, false ) );
+
+    // 縦方向は列のバンドに分ける(1 バンドの列が同じキャッシュラインに乗るように)
+    threadPool.parallelFor( depth.cols, 32, FillBand( depth, maxGap, true ) );
+  }
+
+  // エッジを残す平滑化(横方向の結果を中間バッファに書き、縦方向で元に戻す)
+  void smooth( cv::Mat& depth )
+  {
+    temp.create( depth.rows, depth.cols, CV_16UC1 );
+
+    int bandRows = ThreadPool::getBandRows( depth.cols * 2 );
+    threadPool.parallelFor( depth.rows, bandRows,
+                            SmoothBand( depth, temp, spatialWeights, rangeWeights, false ) );
+    threadPool.parallelFor( depth.rows, bandRows,
+                            SmoothBand( temp, depth, spatialWeights, rangeWeights, true ) );
+  }
+
+  // バンドごとの時間方向のメディアン
+  struct MedianBand
+  {
+    MedianBand( const std::vector<cv::Mat>& history, int count, cv::Mat& dst )
+      : history( history ), count( count ), dst( dst )
+    {
+    }
+
+    void operator()( int begin, int end ) const
+    {
+      const unsigned short* rows[9];
+      unsigned short values[9];
+
+      for ( int y = begin; y < end; ++y ) {
+        for ( int i = 0; i < count; ++i ) {
+          rows[i] = history[i].ptr<unsigned short>( y );
+        }
+
+        unsigned short* out = dst.ptr<unsigned short>( y );
+        for ( int x = 0; x < dst.cols; ++x ) {
+          // 距離のある値だけを挿入ソートで並べる(最大 9 個なので十分速い)
+          int valid = 0;
+          for ( int i = 0; i < count; ++i ) {
+            unsigned short v = rows[i][x];
+            if ( v == 0 ) {
+              continue;
+            }
+
+            int j = valid++;
+            for ( ; (j > 0) && (values[j - 1] > v); --j ) {
+              values[j] = values[j - 1];
+            }
+            values[j] = v;
+          }
+
+          out[x] = (valid != 0) ? values[valid / 2] : 0;
+        }
+      }
+    }
+
+    const std::vector<cv::Mat>& history;
+    int count;
+    cv::Mat& dst;
+  };
+
+  // バンドごとの穴埋め(vertical なら begin 列目から end 列目の手前までを縦に処理する)
+  struct FillBand
+  {
+    FillBand( cv::Mat& depth, int maxGap, bool vertical )
+      : depth( depth ), maxGap( maxGap ), vertical( vertical )
+    {
+    }
+
+    void operator()( int begin, int end ) const
+    {
+      unsigned short* data = depth.ptr<unsigned short>( 0 );
+      int step = (int)(depth.step / sizeof(unsigned short));
+      for ( int i = begin; i < end; ++i ) {
+        if ( vertical ) {
+          fill( data + i, depth.rows, step );
+        }
+        else {
+          fill( data + (i * step), depth.cols, 1 );
+        }
+      }
+    }
+
+    // 両端に距離のある、maxGap 以下の幅の穴を埋める
+    // 手前の物体が広がらないよう、両端のうち遠いほうの値で埋める。
+    // 画面の端につながる穴は、埋める根拠がないのでそのままにする
+    void fill( unsigned short* line, int length, int step ) const
+    {
+      int last = -1;
+      for ( int i = 0; i < length; ++i ) {
+        unsigned short v = line[i * step];
+        if ( v == 0 ) {
+          continue;
+        }
+
+        int gap = i - last - 1;
+        if ( (last >= 0) && (gap > 0) && (gap <= maxGap) ) {
+          unsigned short value = (std::max)( line[last * step], v );
+          for ( int j = last + 1; j < i; ++j ) {
+            line[j * step] = value;
+          }
+        }
+
+        last = i;
+      }
+    }
+
+    cv::Mat& depth;
+    int maxGap;
+    bool vertical;
+  };
+
+  // バンドごとのエッジを残す平滑化(横または縦の 1 方向)
+  //
+  // 中心との距離の差が小さいピクセルほど重くして平均する(バイラテラルフィルタを
+  // 横と縦に分けた近似)。重みは整数にして、内側のループに分岐を置いていない
+  struct SmoothBand
+  {
+    SmoothBand( const cv::Mat& src, cv::Mat& dst,
+                const std::vector<int>& spatial, const std::vector<int>& range, bool vertical )
+      : src( src ), dst( dst ), spatial( spatial ), range( range ), vertical( vertical )
+    {
+    }
+
+    void operator()( int begin, int end ) const
+    {
+      int radius = (int)spatial.size() / 2;
+      int rangeMax = (int)range.size() - 1;
+      const unsigned short* taps[7];
+
+      for ( int y = begin; y < end; ++y ) {
+        const unsigned short* center = src.ptr<unsigned short>( y );
+        unsigned short* out = dst.ptr<unsigned short>( y );
+
+        // 縦方向は上下の行を、横方向は同じ行を参照する
+        for ( int k = -radius; k <= radius; ++k ) {
+          int row = vertical ? (std::min)( (std::max)( y + k, 0 ), src.rows - 1 ) : y;
+          taps[k + radius] = src.ptr<unsigned short>( row );
+        }
+
+        for ( int x = 0; x < src.cols; ++x ) {
+          int c = center[x];
+          int sum = 0;
+          int weight = 0;
+          for ( int k = -radius; k <= radius; ++k ) {
+            int sx = vertical ? x : (std::min)( (std::max)( x + k, 0 ), src.cols - 1 );
+            int v = taps[k + radius][sx];
+            int diff = (std::min)( std::abs( v - c ), rangeMax );
+            int w = spatial[k + radius] * range[diff] * (v != 0);
+            sum += w * v;
+            weight += w;
+          }
+
+          // 距離のないピクセルは 0 のまま(中心の重みがあるので weight は 0 にならない)
+          out[x] = (c == 0) ? 0 : (unsigned short)((sum + (weight / 2)) / weight);
+        }
+      }
+    }
+
+    const cv::Mat& src;
+    cv::Mat& dst;
+    const std::vector<int>& spatial;
+    const std::vector<int>& range;
+    bool vertical;
+  };
+
+private:
+
+  ThreadPool& threadPool;             // 並列処理に使うスレッド
+  int filters;                        // 行う処理
+
+  std::vector<cv::Mat> history;       // 時間方向のメディアンの履歴
+  int historySize;                    // メディアンをとるフレーム数
+  int historyHead;                    // 次に書き込む履歴
+  int historyCount;                   // 履歴にあるフレーム数
+
+  int maxGap;                         // 穴埋めする最大の幅
+  int radius;                         // 平滑化の半径
+  std::vector<int> spatialWeights;    // 位置の重み
+  std::vector<int> rangeWeights;      // 距離の差の重み
+
+  cv::Mat work;                       // 処理結果(フレーム間で使いまわす)
+  cv::Mat temp;                       // 平滑化の中間バッファ
+};
+
+#endif
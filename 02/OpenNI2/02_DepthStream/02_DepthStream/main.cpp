@@ -4,10 +4,21 @@
 #include <OpenNI.h>
 #include <opencv2/opencv.hpp>
 
+#include "ThreadPool.h"
+#include "DepthFilter.h"
+#include "PixelConverter.h"
+
 class DepthSensor
 {
 public:
   
+  DepthSensor()
+    : depthFilter( threadPool )
+    , isFilterEnabled( false )
+    , depthConverter( CV_8UC1 )
+  {
+  }
+  
   void initialize()
   {
     // デバイスを取得する
@@ -18,12 +29,12 @@ public:
     
     // カラーストリームを有効にする
     colorStream.create( device, openni::SENSOR_COLOR );
-    changeResolution( colorStream );
+    changeResolution( colorStream, 640, 480 );
     colorStream.start();
     
     // Depth ストリームを有効にする
     depthStream.create( device, openni::SENSOR_DEPTH );
-    changeResolution( depthStream );
+    changeResolution( depthStream, 640, 480 );
     depthStream.start();
   }
   
@@ -45,26 +56,137 @@ public:
     cv::imshow( "Depth Stream", depthImage );
   }
   
+  // カラーストリームの解像度を VGA(640x480) と SXGA(1280x1024) で切り替える
+  void changeColorResolution()
+  {
+    int width = (colorStream.getVideoMode().getResolutionX() == 640) ? 1280 : 640;
+    int height = (width == 640) ? 480 : 1024;
+    
+    // 動作中に解像度を変更できないデバイスがあるので、一度止める
+    colorStream.stop();
+    changeResolution( colorStream, width, height );
+    colorStream.start();
+  }
+  
+  // Depth データの前処理(穴埋めや平滑化)を切り替える
+  void changeFilter()
+  {
+    isFilterEnabled = !isFilterEnabled;
+    depthFilter.resetHistory();
+    std::cout << "Depth filter : " << (isFilterEnabled ? "on" : "off") << std::endl;
+  }
+  
+  // 変換処理の速度をスレッド数を変えて計測する
+  void benchmark()
+  {
+    // 計測用のフレームを取得する
+    openni::VideoFrameRef colorFrame;
+    openni::VideoFrameRef depthFrame;
+    colorStream.readFrame( &colorFrame );
+    depthStream.readFrame( &depthFrame );
+    
+    const int count = 100;
+    std::cout << "Benchmark color " << colorFrame.getWidth() << "x" << colorFrame.getHeight()
+              << ", depth " << depthFrame.getWidth() << "x" << depthFrame.getHeight() << std::endl;
+    
+    for ( int threads = 1; threads <= threadPool.getThreadCount(); ++threads ) {
+      threadPool.setActiveThreads( threads );
+      
+      // 空の処理で、1 回の並列処理にかかる時間を計測する
+      int64 start = cv::getTickCount();
+      for ( int i = 0; i < count; ++i ) {
+        threadPool.parallelFor( threads * 4, 1, EmptyBand() );
+      }
+      double overhead = (cv::getTickCount() - start) * 1000000.0 / cv::getTickFrequency() / count;
+      
+      // カラーの変換
+      start = cv::getTickCount();
+      for ( int i = 0; i < count; ++i ) {
+        showColorStream( colorFrame );
+      }
+      double color = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() / count;
+      
+      // Depth の変換
+      start = cv::getTickCount();
+      for ( int i = 0; i < count; ++i ) {
+        showDepthStream( depthFrame );
+      }
+      double depth = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() / count;
+      
+      std::cout << " threads : " << threads
+                << "  color : " << color << " ms"
+                << "  depth : " << depth << " ms"
+                << "  overhead : " << overhead << " us" << std::endl;
+      
+      // Depth の前処理
+      depthFilter.benchmark( cv::Mat( depthFrame.getHeight(), depthFrame.getWidth(),
+                                      CV_16UC1, (unsigned short*)depthFrame.getData() ),
+                             std::cout );
+    }
+    
+    // すべてのスレッドを使う設定に戻す
+    threadPool.setActiveThreads( threadPool.getThreadCount() );
+  }
+  
 private:
   
-  void changeResolution( openni::VideoStream& stream )
+  // 何もしないバンド処理(スレッドプールのオーバーヘッドの計測用)
+  struct EmptyBand
+  {
+    void operator()( int, int ) const
+    {
+    }
+  };
+  
+  // 指定した解像度のビデオモードのうち、最もフレームレートの高いものに変更する
+  void changeResolution( openni::VideoStream& stream, int width, int height )
   {
-    openni::VideoMode mode = stream.getVideoMode();
-    mode.setResolution( 640, 480 );
-    mode.setFps( 30 );
-    stream.setVideoMode( mode );
+    openni::VideoMode current = stream.getVideoMode();
+    const openni::Array<openni::VideoMode>& modes =
+      stream.getSensorInfo().getSupportedVideoModes();
+    
+    int found = -1;
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      if ( (modes[i].getResolutionX() == width) &&
+           (modes[i].getResolutionY() == height) &&
+           (modes[i].getPixelFormat() == current.getPixelFormat()) &&
+           ((found < 0) || (modes[i].getFps() > modes[found].getFps())) ) {
+        found = i;
+      }
+    }
+    
+    if ( found < 0 ) {
+      std::cout << "Unsupported resolution : " << width << "x" << height << std::endl;
+      return;
+    }
+    
+    openni::Status ret = stream.setVideoMode( modes[found] );
+    if ( ret != openni::STATUS_OK ) {
+      std::cout << "openni::VideoStream::setVideoMode() failed : "
+                << openni::OpenNI::getExtendedError() << std::endl;
+    }
   }
   
   // カラーストリームを表示できる形に変換する
   cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
   {
+    // RGB888 以外は、ピクセルフォーマットに合わせて BGR の画像に変換する
+    if ( colorFrame.getVideoMode().getPixelFormat() != openni::PIXEL_FORMAT_RGB888 ) {
+      return colorConverter.convert( colorFrame );
+    }
+    
     // OpenCV の形に変換する
-    cv::Mat colorImage = cv::Mat( colorFrame.getHeight(),
-                                 colorFrame.getWidth(),
-                                 CV_8UC3, (unsigned char*)colorFrame.getData() );
+    cv::Mat rgbImage = cv::Mat( colorFrame.getHeight(),
+                               colorFrame.getWidth(),
+                               CV_8UC3, (unsigned char*)colorFrame.getData() );
+    
+    // 変換先の画像は使いまわす
+    colorBuffer.create( rgbImage.rows, rgbImage.cols, CV_8UC3 );
+    cv::Mat& colorImage = colorBuffer;
     
-    // BGR の並びを RGB に変換する
-    cv::cvtColor( colorImage, colorImage, CV_RGB2BGR );
+    // BGR の並びを RGB に変換する(行のバンドごとに並列に処理する)
+    threadPool.parallelFor( rgbImage.rows, ThreadPool::getBandRows( rgbImage.cols * 3 ),
+                           ConvertBand( rgbImage, colorImage, CV_RGB2BGR ) );
     
     return colorImage;
   }
@@ -72,13 +194,30 @@ private:
   // Depth ストリームを表示できる形に変換する
   cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
   {
+    // 前処理は mm 単位の Depth を前提にしているので、それ以外は前処理をせずに変換する
+    if ( depthFrame.getVideoMode().getPixelFormat() != openni::PIXEL_FORMAT_DEPTH_1_MM ) {
+      cv::Mat depthImage = depthConverter.convert( depthFrame );
+      showCenterDistance( depthImage, depthFrame );
+      return depthImage;
+    }
+    
     // 距離データを画像化する(16bit)
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                 depthFrame.getWidth(),
-                                 CV_16UC1, (unsigned short*)depthFrame.getData() );
+    cv::Mat rawImage = cv::Mat( depthFrame.getHeight(),
+                               depthFrame.getWidth(),
+                               CV_16UC1, (unsigned short*)depthFrame.getData() );
+    
+    // 穴埋めや平滑化をする(結果はフィルタ内のバッファを使いまわす)
+    if ( isFilterEnabled ) {
+      rawImage = depthFilter.apply( rawImage );
+    }
     
-    // 0-10000mmまでのデータを0-255(8bit)にする
-    depthImage.convertTo( depthImage, CV_8U, 255.0 / 10000 );
+    // 変換先の画像は使いまわす
+    depthBuffer.create( rawImage.rows, rawImage.cols, CV_8UC1 );
+    cv::Mat& depthImage = depthBuffer;
+    
+    // 0-10000mmまでのデータを0-255(8bit)にする(行のバンドごとに並列に処理する)
+    threadPool.parallelFor( rawImage.rows, ThreadPool::getBandRows( rawImage.cols * 2 ),
+                           ScaleBand( rawImage, depthImage, 255.0 / 10000 ) );
     
     // 中心点の距離を表示する
     showCenterDistance( depthImage, depthFrame );
@@ -104,6 +243,44 @@ private:
                 cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar( 255 ) );
   }
   
+  // バンドごとの色の並びの変換
+  struct ConvertBand
+  {
+    ConvertBand( const cv::Mat& src, cv::Mat& dst, int code )
+      : src( src ), dst( dst ), code( code )
+    {
+    }
+    
+    void operator()( int begin, int end ) const
+    {
+      cv::Mat dstBand = dst.rowRange( begin, end );
+      cv::cvtColor( src.rowRange( begin, end ), dstBand, code );
+    }
+    
+    const cv::Mat& src;
+    cv::Mat& dst;
+    int code;
+  };
+  
+  // バンドごとのビット数の変換
+  struct ScaleBand
+  {
+    ScaleBand( const cv::Mat& src, cv::Mat& dst, double scale )
+      : src( src ), dst( dst ), scale( scale )
+    {
+    }
+    
+    void operator()( int begin, int end ) const
+    {
+      cv::Mat dstBand = dst.rowRange( begin, end );
+      src.rowRange( begin, end ).convertTo( dstBand, CV_8U, scale );
+    }
+    
+    const cv::Mat& src;
+    cv::Mat& dst;
+    double scale;
+  };
+  
 private:
   
   openni::Device device;            // 使用するデバイス
@@ -112,6 +289,17 @@ private:
   
   cv::Mat colorImage;               // 表示用データ
   cv::Mat depthImage;               // Depth 表示用データ
+  
+  cv::Mat colorBuffer;              // カラーの変換先(フレーム間で使いまわす)
+  cv::Mat depthBuffer;              // Depth の変換先(フレーム間で使いまわす)
+  
+  ThreadPool threadPool;            // 変換処理を並列に行うスレッド
+  
+  DepthFilter depthFilter;          // Depth データの前処理
+  bool isFilterEnabled;             // 前処理を行うかどうか
+  
+  PixelConverter colorConverter;    // RGB888 以外のカラーの BGR への変換
+  PixelConverter depthConverter;    // mm 単位以外の Depth の 8bit への変換
 };
 
 int main(int argc, const char * argv[])
@@ -132,6 +320,18 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // カラーの解像度を切り替える
+      else if ( key == 'h' ) {
+        sensor.changeColorResolution();
+      }
+      // 変換処理の速度を計測する
+      else if ( key == 'b' ) {
+        sensor.benchmark();
+      }
+      // Depth データの前処理を切り替える
+      else if ( key == 'f' ) {
+        sensor.changeFilter();
+      }
     }
   }
   catch ( std::exception& ) {
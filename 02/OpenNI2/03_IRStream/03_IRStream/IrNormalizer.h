@@ -0,0 +1,205 @@
+#ifndef _IR_NORMALIZER_H_
+#define _IR_NORMALIZER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2/opencv.hpp>
+
+// IR(GRAY16 / GRAY8)のフレームを、明るさを自動で調整して 8bit にする
+//
+// Xtion の IR は 16bit だが実際は 8-10bit 程度、Kinect は 8bit と、
+// 機種によって有効なビット数が違う。そこで、フレームの値の論理和から有効なビット数を求め、
+// 1024 階調以下に丸めたヒストグラムの下位と上位のパーセンタイルを黒と白に割り当てる。
+// 変換は表(LUT)を引くだけにして、ガンマ補正も表に含める。
+// 8bit と 16bit は同じテンプレートの処理で扱う
+class IrNormalizer
+{
+public:
+
+  IrNormalizer()
+    : autoRange( true )
+    , gamma( 1.0 )
+    , lowPercent( 1.0 )
+    , highPercent( 99.0 )
+    , bitDepth( 0 )
+    , low( -1 )
+    , high( -1 )
+  {
+  }
+
+  // ヒストグラムで明るさを調整するかどうか(しなければ有効なビット数の全体を使う)
+  void setAutoRange( bool enable )
+  {
+    autoRange = enable;
+  }
+
+  bool isAutoRange() const
+  {
+    return autoRange;
+  }
+
+  // ガンマ値(1 より小さいと暗い部分が明るくなる)
+  void setGamma( double gamma )
+  {
+    this->gamma = gamma;
+  }
+
+  double getGamma() const
+  {
+    return gamma;
+  }
+
+  // 黒と白に割り当てるパーセンタイル
+  void setPercentile( double lowPercent, double highPercent )
+  {
+    this->lowPercent = lowPercent;
+    this->highPercent = highPercent;
+  }
+
+  // 最後に処理したフレームの有効なビット数
+  int getBitDepth() const
+  {
+    return bitDepth;
+  }
+
+  // IR フレームを 8bit の画像にする(結果は次の呼び出しまで有効)
+  const cv::Mat& normalize( const openni::VideoFrameRef& irFrame )
+  {
+    if ( irFrame.getVideoMode().getPixelFormat() == openni::PIXEL_FORMAT_GRAY16 ) {
+      process<unsigned short>( wrap( irFrame, CV_16UC1 ) );
+    }
+    else {
+      process<unsigned char>( wrap( irFrame, CV_8UC1 ) );
+    }
+
+    return image;
+  }
+
+  // IR フレームを 16bit のまま取り出す(解析用。GRAY16 はコピーせずに参照する)
+  cv::Mat getRaw( const openni::VideoFrameRef& irFrame )
+  {
+    if ( irFrame.getVideoMode().getPixelFormat() == openni::PIXEL_FORMAT_GRAY16 ) {
+      return wrap( irFrame, CV_16UC1 );
+    }
+
+    wrap( irFrame, CV_8UC1 ).convertTo( raw, CV_16U );
+    return raw;
+  }
+
+private:
+
+  static cv::Mat wrap( const openni::VideoFrameRef& irFrame, int type )
+  {
+    return cv::Mat( irFrame.getHeight(), irFrame.getWidth(), type,
+                    (void*)irFrame.getData(), irFrame.getStrideInBytes() );
+  }
+
+  template<typename T>
+  void process( const cv::Mat& src )
+  {
+    // 値の論理和から有効なビット数を求める(分岐のないループなのでベクトル化される)
+    unsigned int bits = 0;
+    for ( int y = 0; y < src.rows; ++y ) {
+      const T* row = src.ptr<T>( y );
+      for ( int x = 0; x < src.cols; ++x ) {
+        bits |= row[x];
+      }
+    }
+
+    bitDepth = 1;
+    while ( (bits >> bitDepth) != 0 ) {
+      ++bitDepth;
+    }
+
+    // ヒストグラムは 1024 階調以下に丸める
+    int shift = (std::max)( bitDepth - 10, 0 );
+    int bins = 1 << (bitDepth - shift);
+    histogram.assign( bins, 0 );
+    for ( int y = 0; y < src.rows; ++y ) {
+      const T* row = src.ptr<T>( y );
+      for ( int x = 0; x < src.cols; ++x ) {
+        ++histogram[row[x] >> shift];
+      }
+    }
+
+    updateRange( bins, (int)src.total() );
+    updateTable( bins );
+
+    // 表を引いて 8bit にする
+    image.create( src.rows, src.cols, CV_8UC1 );
+    const unsigned char* lut = &table[0];
+    for ( int y = 0; y < src.rows; ++y ) {
+      const T* row = src.ptr<T>( y );
+      unsigned char* dst = image.ptr( y );
+      for ( int x = 0; x < src.cols; ++x ) {
+        dst[x] = lut[row[x] >> shift];
+      }
+    }
+  }
+
+  // 黒と白に割り当てる階調を求める(ちらつかないよう、前のフレームとならす)
+  void updateRange( int bins, int total )
+  {
+    int newLow = 0;
+    int newHigh = bins - 1;
+    if ( autoRange ) {
+      int lowCount = (int)(total * lowPercent / 100);
+      int highCount = (int)(total * highPercent / 100);
+
+      int sum = 0;
+      newHigh = -1;
+      for ( int i = 0; i < bins; ++i ) {
+        sum += histogram[i];
+        if ( sum <= lowCount ) {
+          newLow = i;
+        }
+        if ( (newHigh < 0) && (sum >= highCount) ) {
+          newHigh = i;
+        }
+      }
+      newHigh = (std::max)( newHigh, newLow + 1 );
+    }
+
+    // 階調の数が変わったとき(ビット数が変わったとき)は、ならさない
+    if ( (low < 0) || ((int)table.size() != bins) ) {
+      low = newLow;
+      high = newHigh;
+    }
+    else {
+      low = ((low * 3) + newLow) / 4;
+      high = ((high * 3) + newHigh + 3) / 4;
+    }
+  }
+
+  // 階調から 8bit の値への表を作る
+  void updateTable( int bins )
+  {
+    table.resize( bins );
+    double range = (std::max)( high - low, 1 );
+    for ( int i = 0; i < bins; ++i ) {
+      double v = (std::min)( (std::max)( (i - low) / range, 0.0 ), 1.0 );
+      table[i] = (unsigned char)(255 * std::pow( v, gamma ) + 0.5);
+    }
+  }
+
+private:
+
+  bool autoRange;                   // ヒストグラムで明るさを調整するか
+  double gamma;                     // ガンマ値
+  double lowPercent;                // 黒に割り当てるパーセンタイル
+  double highPercent;               // 白に割り当てるパーセンタイル
+
+  int bitDepth;                     // 有効なビット数
+  int low;                          // 黒に割り当てる階調
+  int high;                         // 白に割り当てる階調
+
+  std::vector<int> histogram;       // 階調ごとのピクセル数
+  std::vector<unsigned char> table; // 階調から 8bit の値への表
+  cv::Mat image;                    // 8bit の画像(フレーム間で使いまわす)
+  cv::Mat raw;                      // 16bit にした GRAY8 の画像(フレーム間で使いまわす)
+};
+
+#endif
@@ -4,10 +4,18 @@
 #include <OpenNI.h>
 #include <opencv2/opencv.hpp>
 
+#include "IrNormalizer.h"
+#include "PixelConverter.h"
+
 class DepthSensor
 {
 public:
   
+  DepthSensor()
+    : depthConverter( CV_8UC1 )
+  {
+  }
+  
   void initialize()
   {
     // デバイスを取得する
@@ -43,6 +51,23 @@ public:
     cv::imshow( "Depth Stream", depthImage );
   }
   
+  // IR の明るさの自動調整を切り替える
+  void changeAutoRange()
+  {
+    irNormalizer.setAutoRange( !irNormalizer.isAutoRange() );
+    std::cout << "Auto range : " << (irNormalizer.isAutoRange() ? "on" : "off")
+              << " (" << irNormalizer.getBitDepth() << " bit)" << std::endl;
+  }
+  
+  // IR のガンマ値を切り替える
+  void changeGamma()
+  {
+    double gamma = irNormalizer.getGamma();
+    gamma = (gamma >= 1.0) ? 0.7 : (gamma >= 0.7) ? 0.5 : 1.0;
+    irNormalizer.setGamma( gamma );
+    std::cout << "Gamma : " << gamma << std::endl;
+  }
+  
 private:
   
   // カラーストリームを表示できる形に変換する
@@ -50,34 +75,16 @@ private:
   {
     cv::Mat colorImage;
     
-    // Color ストリーム
-    if ( colorFrame.getVideoMode().getPixelFormat() ==
-        openni::PIXEL_FORMAT_RGB888 ) {
-      // OpenCV の形に変換する
-      colorImage = cv::Mat( colorFrame.getHeight(),
-                           colorFrame.getWidth(),
-                           CV_8UC3, (unsigned char*)colorFrame.getData() );
-      
-      // BGR の並びを RGB に変換する
-      cv::cvtColor( colorImage, colorImage, CV_RGB2BGR );
+    // Color ストリーム(ピクセルフォーマットに合わせて BGR の画像に変換する)
+    if ( colorFrame.getSensorType() != openni::SENSOR_IR ) {
+      colorImage = colorConverter.convert( colorFrame );
     }
-    // Xtion IR ストリーム
-    else if ( colorFrame.getVideoMode().getPixelFormat() ==
-             openni::PIXEL_FORMAT_GRAY16 ) {
-      // XitonのIRのフォーマットは16bitグレースケール
-      // 実際は255諧調らしく、CV_8Uに落とさないと見えない
-      colorImage = cv::Mat( colorFrame.getHeight(),
-                           colorFrame.getWidth(),
-                           CV_16UC1, (unsigned short*)colorFrame.getData() );
-      colorImage.convertTo( colorImage, CV_8U );
-    }
-    // Kinect for Windows IR ストリーム
+    // IR ストリーム
     else {
+      // XitonのIRのフォーマットは16bitグレースケール(実際は8-10bit程度)
       // KinectのIRのフォーマットは8bitグレースケール
-      // Kinect SDKは16bitグレースケール
-      colorImage = cv::Mat( colorFrame.getHeight(),
-                           colorFrame.getWidth(),
-                           CV_8UC1, (unsigned char*)colorFrame.getData() );
+      // どちらも有効なビット数を調べて、明るさを調整して8bitにする
+      colorImage = irNormalizer.normalize( colorFrame );
     }
     
     return colorImage;
@@ -86,15 +93,9 @@ private:
   // Depth ストリームを表示できる形に変換する
   cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
   {
-    // 距離データを画像化する(16bit)
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                 depthFrame.getWidth(),
-                                 CV_16U, (char*)depthFrame.getData() );
-    
     // 0-10000mmまでのデータを0-255(8bit)にする
-    depthImage.convertTo( depthImage, CV_8U, 255.0 / 10000 );
-    
-    return depthImage;
+    // (ピクセルフォーマットが 100um 単位でも、mm に合わせて変換する)
+    return depthConverter.convert( depthFrame );
   }
   
 private:
@@ -105,6 +106,10 @@ private:
   
   cv::Mat colorImage;               // 表示用データ
   cv::Mat depthImage;               // Depth 表示用データ
+  
+  IrNormalizer irNormalizer;        // IR の 8bit への変換
+  PixelConverter colorConverter;    // カラーの BGR への変換
+  PixelConverter depthConverter;    // Depth の 8bit への変換
 };
 
 int main(int argc, const char * argv[])
@@ -125,6 +130,14 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // IR の明るさの自動調整を切り替える
+      else if ( key == 'a' ) {
+        sensor.changeAutoRange();
+      }
+      // IR のガンマ値を切り替える
+      else if ( key == 'g' ) {
+        sensor.changeGamma();
+      }
     }
   }
   catch ( std::exception& ) {
@@ -0,0 +1,262 @@
+#ifndef _DEPTH_REGISTRATION_H_
+#define _DEPTH_REGISTRATION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2/opencv.hpp>
+
+#include "ThreadPool.h"
+
+// Depth データをカラーカメラの座標に合わせる(デバイスの機能を使わずに行う)
+//
+// Depth カメラとカラーカメラは平行に並び、位置だけがずれているとする
+// (Xtion や Kinect のハードウェアでの位置合わせも同じ考え方)。このとき、
+// Depth のピクセル (u, v, z) が写るカラーの位置は
+//   uc = colBase[u] + shiftX[z]
+//   vc = rowBase[v] + shiftY[z]
+// と、列ごと・行ごと・距離ごとの表の和になる。カラーカメラが Depth カメラから見て
+// (baselineX, baselineY) の位置にあれば、点はカラーカメラからは逆向きにずれて見えるので
+//   shiftX[z] = -colorFx * baselineX / z,  shiftY[z] = -colorFy * baselineY / z
+// となる。表は解像度と校正値ごとに一度だけ作り、
+// フレームごとの処理は表を引いて書き込むだけにする。
+// 複数の Depth が同じ位置に写るときは、手前(距離の小さいほう)を残す。
+// 写る位置は Depth の値で決まるので、カラーの側から Depth を引く(gather)形にはできない。
+// 表を引いて位置を求める部分だけを分岐のないループにしてベクトル化させ、
+// z バッファへの書き込み(scatter)は 1 ピクセルずつ行う
+class DepthRegistration
+{
+public:
+
+  // カメラの校正値
+  struct Calibration
+  {
+    float depthFx, depthFy, depthCx, depthCy;   // Depth カメラの焦点距離と中心(Depth 解像度のピクセル)
+    float colorFx, colorFy, colorCx, colorCy;   // カラーカメラの焦点距離と中心(カラー解像度のピクセル)
+    float baselineX, baselineY;                 // Depth カメラから見たカラーカメラの位置(mm、右と下が正)
+  };
+
+  DepthRegistration( ThreadPool& threadPool )
+    : threadPool( threadPool )
+    , hasCalibration( false )
+    , maxDepth( 10000 )
+    , depthWidth( 0 )
+    , depthHeight( 0 )
+    , colorWidth( 0 )
+    , colorHeight( 0 )
+    , minShiftY( 0 )
+    , maxShiftY( 0 )
+    , splatX( 1 )
+    , splatY( 1 )
+  {
+  }
+
+  // 校正値を設定する(表は次のフレームで作りなおす)
+  void setCalibration( const Calibration& calibration )
+  {
+    this->calibration = calibration;
+    hasCalibration = true;
+    depthWidth = 0;
+  }
+
+  // ストリームの画角から校正値を求める(校正していないときの目安)
+  // baselineX はカメラ間の距離(Xtion や Kinect は約 25mm)
+  void setCalibration( const openni::VideoStream& depthStream,
+                       const openni::VideoStream& colorStream, float baselineX = 25 )
+  {
+    openni::VideoMode depthMode = depthStream.getVideoMode();
+    openni::VideoMode colorMode = colorStream.getVideoMode();
+
+    Calibration c;
+    c.depthFx = (depthMode.getResolutionX() / 2.0f) / std::tan( depthStream.getHorizontalFieldOfView() / 2 );
+    c.depthFy = (depthMode.getResolutionY() / 2.0f) / std::tan( depthStream.getVerticalFieldOfView() / 2 );
+    c.depthCx = depthMode.getResolutionX() / 2.0f;
+    c.depthCy = depthMode.getResolutionY() / 2.0f;
+    c.colorFx = (colorMode.getResolutionX() / 2.0f) / std::tan( colorStream.getHorizontalFieldOfView() / 2 );
+    c.colorFy = (colorMode.getResolutionY() / 2.0f) / std::tan( colorStream.getVerticalFieldOfView() / 2 );
+    c.colorCx = colorMode.getResolutionX() / 2.0f;
+    c.colorCy = colorMode.getResolutionY() / 2.0f;
+    c.baselineX = baselineX;
+    c.baselineY = 0;
+    setCalibration( c );
+  }
+
+  // Depth フレームを、カラーの解像度の Depth 画像にする(結果は次の呼び出しまで有効)
+  const cv::Mat& apply( const openni::VideoFrameRef& depthFrame, int colorWidth, int colorHeight )
+  {
+    // 解像度が変わったら表を作りなおす
+    if ( (depthFrame.getWidth() != depthWidth) || (depthFrame.getHeight() != depthHeight) ||
+         (colorWidth != this->colorWidth) || (colorHeight != this->colorHeight) ) {
+      build( depthFrame.getWidth(), depthFrame.getHeight(), colorWidth, colorHeight );
+    }
+
+    cv::Mat depth( depthFrame.getHeight(), depthFrame.getWidth(), CV_16UC1,
+                   (void*)depthFrame.getData(), depthFrame.getStrideInBytes() );
+    registered.create( colorHeight, colorWidth, CV_16UC1 );
+
+    // 書き込み先の行のバンドごとに並列に処理する(バンドごとに書き込む範囲が分かれる)
+    threadPool.parallelFor( colorHeight, ThreadPool::getBandRows( colorWidth * 2 ),
+                            RegisterBand( *this, depth, registered ) );
+
+    return registered;
+  }
+
+private:
+
+  // 表を作る(固定小数点、256 が 1 ピクセル)
+  void build( int depthWidth, int depthHeight, int colorWidth, int colorHeight )
+  {
+    this->depthWidth = depthWidth;
+    this->depthHeight = depthHeight;
+    this->colorWidth = colorWidth;
+    this->colorHeight = colorHeight;
+
+    // 校正値が設定されていなければ、位置のずれのない同じ画角のカメラとする
+    Calibration c = calibration;
+    if ( !hasCalibration ) {
+      c.depthFx = c.depthFy = c.colorFx = c.colorFy = 1;
+      c.depthCx = c.depthCy = c.colorCx = c.colorCy = 0;
+      c.baselineX = c.baselineY = 0;
+    }
+
+    // Depth の解像度が校正値と違うときは、拡大縮小する
+    // (校正した解像度は、中心の 2 倍とする)
+    float depthScaleX = hasCalibration ? (depthWidth / (c.depthCx * 2)) : 1;
+    float depthScaleY = hasCalibration ? (depthHeight / (c.depthCy * 2)) : 1;
+    float colorScaleX = hasCalibration ? (colorWidth / (c.colorCx * 2)) : ((float)colorWidth / depthWidth);
+    float colorScaleY = hasCalibration ? (colorHeight / (c.colorCy * 2)) : ((float)colorHeight / depthHeight);
+
+    colBase.resize( depthWidth );
+    for ( int u = 0; u < depthWidth; ++u ) {
+      float x = ((u / depthScaleX) - c.depthCx) / c.depthFx;
+      colBase[u] = (int)(256 * (((c.colorFx * x) + c.colorCx) * colorScaleX));
+    }
+
+    rowBase.resize( depthHeight );
+    for ( int v = 0; v < depthHeight; ++v ) {
+      float y = ((v / depthScaleY) - c.depthCy) / c.depthFy;
+      rowBase[v] = (int)(256 * (((c.colorFy * y) + c.colorCy) * colorScaleY));
+    }
+
+    // 距離ごとのずれ(遠いほど小さい。カラーカメラのある向きと逆にずれる)
+    shiftX.resize( maxDepth + 1 );
+    shiftY.resize( maxDepth + 1 );
+    minShiftY = maxShiftY = 0;
+    for ( int z = 1; z <= maxDepth; ++z ) {
+      shiftX[z] = (int)(256 * (-c.colorFx * colorScaleX * c.baselineX / z));
+      shiftY[z] = (int)(256 * (-c.colorFy * colorScaleY * c.baselineY / z));
+      minShiftY = (std::min)( minShiftY, shiftY[z] );
+      maxShiftY = (std::max)( maxShiftY, shiftY[z] );
+    }
+    shiftX[0] = shiftY[0] = 0;
+
+    // Depth の 1 ピクセルがカラーで何ピクセルになるか(その分だけ塗って隙間をなくす)
+    splatX = (std::max)( (int)std::ceil( (float)colorWidth / depthWidth ), 1 );
+    splatY = (std::max)( (int)std::ceil( (float)colorHeight / depthHeight ), 1 );
+  }
+
+  // 書き込み先の行のバンドごとの位置合わせ
+  struct RegisterBand
+  {
+    // 位置をまとめて求めるピクセル数(スタックに置く)
+    enum { CHUNK = 256 };
+
+    RegisterBand( const DepthRegistration& r, const cv::Mat& depth, cv::Mat& dst )
+      : r( r ), depth( depth ), dst( dst )
+    {
+    }
+
+    void operator()( int begin, int end ) const
+    {
+      for ( int y = begin; y < end; ++y ) {
+        unsigned short* row = dst.ptr<unsigned short>( y );
+        std::fill( row, row + dst.cols, 0 );
+      }
+
+      for ( int v = 0; v < depth.rows; ++v ) {
+        // このバンドに写る可能性のない行は飛ばす
+        int top = (r.rowBase[v] + r.minShiftY + 128) >> 8;
+        int bottom = ((r.rowBase[v] + r.maxShiftY + 128) >> 8) + r.splatY;
+        if ( (bottom <= begin) || (top >= end) ) {
+          continue;
+        }
+
+        const unsigned short* src = depth.ptr<unsigned short>( v );
+        const int* colBase = &r.colBase[0];
+        const int* shiftX = &r.shiftX[0];
+        const int* shiftY = &r.shiftY[0];
+        int rowBase = r.rowBase[v];
+        int maxDepth = r.maxDepth;
+
+        for ( int u0 = 0; u0 < depth.cols; u0 += CHUNK ) {
+          int count = (std::min)( (int)CHUNK, depth.cols - u0 );
+
+          // 表を引いてカラーの位置を求める(分岐のないループなので、ベクトル化される。
+          // 距離が 0 のピクセルは、ずれ 0 の表の先頭を引く)
+          int ucs[CHUNK];
+          int vcs[CHUNK];
+          for ( int i = 0; i < count; ++i ) {
+            int index = (std::min)( (int)src[u0 + i], maxDepth );
+            ucs[i] = (colBase[u0 + i] + shiftX[index] + 128) >> 8;
+            vcs[i] = (rowBase + shiftY[index] + 128) >> 8;
+          }
+
+          for ( int i = 0; i < count; ++i ) {
+            int z = src[u0 + i];
+            if ( z == 0 ) {
+              continue;
+            }
+
+            // 手前のものを残す(z バッファ)
+            for ( int dy = 0; dy < r.splatY; ++dy ) {
+              int y = vcs[i] + dy;
+              if ( (y < begin) || (y >= end) ) {
+                continue;
+              }
+
+              unsigned short* row = dst.ptr<unsigned short>( y );
+              for ( int dx = 0; dx < r.splatX; ++dx ) {
+                int x = ucs[i] + dx;
+                if ( (x >= 0) && (x < dst.cols) && ((row[x] == 0) || (z < row[x])) ) {
+                  row[x] = (unsigned short)z;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    const DepthRegistration& r;
+    const cv::Mat& depth;
+    cv::Mat& dst;
+  };
+
+private:
+
+  ThreadPool& threadPool;       // 並列処理に使うスレッド
+
+  Calibration calibration;      // カメラの校正値
+  bool hasCalibration;          // 校正値が設定されているか
+  int maxDepth;                 // 表を作る最大の距離(これより遠いものは同じずれとする)
+
+  int depthWidth;               // 表を作った Depth の幅
+  int depthHeight;              // 表を作った Depth の高さ
+  int colorWidth;               // 表を作ったカラーの幅
+  int colorHeight;              // 表を作ったカラーの高さ
+
+  std::vector<int> colBase;     // 列ごとのカラーの x 座標
+  std::vector<int> rowBase;     // 行ごとのカラーの y 座標
+  std::vector<int> shiftX;      // 距離ごとの x 方向のずれ
+  std::vector<int> shiftY;      // 距離ごとの y 方向のずれ
+  int minShiftY;                // y 方向のずれの最小値
+  int maxShiftY;                // y 方向のずれの最大値
+  int splatX;                   // 1 ピクセルを塗る幅
+  int splatY;                   // 1 ピクセルを塗る高さ
+
+  cv::Mat registered;           // 位置合わせした Depth 画像(フレーム間で使いまわす)
+};
+
+#endif
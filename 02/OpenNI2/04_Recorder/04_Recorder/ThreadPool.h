@@ -0,0 +1,222 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 画像の行を帯(バンド)に分けて、複数のスレッドで処理するためのスレッドプール
+//
+// スレッドは最初に作ったものを使いまわし、1 回の parallelFor() ごとに
+// 起こすだけにしている。各スレッド(呼び出し元のスレッドも含む)は
+// 処理していないバンドを 1 つずつ取りにいくので、早く終わったスレッドが
+// 残りのバンドを引き受けることになる。
+// バンドは「世代(parallelFor() の呼び出し回数)とバンドの番号」を 1 つの 64 ビットの値で取り合うので、
+// 前の呼び出しのバンドを次の呼び出しで取ってしまうことはない。
+// parallelFor() は、参加したスレッドがすべて処理を抜けるまで戻らない
+class ThreadPool
+{
+public:
+
+  // バンドの処理(begin 行目から end 行目の手前まで)
+  typedef std::function<void( int begin, int end )> BandFunction;
+
+  explicit ThreadPool( int threadCount = 0 )
+    : activeThreads( 0 )
+    , body( 0 )
+    , generation( 0 )
+    , bandCount( 0 )
+    , bandRows( 1 )
+    , rows( 0 )
+    , nextBand( 0 )
+    , finished( 0 )
+    , busy( 0 )
+    , exiting( false )
+  {
+    // 指定がなければ CPU のコア数だけ使う(呼び出し元のスレッドも処理する)
+    if ( threadCount <= 0 ) {
+      threadCount = (std::max)( (int)std::thread::hardware_concurrency(), 1 );
+    }
+
+    for ( int i = 1; i < threadCount; ++i ) {
+      workers.push_back( std::thread( &ThreadPool::run, this, i ) );
+    }
+
+    activeThreads = threadCount;
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      exiting = true;
+    }
+    wakeup.notify_all();
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+      workers[i].join();
+    }
+  }
+
+  // 使えるスレッドの数(呼び出し元のスレッドを含む)
+  int getThreadCount() const
+  {
+    return (int)workers.size() + 1;
+  }
+
+  // 処理に参加させるスレッドの数を制限する(性能の計測用)
+  void setActiveThreads( int count )
+  {
+    activeThreads = (std::min)( (std::max)( count, 1 ), getThreadCount() );
+  }
+
+  int getActiveThreads() const
+  {
+    return activeThreads;
+  }
+
+  // 1 行のバイト数から、キャッシュに収まるバンドの行数を求める
+  static int getBandRows( int bytesPerRow, int cacheBytes = 64 * 1024 )
+  {
+    return (std::max)( cacheBytes / (std::max)( bytesPerRow, 1 ), 1 );
+  }
+
+  // rows 行を bandRows 行ずつのバンドに分けて、並列に処理する
+  void parallelFor( int rows, int bandRows, const BandFunction& body )
+  {
+    int bands = (rows + bandRows - 1) / bandRows;
+
+    // 1 スレッドまたはバンドが 1 つなら、呼び出し元のスレッドで処理する
+    if ( (activeThreads <= 1) || (bands <= 1) ) {
+      body( 0, rows );
+      return;
+    }
+
+    // 設定は参加しているスレッドがいないときに変える
+    // (前の呼び出しが終わってから起きたスレッドが、まだ残っていることがある。
+    //  スレッドはロックを取ってから起きるので、ここで設定した値が見える)
+    unsigned int current;
+    {
+      std::unique_lock<std::mutex> lock( mutex );
+      while ( busy > 0 ) {
+        done.wait( lock );
+      }
+
+      current = ++generation;
+      finished = 0;
+      this->body = &body;
+      this->rows = rows;
+      this->bandRows = bandRows;
+      bandCount = bands;
+      nextBand = (unsigned long long)current << 32;
+    }
+    wakeup.notify_all();
+
+    // 呼び出し元のスレッドもバンドを処理する
+    int count = processBands( current );
+
+    // すべてのバンドが終わり、参加したスレッドがすべて抜けるのを待つ
+    // (まだ body を呼んでいるスレッドがあるうちに戻ると、body が先に消えてしまう)
+    std::unique_lock<std::mutex> lock( mutex );
+    finished += count;
+    while ( (finished < bandCount) || (busy > 0) ) {
+      done.wait( lock );
+    }
+    this->body = 0;
+  }
+
+private:
+
+  void run( int index )
+  {
+    unsigned int seen = 0;
+    while ( true ) {
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        while ( !exiting && (generation == seen) ) {
+          wakeup.wait( lock );
+        }
+
+        if ( exiting ) {
+          return;
+        }
+
+        seen = generation;
+
+        // 参加しないスレッドは次の処理を待つ
+        if ( index >= activeThreads ) {
+          continue;
+        }
+
+        // 参加するスレッドを数える(抜けるまで parallelFor() は戻らない)
+        ++busy;
+      }
+
+      int count = processBands( seen );
+
+      std::lock_guard<std::mutex> lock( mutex );
+      finished += count;
+      --busy;
+      if ( (finished >= bandCount) && (busy == 0) ) {
+        done.notify_one();
+      }
+    }
+  }
+
+  // 世代 current の処理していないバンドを取り出して処理し、処理した数を返す
+  int processBands( unsigned int current )
+  {
+    int count = 0;
+    unsigned long long claim = nextBand.load();
+    while ( true ) {
+      // 世代が違えば、その呼び出しのバンドはもう残っていない
+      if ( (unsigned int)(claim >> 32) != current ) {
+        break;
+      }
+
+      int band = (int)(claim & 0xffffffffull);
+      if ( band >= bandCount ) {
+        break;
+      }
+
+      // 世代とバンドの番号をまとめて取る(ほかのスレッドに取られたら取りなおす)
+      if ( !nextBand.compare_exchange_weak( claim, claim + 1 ) ) {
+        continue;
+      }
+
+      int begin = band * bandRows;
+      (*body)( begin, (std::min)( begin + bandRows, rows ) );
+      ++count;
+      claim = nextBand.load();
+    }
+
+    return count;
+  }
+
+private:
+
+  std::vector<std::thread> workers;       // 処理スレッド
+  std::atomic<int> activeThreads;         // 処理に参加するスレッドの数
+
+  std::mutex mutex;
+  std::condition_variable wakeup;         // 処理の開始の通知
+  std::condition_variable done;           // 処理の終了の通知
+
+  // 以下の 4 つは、参加するスレッドがいないときに mutex の中で設定する
+  const BandFunction* body;               // バンドの処理
+  unsigned int generation;                // parallelFor() の呼び出し回数(世代)
+  int bandCount;                          // バンドの数
+  int bandRows;                           // 1 バンドの行数
+  int rows;                               // 全体の行数
+
+  std::atomic<unsigned long long> nextBand; // 次に処理するバンド(上位 32 ビットが世代)
+  int finished;                           // 処理の終わったバンドの数
+  int busy;                               // 処理しているスレッドの数(呼び出し元を除く)
+  bool exiting;                           // 終了するかどうか
+};
+
+#endif
@@ -4,16 +4,26 @@
 #include <OpenNI.h>
 #include <opencv2/opencv.hpp>
 
+#include "ThreadPool.h"
+#include "DepthRegistration.h"
+#include "PixelConverter.h"
+
 class DepthSensor
 {
 public:
   
-  void initialize()
+  DepthSensor()
+    : registration( threadPool )
+    , isRegistrationEnabled( false )
+    , depthConverter( CV_8UC1 )
+  {
+  }
+  
+  // uri にファイル名を指定すると、記録したストリームデータを再生する
+  void initialize( const char* uri = openni::ANY_DEVICE )
   {
     // デバイスを取得する
-    openni::Status ret = device.open( openni::ANY_DEVICE );
-    // ストリームデータを再生する
-    //openni::Status ret = device.open( "record.oni" );
+    openni::Status ret = device.open( uri );
     if ( ret != openni::STATUS_OK ) {
       throw std::runtime_error( "openni::Device::open() failed." );
     }
@@ -26,6 +36,9 @@ public:
     depthStream.create( device, openni::SENSOR_DEPTH );
     depthStream.start();
     
+    // Depth とカラーの位置合わせは、ストリームの画角から求めた値で行う
+    registration.setCalibration( depthStream, colorStream );
+    
     // ストリームデータを記録する
     //recorder.create( "record.oni" );
     //recorder.attach( colorStream );
@@ -49,6 +62,20 @@ public:
     // フレームのデータを表示する
     cv::imshow( "Color Stream", colorImage );
     cv::imshow( "Depth Stream", depthImage );
+    
+    // Depth をカラーに合わせて重ねて表示する
+    if ( isRegistrationEnabled ) {
+      cv::imshow( "Registration", showRegistration( depthFrame, colorImage ) );
+    }
+  }
+  
+  // Depth とカラーの位置合わせの表示を切り替える
+  void changeRegistration()
+  {
+    isRegistrationEnabled = !isRegistrationEnabled;
+    if ( !isRegistrationEnabled ) {
+      cv::destroyWindow( "Registration" );
+    }
   }
   
 private:
@@ -56,29 +83,38 @@ private:
   // カラーストリームを表示できる形に変換する
   cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
   {
-    // OpenCV の形に変換する
-    cv::Mat colorImage = cv::Mat( colorFrame.getHeight(),
-                                 colorFrame.getWidth(),
-                                 CV_8UC3, (unsigned char*)colorFrame.getData() );
+    // ピクセルフォーマットに合わせて BGR の画像に変換する
+    // (変換先はフレーム間で使いまわすので、次のフレームまで有効)
+    return colorConverter.convert( colorFrame );
+  }
+  
+  // 位置合わせした Depth をカラー画像に重ねる
+  cv::Mat showRegistration( const openni::VideoFrameRef& depthFrame, const cv::Mat& colorImage )
+  {
+    const cv::Mat& registered = registration.apply( depthFrame, colorImage.cols, colorImage.rows );
     
-    // BGR の並びを RGB に変換する
-    cv::cvtColor( colorImage, colorImage, CV_BGR2RGB );
+    // 距離のあるピクセルは、距離に応じた赤を半分重ねる
+    cv::Mat overlay = colorImage.clone();
+    for ( int y = 0; y < overlay.rows; ++y ) {
+      const unsigned short* depth = registered.ptr<unsigned short>( y );
+      unsigned char* data = overlay.ptr( y );
+      for ( int x = 0; x < overlay.cols; ++x ) {
+        if ( depth[x] != 0 ) {
+          int gray = ~((depth[x] * 255) / 10000) & 0xff;
+          data[(x * 3) + 2] = (unsigned char)((data[(x * 3) + 2] + gray) / 2);
+        }
+      }
+    }
     
-    return colorImage;
+    return overlay;
   }
   
   // Depth ストリームを表示できる形に変換する
   cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
   {
-    // 距離データを画像化する(16bit)
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                 depthFrame.getWidth(),
-                                 CV_16U, (char*)depthFrame.getData() );
-    
     // 0-10000mmまでのデータを0-255(8bit)にする
-    depthImage.convertTo( depthImage, CV_8U, 255.0 / 10000 );
-    
-    return depthImage;
+    // (ピクセルフォーマットが 100um 単位でも、mm に合わせて変換する)
+    return depthConverter.convert( depthFrame );
   }
   
 private:
@@ -88,8 +124,15 @@ private:
   openni::VideoStream depthStream;  // Depth ストリーム
   openni::Recorder recorder;
   
+  ThreadPool threadPool;                // 位置合わせを並列に行うスレッド
+  DepthRegistration registration;       // Depth とカラーの位置合わせ
+  bool isRegistrationEnabled;           // 位置合わせを表示するか
+  
   cv::Mat colorImage;               // 表示用データ
   cv::Mat depthImage;               // Depth 表示用データ
+  
+  PixelConverter colorConverter;    // カラーの BGR への変換
+  PixelConverter depthConverter;    // Depth の 8bit への変換
 };
 
 int main(int argc, const char * argv[])
@@ -99,8 +142,9 @@ int main(int argc, const char * argv[])
     openni::OpenNI::initialize();
   
     // センサーを初期化する
+    // 引数にファイル名(.oni)を指定すると、記録したストリームデータを再生する
     DepthSensor sensor;
-    sensor.initialize();
+    sensor.initialize( (argc > 1) ? argv[1] : openni::ANY_DEVICE );
   
     // メインループ
     while ( 1 ) {
@@ -110,6 +154,10 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // Depth とカラーの位置合わせの表示を切り替える
+      else if ( key == 'r' ) {
+        sensor.changeRegistration();
+      }
     }
   }
   catch ( std::exception& ) {
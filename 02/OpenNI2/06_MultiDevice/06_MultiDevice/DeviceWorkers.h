@@ -0,0 +1,135 @@
+#ifndef _DEVICE_WORKERS_H_
+#define _DEVICE_WORKERS_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// デバイスごとに 1 つずつ持つ処理スレッド
+//
+// スレッドは最初に作ったものを使いまわし、run() のたびに起こすだけにしている
+// (フレームごとにスレッドを作って待つと、その分だけ時間がかかる)。
+// i 番目のスレッドは、いつも i 番目のデバイスの処理をする
+class DeviceWorkers
+{
+public:
+
+  // デバイスの処理(引数はデバイスの番号)
+  typedef std::function<void( int device )> DeviceFunction;
+
+  DeviceWorkers()
+    : body( 0 )
+    , generation( 0 )
+    , remaining( 0 )
+    , exiting( false )
+  {
+  }
+
+  ~DeviceWorkers()
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      exiting = true;
+    }
+    wakeup.notify_all();
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+      workers[i].join();
+    }
+  }
+
+  // デバイスの数だけスレッドを作る(増やすだけで、減らさない)
+  void resize( int count )
+  {
+    // 後から増やしたスレッドは、次の run() から処理する
+    // (世代はここで読んで渡す。スレッドが動き出してから読むと、その間に始まった run() を見落とす)
+    unsigned int current;
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      current = generation;
+    }
+
+    for ( int i = (int)workers.size(); i < count; ++i ) {
+      workers.push_back( std::thread( &DeviceWorkers::work, this, i, current ) );
+    }
+  }
+
+  int getCount() const
+  {
+    return (int)workers.size();
+  }
+
+  // すべてのデバイスの処理を、デバイスごとのスレッドで同時に行い、終わるまで待つ
+  void run( const DeviceFunction& body )
+  {
+    if ( workers.empty() ) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      this->body = &body;
+      remaining = (int)workers.size();
+      ++generation;
+    }
+    wakeup.notify_all();
+
+    // すべてのスレッドが body を抜けるまで待つ
+    // (各スレッドは 1 回の run() で 1 回だけ処理するので、次の run() と混ざらない)
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( remaining > 0 ) {
+      done.wait( lock );
+    }
+    this->body = 0;
+  }
+
+private:
+
+  // seen : 処理済みとする世代
+  void work( int device, unsigned int seen )
+  {
+    while ( true ) {
+      const DeviceFunction* current;
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        while ( !exiting && (generation == seen) ) {
+          wakeup.wait( lock );
+        }
+
+        if ( exiting ) {
+          return;
+        }
+
+        seen = generation;
+        current = body;
+      }
+
+      (*current)( device );
+
+      std::lock_guard<std::mutex> lock( mutex );
+      if ( --remaining == 0 ) {
+        done.notify_one();
+      }
+    }
+  }
+
+private:
+
+  DeviceWorkers( const DeviceWorkers& );
+  DeviceWorkers& operator = ( const DeviceWorkers& );
+
+  std::vector<std::thread> workers;       // デバイスごとのスレッド
+
+  std::mutex mutex;
+  std::condition_variable wakeup;         // 処理の開始の通知
+  std::condition_variable done;           // 処理の終了の通知
+
+  const DeviceFunction* body;             // デバイスの処理
+  unsigned int generation;                // run() の呼び出し回数
+  int remaining;                          // 処理の終わっていないスレッドの数
+  bool exiting;                           // 終了するかどうか
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef _FRAME_SYNC_H_
+#define _FRAME_SYNC_H_
+
+#include <deque>
+
+#include <OpenNI.h>
+
+// Depth とカラーのフレームを、タイムスタンプの近いものどうしで組にする
+//
+// デバイスの同期機能(setDepthColorSyncEnabled)が使えないときや、記録したデータを
+// 再生するときのためのもの。ストリームごとに数フレームをためておき、
+// 先頭どうしのタイムスタンプの差が許容範囲内なら組にして取り出す。
+// 相手より許容範囲を超えて古いフレームは、もう組になる相手が来ないので捨てる
+class FrameSync
+{
+public:
+
+  // 組にしたフレーム
+  struct Pair
+  {
+    openni::VideoFrameRef depthFrame;
+    openni::VideoFrameRef colorFrame;
+    long long skew;           // Depth からみたカラーのタイムスタンプの差(マイクロ秒)
+  };
+
+  // 組にした数や捨てた数
+  struct Stats
+  {
+    Stats()
+      : paired( 0 ), droppedDepth( 0 ), droppedColor( 0 ), totalSkew( 0 ), maxSkew( 0 )
+    {
+    }
+
+    double getAverageSkew() const
+    {
+      return (paired != 0) ? ((double)totalSkew / paired) : 0;
+    }
+
+    int paired;               // 組にした数
+    int droppedDepth;         // 捨てた Depth フレームの数
+    int droppedColor;         // 捨てたカラーフレームの数
+    long long totalSkew;      // タイムスタンプの差(絶対値)の合計
+    long long maxSkew;        // タイムスタンプの差(絶対値)の最大値
+  };
+
+  // tolerance : 組にするタイムスタンプの差(マイクロ秒、既定は 30fps の半フレーム)
+  // maxQueue  : ストリームごとにためるフレーム数
+  FrameSync( long long tolerance = 16666, size_t maxQueue = 4 )
+    : tolerance( tolerance )
+    , maxQueue( maxQueue )
+  {
+  }
+
+  void setTolerance( long long tolerance )
+  {
+    this->tolerance = tolerance;
+  }
+
+  // Depth フレームを追加する
+  void pushDepth( const openni::VideoFrameRef& frame )
+  {
+    push( depthQueue, frame, stats.droppedDepth );
+  }
+
+  // カラーフレームを追加する
+  void pushColor( const openni::VideoFrameRef& frame )
+  {
+    push( colorQueue, frame, stats.droppedColor );
+  }
+
+  // 組にできたフレームを取り出す(なければ false)
+  bool pop( Pair* pair )
+  {
+    while ( !depthQueue.empty() && !colorQueue.empty() ) {
+      long long skew = (long long)colorQueue.front().getTimestamp() -
+                       (long long)depthQueue.front().getTimestamp();
+
+      // 相手より許容範囲を超えて古いフレームは捨てる
+      if ( skew > tolerance ) {
+        depthQueue.pop_front();
+        ++stats.droppedDepth;
+        continue;
+      }
+      else if ( skew < -tolerance ) {
+        colorQueue.pop_front();
+        ++stats.droppedColor;
+        continue;
+      }
+
+      pair->depthFrame = depthQueue.front();
+      pair->colorFrame = colorQueue.front();
+      pair->skew = skew;
+      depthQueue.pop_front();
+      colorQueue.pop_front();
+
+      long long absSkew = (skew < 0) ? -skew : skew;
+      ++stats.paired;
+      stats.totalSkew += absSkew;
+      stats.maxSkew = (absSkew > stats.maxSkew) ? absSkew : stats.maxSkew;
+      return true;
+    }
+
+    return false;
+  }
+
+  // ためているフレームを捨てる(解像度を変えたときなど)
+  void clear()
+  {
+    depthQueue.clear();
+    colorQueue.clear();
+  }
+
+  const Stats& getStats() const
+  {
+    return stats;
+  }
+
+  void resetStats()
+  {
+    stats = Stats();
+  }
+
+private:
+
+  void push( std::deque<openni::VideoFrameRef>& queue,
+             const openni::VideoFrameRef& frame, int& dropped )
+  {
+    // 再生を巻き戻したときなど、タイムスタンプが戻ったらためていたものを捨てる
+    if ( !queue.empty() && (frame.getTimestamp() < queue.back().getTimestamp()) ) {
+      dropped += (int)queue.size();
+      queue.clear();
+    }
+
+    // 相手が来ないまま古くなったフレームは捨てる
+    if ( queue.size() >= maxQueue ) {
+      queue.pop_front();
+      ++dropped;
+    }
+
+    queue.push_back( frame );
+  }
+
+private:
+
+  long long tolerance;                            // 組にするタイムスタンプの差
+  size_t maxQueue;                                // ストリームごとにためるフレーム数
+
+  std::deque<openni::VideoFrameRef> depthQueue;   // 組になっていない Depth フレーム
+  std::deque<openni::VideoFrameRef> colorQueue;   // 組になっていないカラーフレーム
+
+  Stats stats;                                    // 組にした数や捨てた数
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef _GLOBAL_USER_TRACKER_H_
+#define _GLOBAL_USER_TRACKER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include <NiTE.h>
+#include <opencv2/opencv.hpp>
+
+// センサーごとのユーザー(UserTracker の UserId)を、すべてのセンサーで共通の ID にまとめる
+//
+// 同じ人でもセンサーが違えば UserId は別になるので、世界座標の重心と骨格の長さで同じ人を探す。
+// 前のフレームで対応のついた (センサー, UserId) はそのまま同じ ID にする(ほとんどはここで決まる)。
+// 残りは、床の上のグリッド(空間ハッシュ)で近くの ID だけを候補にし、
+// 距離と骨格の違いが小さい組から順に決める。1 つの ID には、センサーごとに 1 人しか割り当てない。
+// 候補は近くのものだけなので、処理はユーザー数にほぼ比例する
+class GlobalUserTracker
+{
+public:
+
+  enum { FEATURE_COUNT = 4 };
+
+  // センサーで検出したユーザー
+  struct Observation
+  {
+    int sensor;                     // センサーの番号(0 - 63)
+    nite::UserId localId;           // センサーの UserId
+    cv::Point3f position;           // 重心(世界座標、mm)
+    float features[FEATURE_COUNT];  // 骨格の長さ(肩幅、胴、上腕、太もも。mm)
+    bool hasFeatures;               // 骨格の長さが求まっているか
+  };
+
+  // すべてのセンサーで共通のユーザー
+  struct Track
+  {
+    int id;                         // 共通の ID
+    cv::Point3f position;           // 重心(世界座標、mm)
+    float features[FEATURE_COUNT];  // 骨格の長さ(ならしたもの)
+    bool hasFeatures;
+    unsigned int lastFrame;         // 最後に検出したフレーム
+    int sensorCount;                // 最後のフレームで検出したセンサーの数
+
+    // フレームの中で割り当てた観測
+    unsigned long long sensorMask;  // 割り当てたセンサー
+    cv::Point3f sum;                // 重心の合計
+  };
+
+  // gateRadius       : 同じ人とみなす重心の距離(mm)
+  // featureGate      : 同じ人とみなす骨格の長さの違い(mm)
+  // maxMissingFrames : 検出されなくなってから ID を捨てるまでのフレーム数
+  GlobalUserTracker( float gateRadius = 500, float featureGate = 150, int maxMissingFrames = 30 )
+    : gateRadius( gateRadius )
+    , featureGate( featureGate )
+    , featureWeight( 2 )
+    , maxMissingFrames( maxMissingFrames )
+    , frame( 0 )
+    , nextId( 1 )
+  {
+  }
+
+  // 1 フレーム分の、すべてのセンサーの観測から ID を決める
+  void update( const std::vector<Observation>& observations )
+  {
+    ++frame;
+    for ( size_t i = 0; i < tracks.size(); ++i ) {
+      tracks[i].sensorMask = 0;
+      tracks[i].sum = cv::Point3f( 0, 0, 0 );
+      tracks[i].sensorCount = 0;
+    }
+
+    // 前のフレームで対応のついたユーザーは、同じ ID にする
+    pending.clear();
+    for ( size_t i = 0; i < observations.size(); ++i ) {
+      const Observation& o = observations[i];
+      std::unordered_map<int, Link>::iterator link = links.find( makeKey( o.sensor, o.localId ) );
+      if ( link != links.end() ) {
+        std::unordered_map<int, size_t>::iterator index = trackIndex.find( link->second.trackId );
+        if ( (index != trackIndex.end()) && canAssign( tracks[index->second], o ) &&
+             (getDistance( tracks[index->second].position, o.position ) < (gateRadius * 2)) ) {
+          assign( index->second, o );
+          continue;
+        }
+      }
+
+      pending.push_back( i );
+    }
+
+    // 残りは、近くの ID を候補にして、よく合う組から順に決める
+    buildGrid();
+    candidates.clear();
+    for ( size_t i = 0; i < pending.size(); ++i ) {
+      addCandidates( observations[pending[i]], pending[i] );
+    }
+    std::sort( candidates.begin(), candidates.end() );
+
+    assigned.assign( observations.size(), false );
+    for ( size_t i = 0; i < candidates.size(); ++i ) {
+      const Candidate& c = candidates[i];
+      if ( !assigned[c.observation] && canAssign( tracks[c.track], observations[c.observation] ) ) {
+        assign( c.track, observations[c.observation] );
+        assigned[c.observation] = true;
+      }
+    }
+
+    // 候補のなかったユーザーには新しい ID をつける
+    // (同じフレームで別のセンサーに現れた同じ人は、いま作った ID にまとめる)
+    size_t firstNew = tracks.size();
+    for ( size_t i = 0; i < pending.size(); ++i ) {
+      const Observation& o = observations[pending[i]];
+      if ( assigned[pending[i]] ) {
+        continue;
+      }
+
+      size_t best = tracks.size();
+      float bestCost = 0;
+      for ( size_t t = firstNew; t < tracks.size(); ++t ) {
+        float cost;
+        if ( canAssign( tracks[t], o ) && getCost( tracks[t], o, &cost ) &&
+             ((best == tracks.size()) || (cost < bestCost)) ) {
+          best = t;
+          bestCost = cost;
+        }
+      }
+
+      assign( (best < tracks.size()) ? best : createTrack( o ), o );
+    }
+
+    finishFrame();
+  }
+
+  // センサーのユーザーの共通 ID(ない場合は 0)
+  int getGlobalId( int sensor, nite::UserId localId ) const
+  {
+    std::unordered_map<int, Link>::const_iterator link = links.find( makeKey( sensor, localId ) );
+    return (link != links.end()) ? link->second.trackId : 0;
+  }
+
+  const std::vector<Track>& getTracks() const
+  {
+    return tracks;
+  }
+
+  // これまでに現れた人数(センサーが重なっていても 1 人は 1 回だけ数える)
+  int getTotalCount() const
+  {
+    return nextId - 1;
+  }
+
+private:
+
+  // (センサー, UserId) と共通 ID の対応
+  struct Link
+  {
+    int trackId;
+    unsigned int lastFrame;
+  };
+
+  // 観測と ID の組の候補
+  struct Candidate
+  {
+    float cost;
+    size_t observation;
+    size_t track;
+
+    bool operator < ( const Candidate& rhs ) const
+    {
+      return cost < rhs.cost;
+    }
+  };
+
+  static int makeKey( int sensor, nite::UserId localId )
+  {
+    return (sensor << 16) | localId;
+  }
+
+  // 床の上の距離(重心の高さは、隠れ方で変わるので使わない)
+  static float getDistance( const cv::Point3f& a, const cv::Point3f& b )
+  {
+    float dx = a.x - b.x;
+    float dz = a.z - b.z;
+    return std::sqrt( (dx * dx) + (dz * dz) );
+  }
+
+  // 同じセンサーの 2 人を、同じ ID にはしない
+  static bool canAssign( const Track& track, const Observation& o )
+  {
+    return (track.sensorMask & (1ull << o.sensor)) == 0;
+  }
+
+  // 距離と骨格の違いから、組のコストを求める(同じ人とみなせなければ false)
+  bool getCost( const Track& track, const Observation& o, float* cost ) const
+  {
+    float distance = getDistance( track.position, o.position );
+    if ( distance >= gateRadius ) {
+      return false;
+    }
+
+    *cost = distance;
+    if ( track.hasFeatures && o.hasFeatures ) {
+      float difference = 0;
+      for ( int i = 0; i < FEATURE_COUNT; ++i ) {
+        difference += std::fabs( track.features[i] - o.features[i] );
+      }
+      difference /= FEATURE_COUNT;
+
+      if ( difference >= featureGate ) {
+        return false;
+      }
+      *cost += featureWeight * difference;
+    }
+
+    return true;
+  }
+
+  int getCell( float mm ) const
+  {
+    return (int)std::floor( mm / gateRadius );
+  }
+
+  static long long makeCellKey( int x, int z )
+  {
+    return ((long long)x << 32) | (unsigned int)z;
+  }
+
+  // ID を床の上のグリッド(セルの大きさは gateRadius)に振り分ける
+  void buildGrid()
+  {
+    grid.clear();
+    for ( size_t i = 0; i < tracks.size(); ++i ) {
+      long long key = makeCellKey( getCell( tracks[i].position.x ), getCell( tracks[i].position.z ) );
+      grid.push_back( std::make_pair( key, i ) );
+    }
+    std::sort( grid.begin(), grid.end() );
+  }
+
+  // 観測のまわり 3x3 のセルにある ID を候補にする
+  void addCandidates( const Observation& o, size_t observation )
+  {
+    int cx = getCell( o.position.x );
+    int cz = getCell( o.position.z );
+    for ( int z = cz - 1; z <= cz + 1; ++z ) {
+      for ( int x = cx - 1; x <= cx + 1; ++x ) {
+        std::pair<long long, size_t> first( makeCellKey( x, z ), 0 );
+        for ( std::vector<std::pair<long long, size_t> >::const_iterator it =
+                std::lower_bound( grid.begin(), grid.end(), first );
+              (it != grid.end()) && (it->first == first.first); ++it ) {
+          Candidate c;
+          if ( canAssign( tracks[it->second], o ) && getCost( tracks[it->second], o, &c.cost ) ) {
+            c.observation = observation;
+            c.track = it->second;
+            candidates.push_back( c );
+          }
+        }
+      }
+    }
+  }
+
+  size_t createTrack( const Observation& o )
+  {
+    Track track;
+    track.id = nextId++;
+    track.position = o.position;
+    track.hasFeatures = false;
+    track.lastFrame = frame;
+    track.sensorCount = 0;
+    track.sensorMask = 0;
+    track.sum = cv::Point3f( 0, 0, 0 );
+
+    trackIndex[track.id] = tracks.size();
+    tracks.push_back( track );
+    return tracks.size() - 1;
+  }
+
+  void assign( size_t index, const Observation& o )
+  {
+    Track& track = tracks[index];
+    track.sensorMask |= (1ull << o.sensor);
+    track.sum += o.position;
+    ++track.sensorCount;
+
+    if ( o.hasFeatures ) {
+      for ( int i = 0; i < FEATURE_COUNT; ++i ) {
+        track.features[i] = track.hasFeatures ?
+          ((track.features[i] * 0.9f) + (o.features[i] * 0.1f)) : o.features[i];
+      }
+      track.hasFeatures = true;
+    }
+
+    Link& link = links[makeKey( o.sensor, o.localId )];
+    link.trackId = track.id;
+    link.lastFrame = frame;
+  }
+
+  // 重心をセンサーの平均にし、見えなくなったユーザーと ID を捨てる
+  void finishFrame()
+  {
+    for ( size_t i = 0; i < tracks.size(); ) {
+      Track& track = tracks[i];
+      if ( track.sensorCount > 0 ) {
+        track.position = track.sum * (1.0f / track.sensorCount);
+        track.lastFrame = frame;
+      }
+
+      if ( (frame - track.lastFrame) > (unsigned int)maxMissingFrames ) {
+        trackIndex.erase( track.id );
+        if ( i != (tracks.size() - 1) ) {
+          tracks[i] = tracks.back();
+          trackIndex[tracks[i].id] = i;
+        }
+        tracks.pop_back();
+        continue;
+      }
+
+      ++i;
+    }
+
+    // このフレームで検出されなかった UserId の対応は捨てる(UserId は使いまわされるので)
+    for ( std::unordered_map<int, Link>::iterator it = links.begin(); it != links.end(); ) {
+      if ( it->second.lastFrame != frame ) {
+        it = links.erase( it );
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+private:
+
+  float gateRadius;         // 同じ人とみなす重心の距離(mm)
+  float featureGate;        // 同じ人とみなす骨格の長さの違い(mm)
+  float featureWeight;      // コストでの骨格の長さの違いの重み
+  int maxMissingFrames;     // 検出されなくなってから ID を捨てるまでのフレーム数
+  unsigned int frame;       // フレーム番号
+  int nextId;               // 次につける ID
+
+  std::vector<Track> tracks;                      // 共通のユーザー
+  std::unordered_map<int, size_t> trackIndex;     // ID から tracks の位置
+  std::unordered_map<int, Link> links;            // (センサー, UserId) から ID
+
+  // フレームごとの作業用(フレーム間で使いまわす)
+  std::vector<size_t> pending;                              // 対応の決まっていない観測
+  std::vector<std::pair<long long, size_t> > grid;          // セルと ID の位置
+  std::vector<Candidate> candidates;                        // 観測と ID の組の候補
+  std::vector<bool> assigned;                               // 観測に ID を割り当てたか
+};
+
+#endif
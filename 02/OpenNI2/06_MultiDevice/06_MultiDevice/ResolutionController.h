@@ -0,0 +1,145 @@
+#ifndef _RESOLUTION_CONTROLLER_H_
+#define _RESOLUTION_CONTROLLER_H_
+
+#include <vector>
+
+// 処理が間に合わないときに解像度を下げ、余裕ができたら戻す
+//
+// フレームごとの処理時間と、1 回の更新でたまっていたフレーム数を見る。
+// 処理時間が予算を超えるか、フレームがたまり続けると 1 段下げる。
+// 上げるのは、1 段上の解像度でも予算に余裕をもって収まると見込めるときだけで、
+// しばらく様子を見てから上げる(上げ下げを繰り返さないため)。
+// 解像度が変わったら、登録した Listener に知らせる(バッファや表を作りなおすため)
+class ResolutionController
+{
+public:
+
+  // 解像度が変わったことを受け取る
+  class Listener
+  {
+  public:
+
+    virtual ~Listener() {}
+    virtual void onResolutionChanged( int width, int height ) = 0;
+  };
+
+  // budget : 1 フレームの処理に使ってよい時間(ms)
+  ResolutionController( double budget = 1000.0 / 30 )
+    : budget( budget )
+    , level( 0 )
+    , cost( 0 )
+    , overCount( 0 )
+    , underCount( 0 )
+    , settleCount( 0 )
+    , downFrames( 10 )
+    , upFrames( 90 )
+    , settleFrames( 15 )
+  {
+  }
+
+  void setBudget( double budget )
+  {
+    this->budget = budget;
+  }
+
+  // 解像度の段階を追加する(大きいものから順に)
+  void addLevel( int width, int height )
+  {
+    Level l = { width, height };
+    levels.push_back( l );
+  }
+
+  void addListener( Listener* listener )
+  {
+    listeners.push_back( listener );
+  }
+
+  int getWidth() const
+  {
+    return levels[level].width;
+  }
+
+  int getHeight() const
+  {
+    return levels[level].height;
+  }
+
+  // フレームの処理が終わるごとに呼ぶ(解像度を変えたら true)
+  // cost       : 処理時間(ms)
+  // queueDepth : 更新のときにたまっていたフレーム数(間に合っていれば 1 以下)
+  bool update( double cost, int queueDepth )
+  {
+    // 解像度を変えた直後は安定しないので、見ない
+    if ( settleCount > 0 ) {
+      --settleCount;
+      this->cost = cost;
+      return false;
+    }
+
+    this->cost = (this->cost * 0.9) + (cost * 0.1);
+
+    // 間に合っていなければ下げる
+    bool over = (this->cost > budget) || (queueDepth > 1);
+    overCount = over ? (overCount + 1) : 0;
+    if ( (overCount >= downFrames) && ((level + 1) < (int)levels.size()) ) {
+      return change( level + 1 );
+    }
+
+    // 1 段上の解像度での処理時間を画素数の比で見積もり、予算の 7 割に収まれば上げる
+    if ( level > 0 ) {
+      double ratio = getPixels( level - 1 ) / (double)getPixels( level );
+      bool under = !over && ((this->cost * ratio) < (budget * 0.7));
+      underCount = under ? (underCount + 1) : 0;
+      if ( underCount >= upFrames ) {
+        return change( level - 1 );
+      }
+    }
+
+    return false;
+  }
+
+private:
+
+  int getPixels( int index ) const
+  {
+    return levels[index].width * levels[index].height;
+  }
+
+  bool change( int newLevel )
+  {
+    level = newLevel;
+    overCount = 0;
+    underCount = 0;
+    settleCount = settleFrames;
+
+    for ( size_t i = 0; i < listeners.size(); ++i ) {
+      listeners[i]->onResolutionChanged( getWidth(), getHeight() );
+    }
+
+    return true;
+  }
+
+private:
+
+  struct Level
+  {
+    int width;
+    int height;
+  };
+
+  std::vector<Level> levels;            // 解像度の段階(大きいものから)
+  std::vector<Listener*> listeners;     // 解像度の変更を受け取るもの
+
+  double budget;        // 1 フレームの処理に使ってよい時間(ms)
+  int level;            // 今の段階
+  double cost;          // 処理時間(ならしたもの)
+  int overCount;        // 間に合わなかったフレームが続いた数
+  int underCount;       // 余裕のあるフレームが続いた数
+  int settleCount;      // 解像度を変えてから見ないフレームの残り
+
+  int downFrames;       // 下げるまでに続く、間に合わないフレームの数
+  int upFrames;         // 上げるまでに続く、余裕のあるフレームの数
+  int settleFrames;     // 解像度を変えてから見ないフレームの数
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef _VIDEO_MODE_CACHE_H_
+#define _VIDEO_MODE_CACHE_H_
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include <OpenNI.h>
+
+// デバイスのシリアル番号とセンサーごとに、前回使えたビデオモードをファイルに保存しておく
+//
+// 起動のたびに対応しているモードを調べて選びなおさず、保存したモードをそのまま設定する。
+// 複数のデバイスを別々のスレッドで開くので、読み書きは排他する。
+// ファイルは 1 行に 1 つのモードを
+//   センサーの種類 ピクセルフォーマット 幅 高さ フレームレート シリアル番号
+// の形で書く(シリアル番号は記録したファイルの URI のこともあるので、空白を含めて行末まで)
+class VideoModeCache
+{
+public:
+
+  VideoModeCache( const std::string& fileName )
+    : fileName( fileName )
+    , modified( false )
+  {
+    load();
+  }
+
+  // 保存したビデオモードを取得する(なければ false)
+  bool find( const std::string& serial, openni::SensorType sensorType, openni::VideoMode* mode ) const
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    std::map<Key, Entry>::const_iterator it = entries.find( Key( serial, sensorType ) );
+    if ( it == entries.end() ) {
+      return false;
+    }
+
+    mode->setPixelFormat( (openni::PixelFormat)it->second.pixelFormat );
+    mode->setResolution( it->second.width, it->second.height );
+    mode->setFps( it->second.fps );
+    return true;
+  }
+
+  // 使えたビデオモードを追加する(ファイルへは save() で書き込む)
+  void store( const std::string& serial, openni::SensorType sensorType, const openni::VideoMode& mode )
+  {
+    Entry entry;
+    entry.pixelFormat = mode.getPixelFormat();
+    entry.width = mode.getResolutionX();
+    entry.height = mode.getResolutionY();
+    entry.fps = mode.getFps();
+
+    std::lock_guard<std::mutex> lock( mutex );
+    Entry& current = entries[Key( serial, sensorType )];
+    if ( (current.pixelFormat != entry.pixelFormat) || (current.width != entry.width) ||
+         (current.height != entry.height) || (current.fps != entry.fps) ) {
+      current = entry;
+      modified = true;
+    }
+  }
+
+  // 変更があればファイルに書き込む
+  void save()
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( !modified ) {
+      return;
+    }
+
+    std::ofstream file( fileName.c_str() );
+    for ( std::map<Key, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it ) {
+      file << it->first.second << " " << it->second.pixelFormat << " "
+           << it->second.width << " " << it->second.height << " " << it->second.fps << " "
+           << it->first.first << std::endl;
+    }
+
+    modified = false;
+  }
+
+private:
+
+  void load()
+  {
+    std::ifstream file( fileName.c_str() );
+    std::string line;
+    while ( std::getline( file, line ) ) {
+      std::istringstream stream( line );
+      int sensorType;
+      Entry entry;
+      std::string serial;
+      stream >> sensorType >> entry.pixelFormat >> entry.width >> entry.height >> entry.fps;
+      stream >> std::ws;
+      std::getline( stream, serial );
+
+      // 壊れた行は読み飛ばす
+      if ( !stream.fail() && !serial.empty() ) {
+        entries[Key( serial, sensorType )] = entry;
+      }
+    }
+  }
+
+private:
+
+  typedef std::pair<std::string, int> Key;    // シリアル番号とセンサーの種類
+
+  struct Entry
+  {
+    Entry()
+      : pixelFormat( 0 ), width( 0 ), height( 0 ), fps( 0 )
+    {
+    }
+
+    int pixelFormat;
+    int width;
+    int height;
+    int fps;
+  };
+
+  std::string fileName;                       // 保存するファイル名
+  std::map<Key, Entry> entries;               // 保存したビデオモード
+  bool modified;                              // ファイルに書き込んでいない変更があるか
+  mutable std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef _VOXEL_GRID_H_
+#define _VOXEL_GRID_H_
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <OpenNI.h>
+
+// 複数のセンサーの Depth を、共通の座標(世界座標)の疎なボクセルに統合する
+//
+// ボクセルは使うところだけハッシュ表に持つ。表はキーで複数の区画(ストライプ)に分け、
+// 区画ごとにロックするので、デバイスごとのスレッドから同時に追加できる。
+// 点はいったん区画ごとに振り分けてから、区画ごとに 1 回だけロックして書き込む。
+// 占有度は、点が入るたびに上げ、入らなかった時間に応じて下げる(下げるのは読むときにまとめて計算する)。
+// 前回の問い合わせから変わったボクセル(dirty)だけを取り出せる。
+// 区画ごとに変わったボクセルの範囲を持っておき、範囲を指定して取り出すときは、
+// 重ならない区画をまとめて読み飛ばす
+class VoxelGrid
+{
+public:
+
+  typedef long long Key;
+
+  // センサーの内部パラメータ(Depth 画像のピクセル)
+  struct Intrinsics
+  {
+    float fx, fy, cx, cy;
+  };
+
+  // センサーから世界座標への変換(回転と平行移動、mm)
+  struct Extrinsics
+  {
+    Extrinsics()
+    {
+      for ( int i = 0; i < 9; ++i ) {
+        r[i] = ((i % 4) == 0) ? 1.0f : 0.0f;
+      }
+      t[0] = t[1] = t[2] = 0;
+    }
+
+    float r[9];
+    float t[3];
+  };
+
+  // 変わったボクセル
+  struct Dirty
+  {
+    Key key;
+    float occupancy;
+  };
+
+  // ボクセルの番号の範囲(lower 以上 upper 以下、x y z の順)
+  struct Region
+  {
+    // 何も含まない範囲
+    Region()
+    {
+      for ( int i = 0; i < 3; ++i ) {
+        lower[i] = INT_MAX;
+        upper[i] = INT_MIN;
+      }
+    }
+
+    Region( int x0, int y0, int z0, int x1, int y1, int z1 )
+    {
+      lower[0] = x0; lower[1] = y0; lower[2] = z0;
+      upper[0] = x1; upper[1] = y1; upper[2] = z1;
+    }
+
+    // すべてを含む範囲
+    static Region getAll()
+    {
+      return Region( INT_MIN, INT_MIN, INT_MIN, INT_MAX, INT_MAX, INT_MAX );
+    }
+
+    bool contains( int x, int y, int z ) const
+    {
+      return (x >= lower[0]) && (x <= upper[0]) &&
+             (y >= lower[1]) && (y <= upper[1]) &&
+             (z >= lower[2]) && (z <= upper[2]);
+    }
+
+    bool intersects( const Region& other ) const
+    {
+      for ( int i = 0; i < 3; ++i ) {
+        if ( (lower[i] > other.upper[i]) || (upper[i] < other.lower[i]) ) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    // 点を含むように広げる
+    void add( int x, int y, int z )
+    {
+      lower[0] = (std::min)( lower[0], x ); upper[0] = (std::max)( upper[0], x );
+      lower[1] = (std::min)( lower[1], y ); upper[1] = (std::max)( upper[1], y );
+      lower[2] = (std::min)( lower[2], z ); upper[2] = (std::max)( upper[2], z );
+    }
+
+    int lower[3];
+    int upper[3];
+  };
+
+  // voxelSize   : ボクセルの大きさ(mm)
+  // stripeCount : ロックする区画の数
+  VoxelGrid( float voxelSize = 50, int stripeCount = 64 )
+    : voxelSize( voxelSize )
+    , hitWeight( 0.85f )
+    , missPerFrame( 0.05f )
+    , minOccupancy( -2.0f )
+    , maxOccupancy( 3.5f )
+    , stripes( stripeCount )
+  {
+  }
+
+  float getVoxelSize() const
+  {
+    return voxelSize;
+  }
+
+  // 画角と解像度から内部パラメータを求める
+  static Intrinsics getIntrinsics( float horizontalFov, float verticalFov, int width, int height )
+  {
+    Intrinsics k;
+    k.cx = width / 2.0f;
+    k.cy = height / 2.0f;
+    k.fx = k.cx / std::tan( horizontalFov / 2 );
+    k.fy = k.cy / std::tan( verticalFov / 2 );
+    return k;
+  }
+
+  // Depth フレームの点を世界座標にして追加する(ほかのスレッドと同時に呼んでよい)
+  // step  : 点を間引く間隔(ピクセル)
+  // frame : 今のフレーム番号(占有度を下げる計算に使う)
+  void insert( const openni::VideoFrameRef& depthFrame, const Intrinsics& k,
+               const Extrinsics& e, int step, unsigned int frame )
+  {
+    // 点を区画ごとに振り分ける(ロックしないで行う)
+    std::vector<std::vector<Key> > keys( stripes.size() );
+
+    const unsigned char* data = (const unsigned char*)depthFrame.getData();
+    int stride = depthFrame.getStrideInBytes();
+    for ( int v = 0; v < depthFrame.getHeight(); v += step ) {
+      const openni::DepthPixel* row = (const openni::DepthPixel*)(data + (v * stride));
+      float yn = (k.cy - v) / k.fy;
+      for ( int u = 0; u < depthFrame.getWidth(); u += step ) {
+        float z = row[u];
+        if ( z == 0 ) {
+          continue;
+        }
+
+        // センサーの座標(OpenNI の世界座標と同じく、y は上向き)
+        float x = ((u - k.cx) / k.fx) * z;
+        float y = yn * z;
+
+        // 世界座標
+        float wx = (e.r[0] * x) + (e.r[1] * y) + (e.r[2] * z) + e.t[0];
+        float wy = (e.r[3] * x) + (e.r[4] * y) + (e.r[5] * z) + e.t[1];
+        float wz = (e.r[6] * x) + (e.r[7] * y) + (e.r[8] * z) + e.t[2];
+
+        Key key = makeKey( toIndex( wx ), toIndex( wy ), toIndex( wz ) );
+        keys[getStripe( key )].push_back( key );
+      }
+    }
+
+    // 区画ごとに 1 回だけロックして書き込む
+    for ( size_t i = 0; i < stripes.size(); ++i ) {
+      if ( keys[i].empty() ) {
+        continue;
+      }
+
+      Stripe& stripe = stripes[i];
+      std::lock_guard<std::mutex> lock( stripe.mutex );
+      for ( size_t j = 0; j < keys[i].size(); ++j ) {
+        std::pair<VoxelMap::iterator, bool> inserted =
+          stripe.voxels.insert( VoxelMap::value_type( keys[i][j], Voxel() ) );
+        Voxel& voxel = inserted.first->second;
+        if ( inserted.second ) {
+          voxel.updateFrame = frame;
+        }
+
+        // 同じフレームで何点入っても、上げるのは 1 回
+        if ( voxel.hitFrame == frame ) {
+          continue;
+        }
+
+        voxel.occupancy = (std::min)( decay( voxel, frame ) + hitWeight, maxOccupancy );
+        voxel.updateFrame = frame;
+        voxel.hitFrame = frame;
+
+        if ( voxel.dirtyEpoch != stripe.epoch ) {
+          voxel.dirtyEpoch = stripe.epoch;
+          stripe.dirty.push_back( keys[i][j] );
+
+          int x, y, z;
+          getIndex( keys[i][j], &x, &y, &z );
+          stripe.dirtyRegion.add( x, y, z );
+        }
+      }
+    }
+  }
+
+  // 前回から変わったボクセルを取り出す
+  void collectDirty( std::vector<Dirty>* dirty, unsigned int frame )
+  {
+    collectDirty( dirty, frame, Region::getAll() );
+  }
+
+  // 前回から変わったボクセルのうち、範囲の中にあるものだけを取り出す
+  // 範囲の外の変更は捨てる(取り出す側が、範囲の外を使わないとき用)
+  void collectDirty( std::vector<Dirty>* dirty, unsigned int frame, const Region& region )
+  {
+    dirty->clear();
+    for ( size_t i = 0; i < stripes.size(); ++i ) {
+      Stripe& stripe = stripes[i];
+      std::lock_guard<std::mutex> lock( stripe.mutex );
+
+      // 変わったボクセルが範囲に重ならなければ、ハッシュ表を引かずに捨てる
+      if ( stripe.dirtyRegion.intersects( region ) ) {
+        for ( size_t j = 0; j < stripe.dirty.size(); ++j ) {
+          int x, y, z;
+          getIndex( stripe.dirty[j], &x, &y, &z );
+          if ( !region.contains( x, y, z ) ) {
+            continue;
+          }
+
+          const Voxel& voxel = stripe.voxels[stripe.dirty[j]];
+          Dirty d = { stripe.dirty[j], decay( voxel, frame ) };
+          dirty->push_back( d );
+        }
+      }
+
+      // 世代を進めて、区画のボクセルをまとめて変わっていないことにする
+      ++stripe.epoch;
+      stripe.dirty.clear();
+      stripe.dirtyRegion = Region();
+    }
+  }
+
+  // 占有度が下がりきったボクセルを捨てる(たまに呼ぶ)
+  void prune( unsigned int frame )
+  {
+    for ( size_t i = 0; i < stripes.size(); ++i ) {
+      Stripe& stripe = stripes[i];
+      std::lock_guard<std::mutex> lock( stripe.mutex );
+      for ( VoxelMap::iterator it = stripe.voxels.begin(); it != stripe.voxels.end(); ) {
+        if ( (it->second.dirtyEpoch != stripe.epoch) && (decay( it->second, frame ) <= minOccupancy) ) {
+          it = stripe.voxels.erase( it );
+        }
+        else {
+          ++it;
+        }
+      }
+    }
+  }
+
+  size_t getVoxelCount()
+  {
+    size_t count = 0;
+    for ( size_t i = 0; i < stripes.size(); ++i ) {
+      std::lock_guard<std::mutex> lock( stripes[i].mutex );
+      count += stripes[i].voxels.size();
+    }
+
+    return count;
+  }
+
+  // キーからボクセルの番号を取り出す
+  static void getIndex( Key key, int* x, int* y, int* z )
+  {
+    *x = (int)((key >> 42) & 0x1FFFFF) - (1 << 20);
+    *y = (int)((key >> 21) & 0x1FFFFF) - (1 << 20);
+    *z = (int)(key & 0x1FFFFF) - (1 << 20);
+  }
+
+private:
+
+  struct Voxel
+  {
+    Voxel()
+      : occupancy( 0 ), updateFrame( 0 ), hitFrame( ~0u ), dirtyEpoch( ~0u )
+    {
+    }
+
+    float occupancy;            // 占有度(最後に更新したときの値)
+    unsigned int updateFrame;   // 最後に更新したフレーム
+    unsigned int hitFrame;      // 最後に点が入ったフレーム
+    unsigned int dirtyEpoch;    // 変わったときの区画の世代(区画の世代と同じなら、取り出していない変更がある)
+  };
+
+  typedef std::unordered_map<Key, Voxel> VoxelMap;
+
+  struct Stripe
+  {
+    Stripe()
+      : epoch( 0 )
+    {
+    }
+
+    std::mutex mutex;
+    VoxelMap voxels;
+    std::vector<Key> dirty;     // 変わったボクセル
+    Region dirtyRegion;         // 変わったボクセルのある範囲
+    unsigned int epoch;         // 取り出した回数
+  };
+
+  int toIndex( float mm ) const
+  {
+    return (int)std::floor( mm / voxelSize );
+  }
+
+  // 3 つの番号を 21bit ずつ詰める(±約 100 万ボクセル)
+  static Key makeKey( int x, int y, int z )
+  {
+    return ((Key)((x + (1 << 20)) & 0x1FFFFF) << 42) |
+           ((Key)((y + (1 << 20)) & 0x1FFFFF) << 21) |
+           (Key)((z + (1 << 20)) & 0x1FFFFF);
+  }
+
+  int getStripe( Key key ) const
+  {
+    unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ull;
+    return (int)((h >> 32) % stripes.size());
+  }
+
+  // 最後に更新してからのフレーム数だけ、占有度を下げる
+  float decay( const Voxel& voxel, unsigned int frame ) const
+  {
+    float value = voxel.occupancy - (missPerFrame * (frame - voxel.updateFrame));
+    return (std::max)( value, minOccupancy );
+  }
+
+private:
+
+  float voxelSize;              // ボクセルの大きさ(mm)
+  float hitWeight;              // 点が入ったときに上げる占有度
+  float missPerFrame;           // 1 フレームごとに下げる占有度
+  float minOccupancy;           // 占有度の最小値
+  float maxOccupancy;           // 占有度の最大値
+
+  std::vector<Stripe> stripes;  // ロックする区画
+};
+
+#endif
@@ -1,28 +1,90 @@
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 #include <OpenNI.h>
+#include <NiTE.h>
 #include <opencv2/opencv.hpp>
 
-class DepthSensor
+#include "DeviceWorkers.h"
+#include "FrameSync.h"
+#include "GlobalUserTracker.h"
+#include "PixelConverter.h"
+#include "ResolutionController.h"
+#include "VideoModeCache.h"
+#include "VoxelGrid.h"
+
+// 経過時間(ミリ秒)を返し、計測の開始を今にする
+static double lap( int64& tick )
+{
+  int64 now = cv::getTickCount();
+  double elapsed = (now - tick) * 1000.0 / cv::getTickFrequency();
+  tick = now;
+  return elapsed;
+}
+
+class DepthSensor : public ResolutionController::Listener
 {
 public:
   
-  void initialize( const char* uri = openni::ANY_DEVICE )
+  DepthSensor()
+    : depthConverter( CV_8UC1 )
+    , userTrackingEnabled( false )
+  {
+  }
+  
+  // 起動の段階ごとにかかった時間(ミリ秒)
+  struct StartupTimes
+  {
+    StartupTimes()
+      : open( 0 ), configure( 0 ), start( 0 ), cached( 0 )
+    {
+    }
+    
+    double open;        // デバイスを開く
+    double configure;   // ストリームを作ってビデオモードを設定する
+    double start;       // ストリームを開始する
+    int cached;         // キャッシュのビデオモードを設定できたストリームの数
+  };
+  
+  // ビデオモードは、キャッシュにあればそれを設定し、なければ選んでキャッシュに追加する
+  void initialize( const char* uri, VideoModeCache& videoModeCache )
   {
+    int64 tick = cv::getTickCount();
+    
     // デバイスを取得する
     openni::Status ret = device.open( uri );
     if ( ret != openni::STATUS_OK ) {
       throw std::runtime_error( "openni::Device::open() failed." );
     }
+    startupTimes.open = lap( tick );
     
-    // カラーストリームを有効にする
-    colorStream.create( device, openni::SENSOR_COLOR );
-    colorStream.start();
+    // カラーストリームと Depth ストリームを作り、ビデオモードを設定する
+    serial = getSerialNumber( uri );
+    createStream( colorStream, openni::SENSOR_COLOR, serial, videoModeCache );
+    createStream( depthStream, openni::SENSOR_DEPTH, serial, videoModeCache );
+    startupTimes.configure = lap( tick );
     
-    depthStream.create( device, openni::SENSOR_DEPTH );
+    colorStream.start();
     depthStream.start();
+    startupTimes.start = lap( tick );
+    
+    // ストリームをまとめる
+    streams.push_back( &depthStream );
+    streams.push_back( &colorStream );
+    
+    // 処理が間に合わないときは、Depth の解像度の 1/2、1/4 に下げる
+    openni::VideoMode depthMode = depthStream.getVideoMode();
+    for ( int scale = 1; scale <= 4; scale *= 2 ) {
+      resolutionController.addLevel( depthMode.getResolutionX() / scale,
+                                     depthMode.getResolutionY() / scale );
+    }
+    resolutionController.addListener( this );
+    width = resolutionController.getWidth();
+    height = resolutionController.getHeight();
     
     // URIを保存しておく
     this->uri = uri;
@@ -31,20 +93,187 @@ public:
   // フレームの更新処理
   void update()
   {
-    openni::VideoFrameRef colorFrame;
-    openni::VideoFrameRef depthFrame;
+    // 更新されたフレームをすべて取得する(ほかのデバイスを待たせないよう、待たない)
+    int changedIndex;
+    int depthCount = 0;
+    while ( openni::OpenNI::waitForAnyStream( &streams[0], (int)streams.size(),
+                                              &changedIndex, 0 ) == openni::STATUS_OK ) {
+      openni::VideoFrameRef frame;
+      streams[changedIndex]->readFrame( &frame );
+      if ( streams[changedIndex] == &depthStream ) {
+        frameSync.pushDepth( frame );
+        ++depthCount;
+      }
+      else {
+        frameSync.pushColor( frame );
+      }
+    }
+    
+    // タイムスタンプの近い Depth とカラーの組のうち、最新のものを表示する
+    FrameSync::Pair pair;
+    bool paired = false;
+    while ( frameSync.pop( &pair ) ) {
+      paired = true;
+    }
+    
+    if ( !paired ) {
+      return;
+    }
     
-    // 更新されたフレームを取得する
-    colorStream.readFrame( &colorFrame );
-    depthStream.readFrame( &depthFrame );
+    // ボクセルに統合する Depth フレーム
+    lastDepthFrame = pair.depthFrame;
     
     // フレームのデータを表示できる形に変換する
-    colorImage = showColorStream( colorFrame );
-    depthImage = showDepthStream( depthFrame );
+    int64 tick = cv::getTickCount();
+    colorImage = showColorStream( pair.colorFrame );
+    depthImage = showDepthStream( pair.depthFrame );
     
     // フレームのデータを表示する
     cv::imshow( "Color Stream " + getUri(), colorImage );
     cv::imshow( "Depth Stream " + getUri(), depthImage );
+    
+    // 処理時間とたまっていたフレーム数から、解像度を調整する
+    resolutionController.update( lap( tick ), depthCount );
+  }
+  
+  // 1 フレームの処理に使ってよい時間(ミリ秒)
+  void setFrameBudget( double budget )
+  {
+    resolutionController.setBudget( budget );
+  }
+  
+  // 解像度が変わったら、ストリームのビデオモードを変える
+  // (対応するモードがなければ、近いモードにしてホストで縮小する)
+  void onResolutionChanged( int width, int height )
+  {
+    this->width = width;
+    this->height = height;
+    changeResolution( colorStream, width, height );
+    changeResolution( depthStream, width, height );
+    
+    // 前の解像度のフレームは捨てる
+    frameSync.clear();
+    
+    std::cout << getUri() << " resolution : " << width << "x" << height << std::endl;
+  }
+  
+  // Depth とカラーの組の状況を表示する
+  void showSyncStats()
+  {
+    const FrameSync::Stats& stats = frameSync.getStats();
+    std::cout << getUri() << std::endl
+              << " paired : " << stats.paired
+              << "  dropped depth : " << stats.droppedDepth
+              << "  dropped color : " << stats.droppedColor
+              << "  skew avg : " << (stats.getAverageSkew() / 1000) << " ms"
+              << "  max : " << (stats.maxSkew / 1000.0) << " ms" << std::endl;
+  }
+  
+  // 最新の Depth フレームを、世界座標にしてボクセルに追加する(ほかのデバイスと同時に呼んでよい)
+  void fuse( VoxelGrid* voxelGrid, unsigned int frame )
+  {
+    if ( !lastDepthFrame.isValid() ) {
+      return;
+    }
+    
+    VoxelGrid::Intrinsics intrinsics = VoxelGrid::getIntrinsics(
+      depthStream.getHorizontalFieldOfView(), depthStream.getVerticalFieldOfView(),
+      lastDepthFrame.getWidth(), lastDepthFrame.getHeight() );
+    
+    // VGA なら 4 ピクセルおき(ボクセルの大きさに対して十分な密度)
+    int step = (std::max)( lastDepthFrame.getWidth() / 160, 1 );
+    voxelGrid->insert( lastDepthFrame, intrinsics, extrinsics, step, frame );
+    lastDepthFrame.release();
+  }
+  
+  // ユーザーの検出を開始、停止する
+  void setUserTracking( bool enabled )
+  {
+    if ( enabled && !userTrackingEnabled ) {
+      if ( userTracker.create( &device ) != nite::STATUS_OK ) {
+        std::cout << getUri() << " : nite::UserTracker::create() failed." << std::endl;
+        return;
+      }
+    }
+    else if ( !enabled && userTrackingEnabled ) {
+      userTracker.destroy();
+      userLabels.clear();
+    }
+    
+    userTrackingEnabled = enabled;
+  }
+  
+  // ユーザーを検出し、重心と骨格の長さを世界座標で返す(ほかのデバイスと同時に呼んでよい)
+  void trackUsers( int sensor, std::vector<GlobalUserTracker::Observation>* observations )
+  {
+    observations->clear();
+    userLabels.clear();
+    if ( !userTrackingEnabled ) {
+      return;
+    }
+    
+    nite::UserTrackerFrameRef userFrame;
+    if ( userTracker.readFrame( &userFrame ) != nite::STATUS_OK ) {
+      return;
+    }
+    
+    // 表示している Depth 画像の位置にするための倍率
+    openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
+    float scale = depthFrame.isValid() ? ((float)width / depthFrame.getWidth()) : 1.0f;
+    
+    const nite::Array<nite::UserData>& users = userFrame.getUsers();
+    for ( int i = 0; i < users.getSize(); ++i ) {
+      const nite::UserData& user = users[i];
+      
+      // 骨格の長さを使うので、新しいユーザーはスケルトンを追跡する
+      if ( user.isNew() ) {
+        userTracker.startSkeletonTracking( user.getId() );
+      }
+      
+      const nite::Point3f& center = user.getCenterOfMass();
+      if ( !user.isVisible() || (center.z == 0) ) {
+        continue;
+      }
+      
+      GlobalUserTracker::Observation o;
+      o.sensor = sensor;
+      o.localId = user.getId();
+      o.position = toWorld( center );
+      o.hasFeatures = getFeatures( user.getSkeleton(), o.features );
+      observations->push_back( o );
+      
+      UserLabel label;
+      label.localId = user.getId();
+      userTracker.convertJointCoordinatesToDepth( center.x, center.y, center.z,
+                                                  &label.position.x, &label.position.y );
+      label.position *= scale;
+      userLabels.push_back( label );
+    }
+  }
+  
+  // ユーザーの位置に共通の ID を表示する
+  void showUsers( const GlobalUserTracker& globalUserTracker, int sensor )
+  {
+    if ( !userTrackingEnabled || depthImage.empty() ) {
+      return;
+    }
+    
+    cv::Mat usersImage = depthImage.clone();
+    for ( size_t i = 0; i < userLabels.size(); ++i ) {
+      std::stringstream ss;
+      ss << globalUserTracker.getGlobalId( sensor, userLabels[i].localId )
+         << " (" << userLabels[i].localId << ")";
+      cv::putText( usersImage, ss.str(), userLabels[i].position,
+                   cv::FONT_HERSHEY_SIMPLEX, 0.7, cv::Scalar( 255 ) );
+    }
+    
+    cv::imshow( "Depth Stream " + getUri(), usersImage );
+  }
+  
+  // センサーの位置と向き(世界座標への変換)
+  void setExtrinsics( const VoxelGrid::Extrinsics& extrinsics )
+  {
+    this->extrinsics = extrinsics;
   }
   
   const std::string& getUri() const
@@ -52,33 +281,184 @@ public:
     return uri;
   }
   
+  const std::string& getSerial() const
+  {
+    return serial;
+  }
+  
+  const StartupTimes& getStartupTimes() const
+  {
+    return startupTimes;
+  }
+  
 private:
   
-  // カラーストリームを表示できる形に変換する
-  cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
+  // キャッシュのキーにするシリアル番号(記録したファイルなど、取得できないときは URI)
+  std::string getSerialNumber( const char* uri )
   {
-    // OpenCV の形に変換する
-    cv::Mat colorImage = cv::Mat( colorFrame.getHeight(),
-                                 colorFrame.getWidth(),
-                                 CV_8UC3, (unsigned char*)colorFrame.getData() );
+    char serial[64] = { 0 };
+    int size = sizeof(serial);
+    if ( (device.getProperty( openni::DEVICE_PROPERTY_SERIAL_NUMBER, serial, &size ) != openni::STATUS_OK) ||
+         (serial[0] == 0) ) {
+      return uri;
+    }
     
-    // BGR の並びを RGB に変換する
-    cv::cvtColor( colorImage, colorImage, CV_RGB2BGR );
+    return serial;
+  }
+  
+  void createStream( openni::VideoStream& stream, openni::SensorType sensorType,
+                     const std::string& serial, VideoModeCache& videoModeCache )
+  {
+    openni::Status ret = stream.create( device, sensorType );
+    if ( ret != openni::STATUS_OK ) {
+      throw std::runtime_error( "openni::VideoStream::create() failed." );
+    }
     
-    return colorImage;
+    // 前回使えたビデオモードを設定する
+    openni::VideoMode mode;
+    if ( videoModeCache.find( serial, sensorType, &mode ) &&
+         (stream.setVideoMode( mode ) == openni::STATUS_OK) ) {
+      ++startupTimes.cached;
+      return;
+    }
+    
+    // キャッシュになければ(または設定できなければ)、対応しているモードから選ぶ
+    mode = selectVideoMode( stream, sensorType );
+    if ( stream.setVideoMode( mode ) != openni::STATUS_OK ) {
+      mode = stream.getVideoMode();
+    }
+    videoModeCache.store( serial, sensorType, mode );
   }
   
-  cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
+  // 640x480 30fps のモードを選ぶ(なければ今のモードのまま)
+  static openni::VideoMode selectVideoMode( const openni::VideoStream& stream, openni::SensorType sensorType )
   {
-    // 距離データを画像化する(16bit)
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                 depthFrame.getWidth(),
-                                 CV_16UC1, (unsigned short*)depthFrame.getData() );
+    openni::PixelFormat pixelFormat = (sensorType == openni::SENSOR_COLOR) ?
+      openni::PIXEL_FORMAT_RGB888 : openni::PIXEL_FORMAT_DEPTH_1_MM;
     
-    // 0-10000mmまでのデータを0-255(8bit)にする
-    depthImage.convertTo( depthImage, CV_8U, 255.0 / 10000 );
+    const openni::Array<openni::VideoMode>& modes = stream.getSensorInfo().getSupportedVideoModes();
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      if ( (modes[i].getPixelFormat() == pixelFormat) && (modes[i].getResolutionX() == 640) &&
+           (modes[i].getResolutionY() == 480) && (modes[i].getFps() == 30) ) {
+        return modes[i];
+      }
+    }
+    
+    return stream.getVideoMode();
+  }
+  
+  // センサーの座標を世界座標にする
+  cv::Point3f toWorld( const nite::Point3f& p ) const
+  {
+    const VoxelGrid::Extrinsics& e = extrinsics;
+    return cv::Point3f( (e.r[0] * p.x) + (e.r[1] * p.y) + (e.r[2] * p.z) + e.t[0],
+                        (e.r[3] * p.x) + (e.r[4] * p.y) + (e.r[5] * p.z) + e.t[1],
+                        (e.r[6] * p.x) + (e.r[7] * p.y) + (e.r[8] * p.z) + e.t[2] );
+  }
+  
+  // 向きによらない骨格の長さ(肩幅、胴、上腕、太もも)を求める
+  // (関節の信頼度が低いときは求めない)
+  static bool getFeatures( const nite::Skeleton& skeleton, float* features )
+  {
+    if ( skeleton.getState() != nite::SKELETON_TRACKED ) {
+      return false;
+    }
+    
+    static const nite::JointType bones[][2] = {
+      { nite::JOINT_LEFT_SHOULDER, nite::JOINT_RIGHT_SHOULDER },
+      { nite::JOINT_NECK, nite::JOINT_TORSO },
+      { nite::JOINT_LEFT_SHOULDER, nite::JOINT_LEFT_ELBOW },
+      { nite::JOINT_RIGHT_SHOULDER, nite::JOINT_RIGHT_ELBOW },
+      { nite::JOINT_LEFT_HIP, nite::JOINT_LEFT_KNEE },
+      { nite::JOINT_RIGHT_HIP, nite::JOINT_RIGHT_KNEE },
+    };
+    
+    float lengths[6];
+    for ( int i = 0; i < 6; ++i ) {
+      const nite::SkeletonJoint& a = skeleton.getJoint( bones[i][0] );
+      const nite::SkeletonJoint& b = skeleton.getJoint( bones[i][1] );
+      if ( (a.getPositionConfidence() < 0.5f) || (b.getPositionConfidence() < 0.5f) ) {
+        return false;
+      }
+      
+      float dx = a.getPosition().x - b.getPosition().x;
+      float dy = a.getPosition().y - b.getPosition().y;
+      float dz = a.getPosition().z - b.getPosition().z;
+      lengths[i] = std::sqrt( (dx * dx) + (dy * dy) + (dz * dz) );
+    }
+    
+    // 左右のあるものは平均する
+    features[0] = lengths[0];
+    features[1] = lengths[1];
+    features[2] = (lengths[2] + lengths[3]) / 2;
+    features[3] = (lengths[4] + lengths[5]) / 2;
+    return true;
+  }
+  
+  // 指定した解像度以上で一番小さいモードにする(同じピクセルフォーマットとフレームレート)
+  void changeResolution( openni::VideoStream& stream, int width, int height )
+  {
+    openni::VideoMode current = stream.getVideoMode();
+    const openni::Array<openni::VideoMode>& modes = stream.getSensorInfo().getSupportedVideoModes();
+    
+    int found = -1;
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      if ( (modes[i].getPixelFormat() == current.getPixelFormat()) &&
+           (modes[i].getFps() == current.getFps()) &&
+           (modes[i].getResolutionX() >= width) && (modes[i].getResolutionY() >= height) &&
+           ((found < 0) || (modes[i].getResolutionX() < modes[found].getResolutionX())) ) {
+        found = i;
+      }
+    }
+    
+    if ( (found < 0) || (modes[found].getResolutionX() == current.getResolutionX()) ) {
+      return;
+    }
+    
+    // 動作中に変更できないデバイスがあるので、一度止める
+    stream.stop();
+    if ( stream.setVideoMode( modes[found] ) != openni::STATUS_OK ) {
+      std::cout << "openni::VideoStream::setVideoMode() failed : "
+                << openni::OpenNI::getExtendedError() << std::endl;
+    }
+    stream.start();
+  }
+  
+  // ストリームの解像度が大きいときは、変換しながら整数分の 1 に間引く
+  // (何倍かは切り捨てるので、間引いた結果が表示の解像度より小さくなることはない)
+  int getDecimation( const openni::VideoFrameRef& frame ) const
+  {
+    return frame.isValid() ? (std::max)( frame.getWidth() / width, 1 ) : 1;
+  }
+  
+  // 間引いても表示の解像度にならないとき(整数分の 1 でない、JPEG)は、ホストで縮小する
+  cv::Mat fitResolution( const cv::Mat& image, int interpolation )
+  {
+    if ( (image.cols == width) && (image.rows == height) ) {
+      return image;
+    }
     
-    return depthImage;
+    cv::Mat resized;
+    cv::resize( image, resized, cv::Size( width, height ), 0, 0, interpolation );
+    return resized;
+  }
+  
+private:
+  
+  // カラーストリームを表示できる形に変換する
+  cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
+  {
+    // ピクセルフォーマットに合わせて BGR の画像に変換する(必要なら間引いて縮小する)
+    colorConverter.setDecimation( getDecimation( colorFrame ) );
+    return fitResolution( colorConverter.convert( colorFrame ), cv::INTER_AREA );
+  }
+  
+  cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
+  {
+    // 0-10000mmまでのデータを0-255(8bit)にする
+    // (必要なら縮小する。距離を混ぜないよう間引く)
+    depthConverter.setDecimation( getDecimation( depthFrame ) );
+    return fitResolution( depthConverter.convert( depthFrame ), cv::INTER_NEAREST );
   }
   
 private:
@@ -86,31 +466,82 @@ private:
   openni::Device device;
   openni::VideoStream colorStream;
   openni::VideoStream depthStream;
+  std::vector<openni::VideoStream*> streams;
+  
+  FrameSync frameSync;      // Depth とカラーのフレームの組
+  StartupTimes startupTimes;  // 起動にかかった時間
+  
+  ResolutionController resolutionController;  // 負荷に応じた解像度の調整
+  int width;                // 表示する解像度
+  int height;
   
   cv::Mat colorImage;
   cv::Mat depthImage;
   
+  PixelConverter colorConverter;          // カラーの BGR への変換
+  PixelConverter depthConverter;          // Depth の 8bit への変換
+  
+  openni::VideoFrameRef lastDepthFrame;   // ボクセルに統合していない Depth フレーム
+  VoxelGrid::Extrinsics extrinsics;       // センサーから世界座標への変換
+  
+  // 表示する UserId と位置
+  struct UserLabel
+  {
+    nite::UserId localId;
+    cv::Point2f position;   // 表示している Depth 画像の位置
+  };
+  
+  nite::UserTracker userTracker;          // ユーザーの検出
+  bool userTrackingEnabled;               // ユーザーを検出するか
+  std::vector<UserLabel> userLabels;      // 最後に検出したユーザー
+  
   std::string uri;
+  std::string serial;       // シリアル番号(取得できないときは URI)
 };
 
 class SampleApp
 {
 public:
   
-  void initialize()
+  SampleApp()
+    : videoModeCache( "VideoModeCache.txt" )
+    , fusionEnabled( false )
+    , fusionFrame( 0 )
+    , fusionTime( 0 )
+    , userTrackingEnabled( false )
+    , userTrackingTime( 0 )
   {
+  }
+  
+  // URI(記録したファイル名など)を指定したときは、そのデバイスを開く
+  void initialize( int uriCount, const char* const* uris )
+  {
+    std::vector<std::string> uriList;
+    if ( uriCount != 0 ) {
+      for ( int i = 0; i < uriCount; ++i ) {
+        std::cout << uris[i] << std::endl;
+        uriList.push_back( uris[i] );
+      }
+      openDevices( uriList );
+      return;
+    }
+    
     // 接続されているデバイスの一覧を取得する
+    int64 tick = cv::getTickCount();
     openni::Array<openni::DeviceInfo> deviceInfoList;
 		openni::OpenNI::enumerateDevices( &deviceInfoList );
     
-		std::cout << "接続されているデバイスの数 : " << deviceInfoList.getSize() << std::endl;
+		std::cout << "接続されているデバイスの数 : " << deviceInfoList.getSize()
+              << " (" << lap( tick ) << " ms)" << std::endl;
 		for ( int i = 0; i < deviceInfoList.getSize(); ++i ) {
 			std::cout << deviceInfoList[i].getName() << ", "
                 << deviceInfoList[i].getVendor() << ", "
                 << deviceInfoList[i].getUri() << std::endl;
       
-      openDevice( deviceInfoList[i].getUri() );
+      uriList.push_back( deviceInfoList[i].getUri() );
 		}
+    
+    openDevices( uriList );
   }
   
   void update()
@@ -119,30 +550,286 @@ public:
       it != sensors.end(); ++it ) {
         (*it)->update();
     }
+    
+    if ( fusionEnabled ) {
+      fuse();
+    }
+    
+    if ( userTrackingEnabled ) {
+      trackUsers();
+    }
+  }
+  
+  // ボクセルへの統合を切り替える
+  void changeFusion()
+  {
+    fusionEnabled = !fusionEnabled;
+    if ( !fusionEnabled ) {
+      cv::destroyWindow( "Occupancy" );
+    }
+  }
+  
+  // センサーをまたいだユーザーの追跡を切り替える
+  void changeUserTracking()
+  {
+    userTrackingEnabled = !userTrackingEnabled;
+    for ( size_t i = 0; i < sensors.size(); ++i ) {
+      sensors[i]->setUserTracking( userTrackingEnabled );
+    }
+  }
+  
+  void showSyncStats()
+  {
+    for ( std::vector<DepthSensor*>::iterator it = sensors.begin();
+      it != sensors.end(); ++it ) {
+        (*it)->showSyncStats();
+    }
+    
+    if ( fusionEnabled ) {
+      std::cout << "fusion : " << fusionTime << " ms"
+                << "  voxels : " << voxelGrid.getVoxelCount() << std::endl;
+    }
+    
+    if ( userTrackingEnabled ) {
+      std::cout << "users : " << globalUserTracker.getTracks().size()
+                << "  total : " << globalUserTracker.getTotalCount()
+                << "  tracking : " << userTrackingTime << " ms" << std::endl;
+    }
   }
   
 private:
   
-  void openDevice( const char* uri )
+  // すべてのセンサーの Depth を、デバイスごとのスレッドで同時にボクセルに追加し、
+  // 変わったボクセルだけを使って、床を上から見た占有マップを更新する
+  void fuse()
+  {
+    int64 tick = cv::getTickCount();
+    ++fusionFrame;
+    
+    deviceWorkers.run( FuseTask( sensors, voxelGrid, fusionFrame ) );
+    
+    // 占有マップは 1 ピクセルが 1 ボクセル(x が横、z が縦で、原点は下の中央)
+    const int mapSize = 400;
+    if ( occupancyMap.empty() ) {
+      occupancyMap = cv::Mat::zeros( mapSize, mapSize, CV_32FC1 );
+    }
+    
+    // 点の入らなかった場所は、ボクセルと同じ速さで薄くする
+    occupancyMap -= 0.05;
+    cv::max( occupancyMap, 0.0, occupancyMap );
+    
+    // 占有マップに入る範囲(高さはすべて)だけを取り出す
+    VoxelGrid::Region mapRegion( -(mapSize / 2), INT_MIN, 0, (mapSize / 2) - 1, INT_MAX, mapSize - 1 );
+    voxelGrid.collectDirty( &dirty, fusionFrame, mapRegion );
+    for ( size_t i = 0; i < dirty.size(); ++i ) {
+      int x, y, z;
+      VoxelGrid::getIndex( dirty[i].key, &x, &y, &z );
+      int col = x + (mapSize / 2);
+      int row = (mapSize - 1) - z;
+      if ( (col >= 0) && (col < mapSize) && (row >= 0) && (row < mapSize) ) {
+        float& cell = occupancyMap.at<float>( row, col );
+        cell = (std::max)( cell, dirty[i].occupancy );
+      }
+    }
+    
+    // 使われなくなったボクセルを、ときどき捨てる
+    if ( (fusionFrame % 300) == 0 ) {
+      voxelGrid.prune( fusionFrame );
+    }
+    
+    fusionTime = lap( tick );
+    
+    cv::Mat mapImage;
+    occupancyMap.convertTo( mapImage, CV_8U, 255.0 / 3.5 );
+    cv::imshow( "Occupancy", mapImage );
+  }
+  
+  // すべてのセンサーで、デバイスごとのスレッドで同時にユーザーを検出し、
+  // 同じ人に共通の ID をつける
+  void trackUsers()
   {
-    DepthSensor* sensor = new DepthSensor();
-    sensor->initialize( uri );
-    sensors.push_back( sensor );
+    int64 tick = cv::getTickCount();
+    
+    observations.resize( sensors.size() );
+    deviceWorkers.run( TrackUsersTask( sensors, observations ) );
+    
+    allObservations.clear();
+    for ( size_t i = 0; i < observations.size(); ++i ) {
+      allObservations.insert( allObservations.end(), observations[i].begin(), observations[i].end() );
+    }
+    globalUserTracker.update( allObservations );
+    
+    userTrackingTime = lap( tick );
+    
+    for ( size_t i = 0; i < sensors.size(); ++i ) {
+      sensors[i]->showUsers( globalUserTracker, (int)i );
+    }
+  }
+  
+  // デバイスのスレッドで、Depth をボクセルに追加する
+  struct FuseTask
+  {
+    FuseTask( const std::vector<DepthSensor*>& sensors, VoxelGrid& voxelGrid, unsigned int frame )
+      : sensors( sensors ), voxelGrid( voxelGrid ), frame( frame )
+    {
+    }
+    
+    void operator()( int device ) const
+    {
+      sensors[device]->fuse( &voxelGrid, frame );
+    }
+    
+    const std::vector<DepthSensor*>& sensors;
+    VoxelGrid& voxelGrid;
+    unsigned int frame;
+  };
+  
+  // デバイスのスレッドで、ユーザーを検出する
+  struct TrackUsersTask
+  {
+    TrackUsersTask( const std::vector<DepthSensor*>& sensors,
+                    std::vector<std::vector<GlobalUserTracker::Observation> >& observations )
+      : sensors( sensors ), observations( observations )
+    {
+    }
+    
+    void operator()( int device ) const
+    {
+      sensors[device]->trackUsers( device, &observations[device] );
+    }
+    
+    const std::vector<DepthSensor*>& sensors;
+    std::vector<std::vector<GlobalUserTracker::Observation> >& observations;
+  };
+  
+  // センサーの位置と向きを読む
+  // 1 行は「回転(3x3、行ごと) 平行移動(mm) シリアル番号」
+  void loadExtrinsics( const char* fileName )
+  {
+    std::ifstream file( fileName );
+    std::string line;
+    while ( std::getline( file, line ) ) {
+      std::istringstream stream( line );
+      VoxelGrid::Extrinsics extrinsics;
+      for ( int i = 0; i < 9; ++i ) {
+        stream >> extrinsics.r[i];
+      }
+      stream >> extrinsics.t[0] >> extrinsics.t[1] >> extrinsics.t[2] >> std::ws;
+      
+      std::string serial;
+      std::getline( stream, serial );
+      if ( stream.fail() || serial.empty() ) {
+        continue;
+      }
+      
+      for ( size_t i = 0; i < sensors.size(); ++i ) {
+        if ( sensors[i]->getSerial() == serial ) {
+          sensors[i]->setExtrinsics( extrinsics );
+        }
+      }
+    }
+  }
+  
+  // デバイスごとにスレッドを分けて、並行して開く
+  // (デバイスを開いてストリームを開始するまでの待ち時間が、台数分積み重ならない)
+  void openDevices( const std::vector<std::string>& uris )
+  {
+    int64 tick = cv::getTickCount();
+    
+    std::vector<DepthSensor*> opened( uris.size(), 0 );
+    std::vector<std::string> errors( uris.size() );
+    std::vector<std::thread> threads;
+    for ( size_t i = 0; i < uris.size(); ++i ) {
+      threads.push_back( std::thread( &SampleApp::openDevice, this,
+                                      uris[i], &opened[i], &errors[i] ) );
+    }
+    
+    for ( size_t i = 0; i < threads.size(); ++i ) {
+      threads[i].join();
+    }
+    double total = lap( tick );
+    
+    // 段階ごとの時間を表示する(開けなかったデバイスは飛ばして、ほかのデバイスを使う)
+    for ( size_t i = 0; i < uris.size(); ++i ) {
+      if ( opened[i] == 0 ) {
+        std::cout << uris[i] << " : " << errors[i] << std::endl;
+        continue;
+      }
+      
+      const DepthSensor::StartupTimes& times = opened[i]->getStartupTimes();
+      std::cout << uris[i]
+                << " open : " << times.open << " ms"
+                << "  configure : " << times.configure << " ms"
+                << (times.cached == 2 ? " (cached)" : "")
+                << "  start : " << times.start << " ms" << std::endl;
+      sensors.push_back( opened[i] );
+    }
+    std::cout << "起動時間 : " << total << " ms" << std::endl;
+    
+    if ( !uris.empty() && sensors.empty() ) {
+      throw std::runtime_error( "no device opened." );
+    }
+    
+    // 新しく選んだビデオモードを保存する
+    videoModeCache.save();
+    
+    // ボクセルへの統合とユーザーの検出をする、デバイスごとのスレッドを作る
+    deviceWorkers.resize( (int)sensors.size() );
+    
+    // 1 フレームの時間(30fps)を、デバイスで分けあう
+    for ( size_t i = 0; i < sensors.size(); ++i ) {
+      sensors[i]->setFrameBudget( (1000.0 / 30) / sensors.size() );
+    }
+    
+    // ボクセルに統合するための、センサーの位置と向き
+    loadExtrinsics( "Extrinsics.txt" );
+  }
+  
+  // スレッドで 1 台のデバイスを開く(エラーの内容はスレッドごとなので、ここで取得する)
+  void openDevice( std::string uri, DepthSensor** sensor, std::string* error )
+  {
+    DepthSensor* newSensor = new DepthSensor();
+    try {
+      newSensor->initialize( uri.c_str(), videoModeCache );
+      *sensor = newSensor;
+    }
+    catch ( std::exception& ex ) {
+      *error = std::string( ex.what() ) + " " + openni::OpenNI::getExtendedError();
+      delete newSensor;
+    }
   }
   
 private:
   
   std::vector<DepthSensor*> sensors;
+  VideoModeCache videoModeCache;    // デバイスごとのビデオモード
+  
+  VoxelGrid voxelGrid;              // すべてのセンサーを統合したボクセル
+  bool fusionEnabled;               // ボクセルに統合するか
+  unsigned int fusionFrame;         // 統合したフレームの番号
+  double fusionTime;                // 統合にかかった時間(ms)
+  std::vector<VoxelGrid::Dirty> dirty;  // 変わったボクセル
+  cv::Mat occupancyMap;             // 床を上から見た占有マップ
+  
+  GlobalUserTracker globalUserTracker;  // センサーをまたいだユーザーの追跡
+  bool userTrackingEnabled;         // ユーザーを追跡するか
+  double userTrackingTime;          // 追跡にかかった時間(ms)
+  std::vector<std::vector<GlobalUserTracker::Observation> > observations;  // センサーごとのユーザー
+  std::vector<GlobalUserTracker::Observation> allObservations;            // すべてのユーザー
+  
+  DeviceWorkers deviceWorkers;      // デバイスごとの処理スレッド(フレーム間で使いまわす)
 };
 
 int main(int argc, const char * argv[])
 {
   try {
-    // OpenNI を初期化する
+    // OpenNI と NiTE を初期化する
     openni::OpenNI::initialize();
+    nite::NiTE::initialize();
     
+    // 引数に URI(.oni ファイルなど)を指定すると、そのデバイスを開く
     SampleApp app;
-    app.initialize();
+    app.initialize( argc - 1, &argv[1] );
     while ( 1 ) {
       app.update();
       
@@ -150,6 +837,18 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // Depth とカラーの組の状況を表示する
+      else if ( key == 's' ) {
+        app.showSyncStats();
+      }
+      // センサーを統合した占有マップを表示する
+      else if ( key == 'v' ) {
+        app.changeFusion();
+      }
+      // センサーをまたいでユーザーを追跡する
+      else if ( key == 'u' ) {
+        app.changeUserTracking();
+      }
     }
   }
   catch ( std::exception& ) {
@@ -0,0 +1,60 @@
+#ifndef _COLOR_DECODER_H_
+#define _COLOR_DECODER_H_
+
+#include <OpenNI.h>
+#include <opencv2\opencv.hpp>
+
+#include "PixelConverter.h"
+
+// J[t[AsNZtH[}bgɉ BGR ̉摜ɕϊ
+//
+// RGB888 ȊOɁAUSB ̑ш̏ YUV422(UYVY)AYUYVAJPEG ɑΉB
+// ϊ PixelConverter ArfI[hςƂI񂾊֐ōsB
+// ϊ̉摜͎g܂킷̂ŁA𑜓xςȂ胁mۂȂȂB
+// E̔]́AXg[̐ݒ(ׂĂ̗p҂Ɍ)ł͂ȂϊƂɎw肷
+class ColorDecoder
+{
+public:
+
+  ColorDecoder()
+    : converter( CV_8UC3 )
+  {
+  }
+
+  // E𔽓]ĕϊ邩ǂ
+  void setMirror( bool mirror )
+  {
+    converter.setMirror( mirror );
+  }
+
+  bool isMirror() const
+  {
+    return converter.isMirror();
+  }
+
+  // t[ BGR ̉摜ɕϊ(ʂ͎̌Ăяo܂ŗL)
+  const cv::Mat& decode( const openni::VideoFrameRef& colorFrame )
+  {
+    return converter.convert( colorFrame );
+  }
+
+  // ϊ̑xv(1 t[̕ϊ(ms)Ԃ)
+  double benchmark( const openni::VideoFrameRef& colorFrame, int count = 100 )
+  {
+    // 1 ڂ͊֐̑Iƃ̊mۂ̂ŁAvɊ܂߂Ȃ
+    decode( colorFrame );
+
+    int64 start = cv::getTickCount();
+    for ( int i = 0; i < count; ++i ) {
+      decode( colorFrame );
+    }
+
+    return (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency() / count;
+  }
+
+private:
+
+  PixelConverter converter;   // BGR ւ̕ϊ(ϊ̓t[ԂŎg܂킷)
+};
+
+#endif
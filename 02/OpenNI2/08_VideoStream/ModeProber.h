@@ -0,0 +1,259 @@
+#ifndef _MODE_PROBER_H_
+#define _MODE_PROBER_H_
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2\opencv.hpp>
+
+// Xg[̑ΉĂrfI[hۂɓČvAԂ悢̂I
+//
+// [hƂɁA(Pipeline)ʂƂ̃t[[gAxAԂ𑪂B
+// ڕW̃t[[gۂAԂ\ZɎ܂郂[ĥAԉ𑜓x̑傫̂IԁB
+// I񂾃[h̓foCX̋@ƃZT[ƂɃt@CɕۑA͌vɎg
+class ModeProber
+{
+public:
+
+  // [hƂ̌v
+  struct Result
+  {
+    Result()
+      : started( false ), fps( 0 ), latency( 0 ), cost( 0 )
+    {
+    }
+
+    openni::VideoMode mode;
+    bool started;       // rfI[hݒ肵ĊJnł
+    double fps;         // ʂƂ̃t[[g
+    double latency;     // t[͂Ă珈I܂ł̒x(ms)
+    double cost;        // 1 t[̏(ms)
+  };
+
+  // targetFps  : ۂt[[g
+  // costRatio  : 1 t[̎Ԃ̂AɎgĂ悢
+  ModeProber( int targetFps = 30, double costRatio = 0.5 )
+    : targetFps( targetFps )
+    , costRatio( costRatio )
+    , warmupFrames( 5 )
+    , probeFrames( 30 )
+  {
+  }
+
+  // ΉĂ邷ׂẴrfI[hv(I猳̃[hɖ߂)
+  // pipeline ̓t[󂯎ď֐IuWFNg
+  template<typename Pipeline>
+  std::vector<Result> probe( openni::VideoStream& stream, Pipeline& pipeline )
+  {
+    openni::VideoMode current = stream.getVideoMode();
+    const openni::Array<openni::VideoMode>& modes = stream.getSensorInfo().getSupportedVideoModes();
+
+    std::vector<Result> results;
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      results.push_back( measure( stream, modes[i], pipeline ) );
+    }
+
+    setVideoMode( stream, current );
+    return results;
+  }
+
+  // ڕW𖞂[ĥA𑜓xԑ傫̂I(Ȃ珈̌y)
+  // ̂Ȃ΁At[[gԍ
+  int select( const std::vector<Result>& results ) const
+  {
+    double budget = (1000.0 / targetFps) * costRatio;
+
+    int best = -1;
+    int fastest = -1;
+    for ( int i = 0; i < (int)results.size(); ++i ) {
+      const Result& r = results[i];
+      if ( !r.started ) {
+        continue;
+      }
+
+      if ( (fastest < 0) || (r.fps > results[fastest].fps) ) {
+        fastest = i;
+      }
+
+      // ^CX^v̂炬̂ŁAt[[g 1 ܂ŋ
+      if ( (r.fps < (targetFps * 0.9)) || (r.cost > budget) ) {
+        continue;
+      }
+
+      if ( best < 0 ) {
+        best = i;
+        continue;
+      }
+
+      int pixels = getPixels( r.mode );
+      int bestPixels = getPixels( results[best].mode );
+      if ( (pixels > bestPixels) || ((pixels == bestPixels) && (r.cost < results[best].cost)) ) {
+        best = i;
+      }
+    }
+
+    return (best >= 0) ? best : fastest;
+  }
+
+  // vʂ\
+  static void print( std::ostream& out, const std::vector<Result>& results, int selected )
+  {
+    for ( int i = 0; i < (int)results.size(); ++i ) {
+      const Result& r = results[i];
+      out << ((i == selected) ? "* " : "  ")
+          << r.mode.getResolutionX() << "x" << r.mode.getResolutionY()
+          << "@" << r.mode.getFps() << " format " << r.mode.getPixelFormat();
+      if ( r.started ) {
+        out << "  fps : " << r.fps << "  latency : " << r.latency << " ms"
+            << "  cost : " << r.cost << " ms" << std::endl;
+      }
+      else {
+        out << "  (not available)" << std::endl;
+      }
+    }
+  }
+
+  // ۑ[hǂ(@ƃZT[)
+  static bool load( const std::string& fileName, const std::string& key, openni::VideoMode* mode )
+  {
+    std::ifstream file( fileName.c_str() );
+    std::string line;
+    while ( std::getline( file, line ) ) {
+      int pixelFormat, width, height, fps;
+      std::string name;
+      if ( parse( line, &pixelFormat, &width, &height, &fps, &name ) && (name == key) ) {
+        mode->setPixelFormat( (openni::PixelFormat)pixelFormat );
+        mode->setResolution( width, height );
+        mode->setFps( fps );
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // I񂾃[hۑ(ق̋@ZT[̍s͎c)
+  static void save( const std::string& fileName, const std::string& key, const openni::VideoMode& mode )
+  {
+    std::vector<std::string> lines;
+    {
+      std::ifstream file( fileName.c_str() );
+      std::string line;
+      while ( std::getline( file, line ) ) {
+        int pixelFormat, width, height, fps;
+        std::string name;
+        if ( parse( line, &pixelFormat, &width, &height, &fps, &name ) && (name != key) ) {
+          lines.push_back( line );
+        }
+      }
+    }
+
+    std::stringstream line;
+    line << mode.getPixelFormat() << " " << mode.getResolutionX() << " "
+         << mode.getResolutionY() << " " << mode.getFps() << " " << key;
+    lines.push_back( line.str() );
+
+    std::ofstream file( fileName.c_str() );
+    for ( size_t i = 0; i < lines.size(); ++i ) {
+      file << lines[i] << std::endl;
+    }
+  }
+
+  // rfI[hύX(쒆ɕύXłȂfoCX̂ŁAx~߂)
+  static bool setVideoMode( openni::VideoStream& stream, const openni::VideoMode& mode )
+  {
+    stream.stop();
+    openni::Status ret = stream.setVideoMode( mode );
+    stream.start();
+    return ret == openni::STATUS_OK;
+  }
+
+private:
+
+  static int getPixels( const openni::VideoMode& mode )
+  {
+    return mode.getResolutionX() * mode.getResolutionY();
+  }
+
+  // 1 śusNZtH[}bg   t[[g @ƃZT[v
+  static bool parse( const std::string& line, int* pixelFormat, int* width, int* height,
+                     int* fps, std::string* key )
+  {
+    std::istringstream stream( line );
+    stream >> *pixelFormat >> *width >> *height >> *fps >> std::ws;
+    std::getline( stream, *key );
+    return !stream.fail() && !key->empty();
+  }
+
+  static double getMilliseconds( int64 start, int64 end )
+  {
+    return (end - start) * 1000.0 / cv::getTickFrequency();
+  }
+
+  template<typename Pipeline>
+  Result measure( openni::VideoStream& stream, const openni::VideoMode& mode, Pipeline& pipeline )
+  {
+    Result result;
+    result.mode = mode;
+    if ( !setVideoMode( stream, mode ) ) {
+      return result;
+    }
+
+    openni::VideoStream* streams[] = { &stream };
+    int64 first = 0;
+    int64 last = 0;
+    double totalCost = 0;
+    double totalOffset = 0;
+    double minOffset = 0;
+    int count = 0;
+    for ( int i = 0; i < (warmupFrames + probeFrames); ++i ) {
+      // t[Ȃ[h͎gȂ̂Ƃ
+      int changedIndex;
+      if ( openni::OpenNI::waitForAnyStream( streams, 1, &changedIndex, 2000 ) != openni::STATUS_OK ) {
+        return result;
+      }
+
+      openni::VideoFrameRef frame;
+      stream.readFrame( &frame );
+      int64 arrived = cv::getTickCount();
+      pipeline( frame );
+      int64 done = cv::getTickCount();
+
+      // ŏ̐t[̓[h̐؂ւň肵Ȃ̂ŁAvȂ
+      if ( i < warmupFrames ) {
+        continue;
+      }
+
+      // foCX̎vƃzXg̎v̍́At[xē͂傫ȂB
+      // ̈ԏt[x̂Ȃ̂ƂāAx߂
+      double offset = getMilliseconds( 0, arrived ) - (frame.getTimestamp() / 1000.0);
+      minOffset = (count == 0) ? offset : (std::min)( minOffset, offset );
+      totalOffset += offset;
+      totalCost += getMilliseconds( arrived, done );
+
+      first = (count == 0) ? arrived : first;
+      last = arrived;
+      ++count;
+    }
+
+    result.started = true;
+    result.cost = totalCost / count;
+    result.latency = ((totalOffset / count) - minOffset) + result.cost;
+    result.fps = (last != first) ? ((count - 1) * 1000.0 / getMilliseconds( first, last )) : 0;
+    return result;
+  }
+
+private:
+
+  int targetFps;        // ۂt[[g
+  double costRatio;     // 1 t[̎Ԃ̂AɎgĂ悢
+  int warmupFrames;     // vȂŏ̃t[
+  int probeFrames;      // vt[
+};
+
+#endif
@@ -0,0 +1,438 @@
+#ifndef _PIXEL_CONVERTER_H_
+#define _PIXEL_CONVERTER_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2\opencv.hpp>
+
+// ϊ̓r 1 sNZ(e 0 - 255BO[ r = g = b)
+struct PixelValue
+{
+  int r, g, b;
+};
+
+// ϊ̃sNZtH[}bg
+// PIXELS sNZ(BYTES oCg)ǂ
+template<openni::PixelFormat Format>
+struct PixelSource;
+
+// RGB888  R G B ̏ɕ
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_RGB888>
+{
+  enum { PIXELS = 1, BYTES = 3 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = s[0];
+    p[0].g = s[1];
+    p[0].b = s[2];
+  }
+};
+
+// YUV  2 sNZ 4 oCgŐFL(Y0, U, Y1, V ̓oCg̈ʒu)
+// W cv::cvtColor Ɠ ITU-R BT.601(20bit ̌Œ菬_)
+template<int Y0, int U, int Y1, int V>
+struct YuvPixelSource
+{
+  enum { PIXELS = 2, BYTES = 4 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    int u = s[U] - 128;
+    int v = s[V] - 128;
+    int r = (1 << 19) + (1673527 * v);
+    int g = (1 << 19) - (852492 * v) - (409993 * u);
+    int b = (1 << 19) + (2116026 * u);
+
+    store( p[0], s[Y0], r, g, b );
+    store( p[1], s[Y1], r, g, b );
+  }
+
+  static void store( PixelValue& p, int y, int r, int g, int b )
+  {
+    int luma = ((y > 16) ? (y - 16) : 0) * 1220542;
+    p.r = clamp( (luma + r) >> 20 );
+    p.g = clamp( (luma + g) >> 20 );
+    p.b = clamp( (luma + b) >> 20 );
+  }
+
+  static int clamp( int value )
+  {
+    return (value < 0) ? 0 : (value > 255) ? 255 : value;
+  }
+};
+
+// YUV422  U Y0 V Y1 ̏
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_YUV422> : YuvPixelSource<1, 0, 3, 2>
+{
+};
+
+// YUYV  Y0 U Y1 V ̏
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_YUYV> : YuvPixelSource<0, 1, 2, 3>
+{
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_GRAY8>
+{
+  enum { PIXELS = 1, BYTES = 1 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = p[0].g = p[0].b = s[0];
+  }
+};
+
+// 16bit ̃tH[}bg(l LinearScale  0 - 255 ɂ)
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+  enum { PIXELS = 1, BYTES = 2 };
+
+  static void read( const unsigned char* s, PixelValue* p )
+  {
+    p[0].r = *(const unsigned short*)s;
+  }
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_DEPTH_1_MM>
+  : PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+};
+
+template<>
+struct PixelSource<openni::PIXEL_FORMAT_DEPTH_100_UM>
+  : PixelSource<openni::PIXEL_FORMAT_GRAY16>
+{
+};
+
+// t[ 8bit ̉摜(BGR ܂̓O[)ɕϊ
+//
+// ΐAϊ̃sNZtH[}bgAϊ̕сAE̔]Al̏kev[g
+// ɂ֐ōsAgݍ킹ƂɃRpCɍĂ([v̒ɕ򂪂Ȃ)B
+// ]Ȃ RGBAYUVAO[́ASIMD ōœKĂ cv::cvtColor g֐ɂB
+// g֐͕\IсAIтȂ̂̓rfI[hݒ肪ςƂB
+// \Ƃ́AϊȂԈ(ǂރsNZsNZ)B
+// VtH[}bǵAPixelSource ꉻĕ\ɒǉΎg
+class PixelConverter
+{
+public:
+
+  // type : ϊ̉摜̌^(CV_8UC3 Ȃ BGRACV_8UC1 ȂO[)
+  PixelConverter( int type = CV_8UC3 )
+    : type( type )
+    , mirror( false )
+    , range( 10000 )
+    , decimation( 1 )
+    , kernel( 0 )
+    , factor( 0 )
+  {
+  }
+
+  // E𔽓]ĕϊ邩ǂ
+  void setMirror( bool mirror )
+  {
+    this->mirror = mirror;
+    kernel = 0;
+  }
+
+  bool isMirror() const
+  {
+    return mirror;
+  }
+
+  // 16bit ̃tH[}bg 255 ɂl(Depth  mmB255 ȏ)
+  void setRange( int range )
+  {
+    this->range = range;
+    kernel = 0;
+  }
+
+  // cƂ decimation sNZƂ 1 sNZϊ(1 ȂԈȂ)
+  // JPEG ͓WJĂłȂƊԈȂ̂ŁȂ傫̂܂ܕϊ
+  void setDecimation( int decimation )
+  {
+    decimation = (std::max)( decimation, 1 );
+    if ( decimation != this->decimation ) {
+      this->decimation = decimation;
+      kernel = 0;
+    }
+  }
+
+  // t[ϊ(ʂ͎̌Ăяo܂ŗL)
+  const cv::Mat& convert( const openni::VideoFrameRef& frame )
+  {
+    if ( !frame.isValid() ) {
+      return image;
+    }
+
+    // rfI[hςƂAϊ̊֐IтȂ
+    const openni::VideoMode& videoMode = frame.getVideoMode();
+    if ( (kernel == 0) || (videoMode.getPixelFormat() != pixelFormat) ) {
+      select( videoMode.getPixelFormat() );
+    }
+
+    kernel( frame, image, factor, decimation );
+    return image;
+  }
+
+  // ϊłsNZtH[}bg
+  bool isSupported( openni::PixelFormat pixelFormat ) const
+  {
+    return find( pixelFormat ) != 0;
+  }
+
+private:
+
+  // ϊ̊֐(factor ͒l̏k̔{A16bit ̌Œ菬_Bdecimation ͊ԈԊu)
+  typedef void (*Kernel)( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation );
+
+  // l̏kȂ
+  struct NoScale
+  {
+    static void apply( PixelValue&, int )
+    {
+    }
+  };
+
+  // 1 `l̒lk 0 - 255 ɂ
+  struct LinearScale
+  {
+    static void apply( PixelValue& p, int factor )
+    {
+      unsigned int value = ((unsigned int)p.r * factor) >> 16;
+      p.r = p.g = p.b = (value > 255) ? 255 : (int)value;
+    }
+  };
+
+  // ϊ̕
+  struct BgrLayout
+  {
+    enum { TYPE = CV_8UC3, CHANNELS = 3, JPEG_FLAG = CV_LOAD_IMAGE_COLOR };
+
+    static void write( unsigned char* d, const PixelValue& p )
+    {
+      d[0] = (unsigned char)p.b;
+      d[1] = (unsigned char)p.g;
+      d[2] = (unsigned char)p.r;
+    }
+  };
+
+  struct GrayLayout
+  {
+    enum { TYPE = CV_8UC1, CHANNELS = 1, JPEG_FLAG = CV_LOAD_IMAGE_GRAYSCALE };
+
+    // W̍v 256 Ȃ̂ŁAO[̃sNZ͂̂܂܂̒lɂȂ
+    static void write( unsigned char* d, const PixelValue& p )
+    {
+      d[0] = (unsigned char)(((p.r * 77) + (p.g * 150) + (p.b * 29)) >> 8);
+    }
+  };
+
+  // ϊ̊֐(]Ƃ͉E珑ނ̂ŁA]̂߂̏͑Ȃ)
+  template<openni::PixelFormat Format, typename Layout, bool Mirror, typename Scale>
+  static void convertPixels( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation )
+  {
+    if ( decimation > 1 ) {
+      decimatePixels<Format, Layout, Mirror, Scale>( frame, dst, factor, decimation );
+      return;
+    }
+
+    typedef PixelSource<Format> Source;
+    const int step = Mirror ? -Layout::CHANNELS : Layout::CHANNELS;
+
+    int width = frame.getWidth();
+    int height = frame.getHeight();
+    dst.create( height, width, Layout::TYPE );
+
+    const unsigned char* data = (const unsigned char*)frame.getData();
+    int stride = frame.getStrideInBytes();
+    for ( int y = 0; y < height; ++y ) {
+      const unsigned char* s = data + (y * stride);
+      unsigned char* d = dst.ptr( y ) + (Mirror ? ((width - 1) * Layout::CHANNELS) : 0);
+      for ( int x = 0; (x + Source::PIXELS) <= width; x += Source::PIXELS, s += Source::BYTES ) {
+        PixelValue p[Source::PIXELS];
+        Source::read( s, p );
+        for ( int i = 0; i < Source::PIXELS; ++i, d += step ) {
+          Scale::apply( p[i], factor );
+          Layout::write( d, p[i] );
+        }
+      }
+    }
+  }
+
+  // Ԉĕϊ֐(PIXELS sNZ 1 g̃tH[}bǵAgǂŎg 1 o)
+  template<openni::PixelFormat Format, typename Layout, bool Mirror, typename Scale>
+  static void decimatePixels( const openni::VideoFrameRef& frame, cv::Mat& dst, int factor, int decimation )
+  {
+    typedef PixelSource<Format> Source;
+    const int step = Mirror ? -Layout::CHANNELS : Layout::CHANNELS;
+
+    int width = frame.getWidth() / decimation;
+    int height = frame.getHeight() / decimation;
+    dst.create( height, width, Layout::TYPE );
+
+    const unsigned char* data = (const unsigned char*)frame.getData();
+    int stride = frame.getStrideInBytes();
+    for ( int y = 0; y < height; ++y ) {
+      const unsigned char* s = data + ((y * decimation) * stride);
+      unsigned char* d = dst.ptr( y ) + (Mirror ? ((width - 1) * Layout::CHANNELS) : 0);
+      for ( int x = 0, sx = 0; x < width; ++x, sx += decimation, d += step ) {
+        PixelValue p[Source::PIXELS];
+        Source::read( s + ((sx / Source::PIXELS) * Source::BYTES), p );
+        PixelValue& value = p[sx % Source::PIXELS];
+        Scale::apply( value, factor );
+        Layout::write( d, value );
+      }
+    }
+  }
+
+  // cv::cvtColor ł̕ϊ(SourceType ͕ϊ̉摜̌^ACode  cvtColor ̕ϊ̎)
+  template<int SourceType, int Code>
+  static void convertColor( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int )
+  {
+    cv::cvtColor( cv::Mat( frame.getHeight(), frame.getWidth(), SourceType,
+                           (void*)frame.getData(), frame.getStrideInBytes() ), dst, Code );
+  }
+
+  // JPEG  1 t[ 1  JPEG 摜Ȃ̂ŁAWJĂ甽]
+  template<typename Layout, bool Mirror>
+  static void decodeJpeg( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int )
+  {
+    cv::imdecode( cv::Mat( 1, frame.getDataSize(), CV_8UC1, (void*)frame.getData() ),
+                  Layout::JPEG_FLAG, &dst );
+    if ( Mirror ) {
+      cv::flip( dst, dst, 1 );
+    }
+  }
+
+  // ΉĂȂtH[}bg͍ɂ
+  template<typename Layout>
+  static void fillBlack( const openni::VideoFrameRef& frame, cv::Mat& dst, int, int decimation )
+  {
+    dst.create( frame.getHeight() / decimation, frame.getWidth() / decimation, Layout::TYPE );
+    dst = cv::Scalar::all( 0 );
+  }
+
+  // \ 1 s(unit  16bit ̃tH[}bg range ̒P 1 ̒lBkȂ̂ 0A
+  // decimate ͊Ԉĕϊł邩)
+  struct Entry
+  {
+    openni::PixelFormat pixelFormat;
+    int type;
+    bool mirror;
+    int unit;
+    bool decimate;
+    Kernel kernel;
+  };
+
+  static void addEntry( std::vector<Entry>& table, openni::PixelFormat pixelFormat, int type,
+                        bool mirror, int unit, bool decimate, Kernel kernel )
+  {
+    Entry entry = { pixelFormat, type, mirror, unit, decimate, kernel };
+    table.push_back( entry );
+  }
+
+  // tH[}bgƂɁAϊ̕тƔ]̑gݍ킹\ɒǉ
+  template<openni::PixelFormat Format, typename Scale>
+  static void addFormat( std::vector<Entry>& table, int unit )
+  {
+    addEntry( table, Format, CV_8UC3, false, unit, true, &convertPixels<Format, BgrLayout, false, Scale> );
+    addEntry( table, Format, CV_8UC3, true, unit, true, &convertPixels<Format, BgrLayout, true, Scale> );
+    addEntry( table, Format, CV_8UC1, false, unit, true, &convertPixels<Format, GrayLayout, false, Scale> );
+    addEntry( table, Format, CV_8UC1, true, unit, true, &convertPixels<Format, GrayLayout, true, Scale> );
+  }
+
+  // ]ȂƂ cv::cvtColor g(\͐擪T̂ŁAɒǉقgB
+  // cv::cvtColor ł͊ԈȂ̂ŁAԈƂ͌̊֐g)
+  template<openni::PixelFormat Format, int SourceType, int BgrCode, int GrayCode>
+  static void addColorFormat( std::vector<Entry>& table )
+  {
+    addEntry( table, Format, CV_8UC3, false, 0, false, &convertColor<SourceType, BgrCode> );
+    addEntry( table, Format, CV_8UC1, false, 0, false, &convertColor<SourceType, GrayCode> );
+    addFormat<Format, NoScale>( table, 0 );
+  }
+
+  static std::vector<Entry> makeTable()
+  {
+    std::vector<Entry> table;
+    addColorFormat<openni::PIXEL_FORMAT_RGB888, CV_8UC3, CV_RGB2BGR, CV_RGB2GRAY>( table );
+    addColorFormat<openni::PIXEL_FORMAT_YUV422, CV_8UC2, CV_YUV2BGR_UYVY, CV_YUV2GRAY_UYVY>( table );
+    addColorFormat<openni::PIXEL_FORMAT_YUYV, CV_8UC2, CV_YUV2BGR_YUY2, CV_YUV2GRAY_YUY2>( table );
+
+    // O[O[ cv::cvtColor ɂȂ̂ŁABGR ւ̕ϊ cv::cvtColor g
+    addEntry( table, openni::PIXEL_FORMAT_GRAY8, CV_8UC3, false, 0, false, &convertColor<CV_8UC1, CV_GRAY2BGR> );
+    addFormat<openni::PIXEL_FORMAT_GRAY8, NoScale>( table, 0 );
+    addFormat<openni::PIXEL_FORMAT_GRAY16, LinearScale>( table, 1 );
+    addFormat<openni::PIXEL_FORMAT_DEPTH_1_MM, LinearScale>( table, 1 );
+    addFormat<openni::PIXEL_FORMAT_DEPTH_100_UM, LinearScale>( table, 10 );
+
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC3, false, 0, false, &decodeJpeg<BgrLayout, false> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC3, true, 0, false, &decodeJpeg<BgrLayout, true> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC1, false, 0, false, &decodeJpeg<GrayLayout, false> );
+    addEntry( table, openni::PIXEL_FORMAT_JPEG, CV_8UC1, true, 0, false, &decodeJpeg<GrayLayout, true> );
+    return table;
+  }
+
+  static const std::vector<Entry>& getTable()
+  {
+    static const std::vector<Entry> table = makeTable();
+    return table;
+  }
+
+  // ԈƂ́AԈĕϊł֐D悷(ȂΊԈȂ֐)
+  const Entry* find( openni::PixelFormat pixelFormat ) const
+  {
+    const Entry* found = 0;
+    const std::vector<Entry>& table = getTable();
+    for ( size_t i = 0; i < table.size(); ++i ) {
+      if ( (table[i].pixelFormat == pixelFormat) && (table[i].type == type) &&
+           (table[i].mirror == mirror) ) {
+        if ( (decimation == 1) || table[i].decimate ) {
+          return &table[i];
+        }
+
+        if ( found == 0 ) {
+          found = &table[i];
+        }
+      }
+    }
+
+    return found;
+  }
+
+  void select( openni::PixelFormat pixelFormat )
+  {
+    this->pixelFormat = pixelFormat;
+
+    const Entry* entry = find( pixelFormat );
+    if ( entry == 0 ) {
+      kernel = (type == CV_8UC1) ? &fillBlack<GrayLayout> : &fillBlack<BgrLayout>;
+      factor = 0;
+      return;
+    }
+
+    kernel = entry->kernel;
+    factor = (entry->unit != 0) ? ((255 << 16) / (range * entry->unit)) : 0;
+  }
+
+private:
+
+  int type;                           // ϊ̉摜̌^
+  bool mirror;                        // E𔽓]ĕϊ邩
+  int range;                          // 16bit ̃tH[}bg 255 ɂl
+  int decimation;                     // ԈԊu(1 ȂԈȂ)
+
+  openni::PixelFormat pixelFormat;    // ϊ̊֐I񂾂Ƃ̃sNZtH[}bg
+  Kernel kernel;                      // I񂾕ϊ̊֐(ݒ肪ς 0)
+  int factor;                         // l̏k̔{(16bit ̌Œ菬_)
+  cv::Mat image;                      // ϊ̉摜(t[ԂŎg܂킷)
+};
+
+#endif
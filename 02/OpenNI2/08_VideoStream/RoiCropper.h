@@ -0,0 +1,144 @@
+#ifndef _ROI_CROPPER_H_
+#define _ROI_CROPPER_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2\opencv.hpp>
+
+// 1 ̃t[Ap҂Ƃɕ̋`(ROI)؂o
+//
+// Xg[ Cropping ׂ͂Ă̗p҂ɌA` 1 włȂB
+// ł͋`ƂɁAt[̃f[^w(Rs[Ȃ)cv::Mat B
+// `͂ύXĂ悭Ãt[甽f(Xg[͎~߂Ȃ)B
+// `̓ZT[Ŝ̍WŎw肵AXg[ Cropping LȂƂ͂̕炷B
+// E𔽓]摜؂oƂ́A͈͂ʂ悤ɋ`]
+class RoiCropper
+{
+public:
+
+  RoiCropper()
+    : originX( 0 )
+    , originY( 0 )
+    , mirrored( false )
+  {
+  }
+
+  // p҂ǉ(߂l͗p҂̔ԍ)
+  int addConsumer( const std::string& name )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    consumers.push_back( Consumer() );
+    consumers.back().name = name;
+    return (int)consumers.size() - 1;
+  }
+
+  // O̓Rs[ĕԂ(ق̃Xbh addConsumer() Ŕz񂪈ړ邱Ƃ̂)
+  std::string getName( int consumer ) const
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    return consumers[consumer].name;
+  }
+
+  // p҂̋`ݒ肷(ق̃XbhĂł悢)
+  void setRois( int consumer, const std::vector<cv::Rect>& rois )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    consumers[consumer].rois = rois;
+  }
+
+  // ؂ot[ݒ肷(t[͎̐ݒ܂ŎQƂĂ)
+  void setFrame( const openni::VideoFrameRef& frame )
+  {
+    this->frame = frame;
+
+    // JPEG ͈kĂ̂Ő؂oȂ(ϊ摜ݒ肷邱)
+    if ( frame.getVideoMode().getPixelFormat() == openni::PIXEL_FORMAT_JPEG ) {
+      image = cv::Mat();
+    }
+    else {
+      image = cv::Mat( frame.getHeight(), frame.getWidth(), getType( frame ),
+                       (void*)frame.getData(), frame.getStrideInBytes() );
+    }
+    originX = frame.getCroppingEnabled() ? frame.getCropOriginX() : 0;
+    originY = frame.getCroppingEnabled() ? frame.getCropOriginY() : 0;
+    mirrored = false;
+  }
+
+  // ϊς݂̉摜؂o(摜͎̐ݒ܂ŏȂ)
+  // mirrored : 摜E]Ă邩
+  void setFrame( const cv::Mat& image, int originX = 0, int originY = 0, bool mirrored = false )
+  {
+    frame.release();
+    this->image = image;
+    this->originX = originX;
+    this->originY = originY;
+    this->mirrored = mirrored;
+  }
+
+  // p҂̋`̃r[擾(t[̊Oɂ͂ݏo͐؂l߂)
+  // r[̓t[̃f[^ŵŁA setFrame() ܂ŗL
+  void getViews( int consumer, std::vector<cv::Mat>* views ) const
+  {
+    std::vector<cv::Rect> rois;
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      rois = consumers[consumer].rois;
+    }
+
+    views->clear();
+    cv::Rect bounds( 0, 0, image.cols, image.rows );
+    for ( size_t i = 0; i < rois.size(); ++i ) {
+      int x = rois[i].x - originX;
+      if ( mirrored ) {
+        x = image.cols - x - rois[i].width;
+      }
+
+      cv::Rect roi = cv::Rect( x, rois[i].y - originY, rois[i].width, rois[i].height ) & bounds;
+      views->push_back( (roi.area() > 0) ? image( roi ) : cv::Mat() );
+    }
+  }
+
+private:
+
+  // sNZtH[}bgɉ^
+  // (YUV422  YUYV  2 sNZŐFL̂ŁA` x ƕ͋ɂ邱)
+  static int getType( const openni::VideoFrameRef& frame )
+  {
+    switch ( frame.getVideoMode().getPixelFormat() ) {
+    case openni::PIXEL_FORMAT_RGB888:
+      return CV_8UC3;
+
+    case openni::PIXEL_FORMAT_YUV422:
+    case openni::PIXEL_FORMAT_YUYV:
+      return CV_8UC2;
+
+    case openni::PIXEL_FORMAT_GRAY8:
+      return CV_8UC1;
+
+    default:
+      return CV_16UC1;
+    }
+  }
+
+  struct Consumer
+  {
+    std::string name;                   // p҂̖O
+    std::vector<cv::Rect> rois;         // ؂o`(ZT[Ŝ̍W)
+  };
+
+private:
+
+  std::vector<Consumer> consumers;      // p҂Ƃ̋`
+  mutable std::mutex mutex;
+
+  openni::VideoFrameRef frame;          // ؂ot[(f[^Ȃ)
+  cv::Mat image;                        // t[̃f[^w摜
+  int originX;                          // t[̍̃ZT[̈ʒu
+  int originY;
+  bool mirrored;                        // 摜E]Ă邩
+};
+
+#endif
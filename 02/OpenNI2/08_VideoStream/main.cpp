@@ -1,12 +1,26 @@
 #include <OpenNI.h>
 #include <opencv2\opencv.hpp>
+#include <sstream>
 #include <vector>
 
+#include "ColorDecoder.h"
+#include "ModeProber.h"
+#include "PixelConverter.h"
+#include "RoiCropper.h"
+
 
 class DepthSensor
 {
 public:
 
+  DepthSensor()
+    : mirror( false )
+    , depthConverter( CV_8UC1 )
+  {
+    // 0-10000mm܂ł̃f[^0-255(8bit)ɂ
+    depthConverter.setRange( 10000 );
+  }
+
   void initialize()
   {
     // OpenNI 
@@ -18,12 +32,14 @@ public:
       throw std::runtime_error( "openni::Device::open() failed." );
     }
 
-    // J[Xg[Lɂ
+    // J[Xg[Lɂ(vđI񂾃[h΁Ag)
     colorStream.create( device, openni::SensorType::SENSOR_COLOR );
+    loadVideoMode( colorStream );
     colorStream.start();
 
     // Depth Xg[Lɂ
     depthStream.create( device, openni::SensorType::SENSOR_DEPTH );
+    loadVideoMode( depthStream );
     depthStream.start();
 
     // Xg[̏\
@@ -32,6 +48,17 @@ public:
 
     std::cout << "Depth Stream" << std::endl;
     showStreamParameter( depthStream );
+
+    // ؂o̗p҂ǉ(͗p͍E 2 A\p͒S)
+    analyticsConsumer = roiCropper.addConsumer( "Analytics" );
+    std::vector<cv::Rect> rois;
+    rois.push_back( cv::Rect( 0, 120, 200, 240 ) );
+    rois.push_back( cv::Rect( 440, 120, 200, 240 ) );
+    roiCropper.setRois( analyticsConsumer, rois );
+
+    uiConsumer = roiCropper.addConsumer( "UI" );
+    uiRoiIndex = -1;
+    changeUiRoi();
   }
 
   void update()
@@ -50,13 +77,39 @@ public:
     // t[̃f[^\
     cv::imshow( "Color Stream", colorImage );
     cv::imshow( "Depth Stream", depthImage );
+
+    // p҂Ƃ̋`؂oĕ\(Cropping LȂÄʒủ摜ɂȂ)
+    if ( colorFrame.getCroppingEnabled() ) {
+      roiCropper.setFrame( colorImage, colorFrame.getCropOriginX(), colorFrame.getCropOriginY(),
+                           colorDecoder.isMirror() );
+    }
+    else {
+      roiCropper.setFrame( colorImage, 0, 0, colorDecoder.isMirror() );
+    }
+    showRois( analyticsConsumer );
+    showRois( uiConsumer );
+  }
+
+  // \p̐؂o`ɐ؂ւ(Xg[̐ݒ͕ςȂ)
+  void changeUiRoi()
+  {
+    static const cv::Rect rois[] = {
+      cv::Rect( 160, 120, 320, 240 ),
+      cv::Rect( 0, 0, 320, 240 ),
+      cv::Rect( 320, 240, 320, 240 ),
+    };
+
+    uiRoiIndex = (uiRoiIndex + 1) % (sizeof(rois) / sizeof(rois[0]));
+    roiCropper.setRois( uiConsumer, std::vector<cv::Rect>( 1, rois[uiRoiIndex] ) );
   }
 
   // ~[[hύX
+  // (Xg[̐ݒׂ͂Ă̗p҂ɌAL^t@Cł͎gȂ̂ŁA\̕ϊŔ])
   void changeMirrorMode()
   {
-    colorStream.setMirroringEnabled( !colorStream.getMirroringEnabled() );
-    depthStream.setMirroringEnabled( !depthStream.getMirroringEnabled() );
+    mirror = !mirror;
+    colorDecoder.setMirror( mirror );
+    depthConverter.setMirror( mirror );
   }
 
   // Cropping̐ݒύX
@@ -78,34 +131,186 @@ public:
     }
   }
 
+  // J[Xg[̃sNZtH[}bgA𑜓xŎĝɏɐ؂ւ
+  void changePixelFormat()
+  {
+    openni::VideoMode current = colorStream.getVideoMode();
+    std::vector<openni::VideoMode> modes = getColorModes( current );
+    for ( size_t i = 0; i < modes.size(); ++i ) {
+      if ( modes[i].getPixelFormat() == current.getPixelFormat() ) {
+        changeVideoMode( colorStream, modes[(i + 1) % modes.size()] );
+        break;
+      }
+    }
+
+    std::cout << "PixelFormat : "
+              << getPixelFormatToString( colorStream.getVideoMode().getPixelFormat() ) << std::endl;
+  }
+
+  // 𑜓xŎgsNZtH[}bgƂɁAϊ̑xv
+  void benchmarkPixelFormat()
+  {
+    openni::VideoMode current = colorStream.getVideoMode();
+    std::vector<openni::VideoMode> modes = getColorModes( current );
+
+    std::cout << "Benchmark " << current.getResolutionX() << "x" << current.getResolutionY() << std::endl;
+    for ( size_t i = 0; i < modes.size(); ++i ) {
+      if ( !changeVideoMode( colorStream, modes[i] ) ) {
+        continue;
+      }
+
+      // vp̃t[擾
+      openni::VideoFrameRef colorFrame;
+      colorStream.readFrame( &colorFrame );
+
+      double time = colorDecoder.benchmark( colorFrame );
+      double pixels = (double)colorFrame.getWidth() * colorFrame.getHeight();
+      std::cout << " " << getPixelFormatToString( modes[i].getPixelFormat() )
+                << "  size : " << colorFrame.getDataSize() << " bytes"
+                << "  decode : " << time << " ms"
+                << " (" << (pixels / time / 1000) << " Mpixel/s)" << std::endl;
+    }
+
+    // ̃sNZtH[}bgɖ߂
+    changeVideoMode( colorStream, current );
+  }
+
+  // ΉĂrfI[hvAԂ悢̂ɐ؂ւĕۑ
+  void probeVideoModes()
+  {
+    ModeProber prober;
+
+    ColorPipeline colorPipeline( colorDecoder );
+    probeVideoMode( prober, colorStream, colorPipeline );
+
+    DepthPipeline depthPipeline( depthConverter );
+    probeVideoMode( prober, depthStream, depthPipeline );
+  }
+
 private:
 
-  // J[Xg[\ł`ɕϊ
-  cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
+  // [ȟvŒʂJ[̏(\Ɠϊ)
+  struct ColorPipeline
   {
-    // OpenCV ̌`ɕϊ
-    cv::Mat colorImage = cv::Mat( colorFrame.getHeight(),
-                                  colorFrame.getWidth(),
-                                  CV_8UC3, (char*)colorFrame.getData() );
+    ColorPipeline( ColorDecoder& colorDecoder )
+      : colorDecoder( colorDecoder )
+    {
+    }
+
+    void operator()( const openni::VideoFrameRef& frame )
+    {
+      colorDecoder.decode( frame );
+    }
+
+    ColorDecoder& colorDecoder;
+  };
+
+  // [ȟvŒʂ Depth ̏(\Ɠϊ)
+  struct DepthPipeline
+  {
+    DepthPipeline( PixelConverter& depthConverter )
+      : depthConverter( depthConverter )
+    {
+    }
+
+    void operator()( const openni::VideoFrameRef& frame )
+    {
+      depthConverter.convert( frame );
+    }
 
-    // BGR ̕т RGB ɕϊ
-    cv::cvtColor( colorImage, colorImage, CV_BGR2RGB );
+    PixelConverter& depthConverter;
+  };
 
-    return colorImage;
+  template<typename Pipeline>
+  void probeVideoMode( ModeProber& prober, openni::VideoStream& stream, Pipeline& pipeline )
+  {
+    std::cout << getVideoModeKey( stream ) << std::endl;
+
+    std::vector<ModeProber::Result> results = prober.probe( stream, pipeline );
+    int selected = prober.select( results );
+    ModeProber::print( std::cout, results, selected );
+
+    if ( (selected >= 0) && ModeProber::setVideoMode( stream, results[selected].mode ) ) {
+      ModeProber::save( videoModeFileName, getVideoModeKey( stream ), results[selected].mode );
+    }
   }
 
-  // Depth Xg[\ł`ɕϊ
-  cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
+  // ۑrfI[hݒ肷(JnOɌĂ)
+  void loadVideoMode( openni::VideoStream& stream )
   {
-    // f[^摜(16bit)
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                  depthFrame.getWidth(),
-                                  CV_16U, (char*)depthFrame.getData() );
+    openni::VideoMode mode;
+    if ( ModeProber::load( videoModeFileName, getVideoModeKey( stream ), &mode ) &&
+         (stream.setVideoMode( mode ) != openni::STATUS_OK) ) {
+      std::cout << "openni::VideoStream::setVideoMode() failed : "
+                << openni::OpenNI::getExtendedError() << std::endl;
+    }
+  }
 
-    // 0-10000mm܂ł̃f[^0-255(8bit)ɂ
-    depthImage.convertTo( depthImage, CV_8U, 255.0 / 10000 );
+  // rfI[hۑL[(@ƃZT[̎)
+  std::string getVideoModeKey( openni::VideoStream& stream )
+  {
+    return std::string( device.getDeviceInfo().getName() ) + " " +
+           getSensorTypeToString( stream.getSensorInfo().getSensorType() );
+  }
 
-    return depthImage;
+  // p҂̋`\(摜̓Rs[At[̈ꕔwĂ)
+  void showRois( int consumer )
+  {
+    roiCropper.getViews( consumer, &views );
+    for ( size_t i = 0; i < views.size(); ++i ) {
+      if ( !views[i].empty() ) {
+        std::stringstream name;
+        name << roiCropper.getName( consumer ) << " " << i;
+        cv::imshow( name.str(), views[i] );
+      }
+    }
+  }
+
+  // w肵rfI[hƓ𑜓xƃt[[ǵAJ[̃rfI[h
+  std::vector<openni::VideoMode> getColorModes( const openni::VideoMode& current )
+  {
+    std::vector<openni::VideoMode> result;
+    const openni::Array<openni::VideoMode>& modes =
+      colorStream.getSensorInfo().getSupportedVideoModes();
+    for ( int i = 0; i < modes.getSize(); ++i ) {
+      if ( (modes[i].getResolutionX() == current.getResolutionX()) &&
+           (modes[i].getResolutionY() == current.getResolutionY()) &&
+           (modes[i].getFps() == current.getFps()) ) {
+        result.push_back( modes[i] );
+      }
+    }
+
+    return result;
+  }
+
+  // rfI[hύX(쒆ɕύXłȂfoCX̂ŁAx~߂)
+  bool changeVideoMode( openni::VideoStream& stream, const openni::VideoMode& videoMode )
+  {
+    stream.stop();
+    openni::Status ret = stream.setVideoMode( videoMode );
+    stream.start();
+
+    if ( ret != openni::STATUS_OK ) {
+      std::cout << "openni::VideoStream::setVideoMode() failed : "
+                << openni::OpenNI::getExtendedError() << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  // J[Xg[\ł`ɕϊ
+  cv::Mat showColorStream( const openni::VideoFrameRef& colorFrame )
+  {
+    // sNZtH[}bgɉ BGR ɕϊ(ϊ͎g܂킷)
+    return colorDecoder.decode( colorFrame );
+  }
+
+  // Depth Xg[\ł`ɕϊ
+  cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
+  {
+    // f[^ 8bit ɉ摜(DEPTH_100_UM ͈̔͂ɂȂ)
+    return depthConverter.convert( depthFrame );
   }
 
   void showStreamParameter( openni::VideoStream& stream )
@@ -204,8 +409,22 @@ private:
 
   cv::Mat colorImage;               // \pf[^
   cv::Mat depthImage;               // Depth \pf[^
+
+  ColorDecoder colorDecoder;        // J[t[̕ϊ
+  bool mirror;                      // \E]邩
+  PixelConverter depthConverter;    // Depth t[̕ϊ
+
+  static const char* videoModeFileName; // vđI񂾃rfI[h̃t@C
+
+  RoiCropper roiCropper;            // p҂Ƃ̋`̐؂o
+  int analyticsConsumer;            // ͗p̗p
+  int uiConsumer;                   // \p̗p
+  int uiRoiIndex;                   // \p̋`̔ԍ
+  std::vector<cv::Mat> views;       // ؂o摜
 };
 
+const char* DepthSensor::videoModeFileName = "BestVideoMode.txt";
+
 int main(int argc, const char * argv[])
 {
   try {
@@ -232,6 +451,22 @@ int main(int argc, const char * argv[])
       else if ( key == 'c' ) {
         sensor.changeCropping();
       }
+      // \p̐؂o`ύX
+      else if ( key == 'r' ) {
+        sensor.changeUiRoi();
+      }
+      // J[̃sNZtH[}bgύX
+      else if ( key == 'f' ) {
+        sensor.changePixelFormat();
+      }
+      // sNZtH[}bgƂ̕ϊ̑xv
+      else if ( key == 'b' ) {
+        sensor.benchmarkPixelFormat();
+      }
+      // rfI[hvāAԂ悢̂I
+      else if ( key == 'p' ) {
+        sensor.probeVideoModes();
+      }
     }
   }
   catch ( std::exception& ex ) {
@@ -0,0 +1,661 @@
+// センサーがなくても OpenNI のアプリケーションを動かすための、模擬デバイスのドライバ
+//
+// ビルドしてできた DLL を OpenNI2 の Drivers フォルダ(OpenNI2.dll のある場所の
+// OpenNI2\Drivers)にコピーすると、"mock://" で始まる URI のデバイスを開けるようになる。
+//
+// 設定は "key=value&key=value" の形で、環境変数 OPENNI2_MOCK と URI のクエリに書ける
+// (URI の設定が優先される)。
+//   devices   : 起動時に接続されているデバイスの数(mock://0 から順に。既定は 0)
+//   width     : 解像度の幅(既定は 640)
+//   height    : 解像度の高さ(既定は 480)
+//   fps       : フレームレート(既定は 30)
+//   jitter    : フレームの間隔のゆらぎ(ミリ秒、既定は 0)
+//   hotplug   : 最後のデバイスの切断と接続を繰り返す間隔(秒、既定は 0 で行わない)
+//   depthFile : Depth のデータを読むファイル(1 フレームずつ詰めた生データ、繰り返し読む)
+//   colorFile : カラーのデータを読むファイル(同上)
+//   irFile    : IR のデータを読むファイル(同上)
+//
+// 例) OPENNI2_MOCK=devices=16&fps=30&jitter=2 で 16 台のデバイスが接続された状態になる
+//     device.open( "mock://0?width=320&height=240" ) で QVGA のデバイスを開く
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Driver/OniDriverAPI.h>
+
+// 模擬デバイスの設定
+struct MockConfig
+{
+  MockConfig()
+    : devices( 0 )
+    , width( 640 )
+    , height( 480 )
+    , fps( 30 )
+    , jitter( 0 )
+    , hotplug( 0 )
+  {
+  }
+
+  // "key=value&key=value" の形の設定を読む
+  void parse( const std::string& query )
+  {
+    size_t pos = 0;
+    while ( pos < query.size() ) {
+      size_t end = query.find( '&', pos );
+      if ( end == std::string::npos ) {
+        end = query.size();
+      }
+
+      std::string item = query.substr( pos, end - pos );
+      size_t equal = item.find( '=' );
+      if ( equal != std::string::npos ) {
+        set( item.substr( 0, equal ), item.substr( equal + 1 ) );
+      }
+
+      pos = end + 1;
+    }
+  }
+
+  void set( const std::string& key, const std::string& value )
+  {
+    if ( key == "devices" ) {
+      devices = std::atoi( value.c_str() );
+    }
+    else if ( key == "width" ) {
+      width = std::atoi( value.c_str() );
+    }
+    else if ( key == "height" ) {
+      height = std::atoi( value.c_str() );
+    }
+    else if ( key == "fps" ) {
+      fps = std::atoi( value.c_str() );
+    }
+    else if ( key == "jitter" ) {
+      jitter = std::atof( value.c_str() );
+    }
+    else if ( key == "hotplug" ) {
+      hotplug = std::atof( value.c_str() );
+    }
+    else if ( key == "depthFile" ) {
+      depthFile = value;
+    }
+    else if ( key == "colorFile" ) {
+      colorFile = value;
+    }
+    else if ( key == "irFile" ) {
+      irFile = value;
+    }
+  }
+
+  int devices;              // 起動時に接続されているデバイスの数
+  int width;                // 解像度の幅
+  int height;               // 解像度の高さ
+  int fps;                  // フレームレート
+  double jitter;            // フレームの間隔のゆらぎ(ミリ秒)
+  double hotplug;           // 切断と接続を繰り返す間隔(秒)
+  std::string depthFile;    // Depth のデータを読むファイル
+  std::string colorFile;    // カラーのデータを読むファイル
+  std::string irFile;       // IR のデータを読むファイル
+};
+
+// 模擬ストリーム(スレッドで一定間隔にフレームを作る)
+class MockStream : public oni::driver::StreamBase
+{
+public:
+
+  MockStream( OniSensorType sensorType, const OniVideoMode& videoMode, const MockConfig& config,
+              int deviceIndex, std::chrono::steady_clock::time_point epoch )
+    : sensorType( sensorType )
+    , videoMode( videoMode )
+    , deviceIndex( deviceIndex )
+    , epoch( epoch )
+    , jitter( config.jitter )
+    , mirroring( false )
+    , running( false )
+  {
+    // ファイルが指定されていれば、そこからフレームを読む
+    const std::string& fileName = (sensorType == ONI_SENSOR_DEPTH) ? config.depthFile :
+                                  (sensorType == ONI_SENSOR_COLOR) ? config.colorFile : config.irFile;
+    if ( !fileName.empty() ) {
+      file.open( fileName.c_str(), std::ios::binary );
+    }
+  }
+
+  ~MockStream()
+  {
+    stop();
+  }
+
+  OniStatus start()
+  {
+    if ( !running ) {
+      running = true;
+      thread = std::thread( &MockStream::run, this );
+    }
+
+    return ONI_STATUS_OK;
+  }
+
+  void stop()
+  {
+    if ( running ) {
+      running = false;
+      thread.join();
+    }
+  }
+
+  OniBool isPropertySupported( int propertyId )
+  {
+    return (propertyId == ONI_STREAM_PROPERTY_VIDEO_MODE) ||
+           (propertyId == ONI_STREAM_PROPERTY_HORIZONTAL_FOV) ||
+           (propertyId == ONI_STREAM_PROPERTY_VERTICAL_FOV) ||
+           (propertyId == ONI_STREAM_PROPERTY_MAX_VALUE) ||
+           (propertyId == ONI_STREAM_PROPERTY_MIN_VALUE) ||
+           (propertyId == ONI_STREAM_PROPERTY_MIRRORING);
+  }
+
+  OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    switch ( propertyId ) {
+    case ONI_STREAM_PROPERTY_VIDEO_MODE:
+      return copyProperty( videoMode, data, pDataSize );
+
+    // 画角は Xtion と同じにする
+    case ONI_STREAM_PROPERTY_HORIZONTAL_FOV:
+      return copyProperty( (sensorType == ONI_SENSOR_COLOR) ? 1.0225f : 1.0123f, data, pDataSize );
+
+    case ONI_STREAM_PROPERTY_VERTICAL_FOV:
+      return copyProperty( (sensorType == ONI_SENSOR_COLOR) ? 0.7959f : 0.7897f, data, pDataSize );
+
+    case ONI_STREAM_PROPERTY_MAX_VALUE:
+      return copyProperty( (sensorType == ONI_SENSOR_DEPTH) ? 10000 :
+                           (sensorType == ONI_SENSOR_IR) ? 1023 : 255, data, pDataSize );
+
+    case ONI_STREAM_PROPERTY_MIN_VALUE:
+      return copyProperty( 0, data, pDataSize );
+
+    case ONI_STREAM_PROPERTY_MIRRORING:
+      return copyProperty( (OniBool)(mirroring ? TRUE : FALSE), data, pDataSize );
+    }
+
+    return ONI_STATUS_NOT_SUPPORTED;
+  }
+
+  OniStatus setProperty( int propertyId, const void* data, int dataSize )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( propertyId == ONI_STREAM_PROPERTY_VIDEO_MODE ) {
+      if ( dataSize != sizeof(OniVideoMode) ) {
+        return ONI_STATUS_BAD_PARAMETER;
+      }
+
+      // フレームのバッファの大きさは開始時に決まるので、動作中は変更できない
+      if ( running ) {
+        return ONI_STATUS_OUT_OF_FLOW;
+      }
+
+      const OniVideoMode& mode = *(const OniVideoMode*)data;
+      if ( (mode.pixelFormat != videoMode.pixelFormat) || (mode.resolutionX <= 0) ||
+           (mode.resolutionY <= 0) || (mode.fps <= 0) ) {
+        return ONI_STATUS_NOT_SUPPORTED;
+      }
+
+      videoMode = mode;
+      return ONI_STATUS_OK;
+    }
+    else if ( propertyId == ONI_STREAM_PROPERTY_MIRRORING ) {
+      if ( dataSize != sizeof(OniBool) ) {
+        return ONI_STATUS_BAD_PARAMETER;
+      }
+
+      mirroring = (*(const OniBool*)data) != FALSE;
+      return ONI_STATUS_OK;
+    }
+
+    return ONI_STATUS_NOT_SUPPORTED;
+  }
+
+private:
+
+  template<typename T>
+  static OniStatus copyProperty( const T& value, void* data, int* pDataSize )
+  {
+    if ( *pDataSize != sizeof(T) ) {
+      return ONI_STATUS_BAD_PARAMETER;
+    }
+
+    *(T*)data = value;
+    return ONI_STATUS_OK;
+  }
+
+  static int getBytesPerPixel( OniPixelFormat pixelFormat )
+  {
+    return (pixelFormat == ONI_PIXEL_FORMAT_RGB888) ? 3 :
+           (pixelFormat == ONI_PIXEL_FORMAT_GRAY8) ? 1 : 2;
+  }
+
+  // フレームを作るスレッド
+  void run()
+  {
+    std::mt19937 random( (deviceIndex * 16) + sensorType );
+    std::uniform_real_distribution<double> noise( -jitter, jitter );
+
+    // フレームの時刻はデバイスごとに共通の基準から数えるので、
+    // 同じデバイスのストリームどうしはゆらぎの分だけずれる
+    double interval = 1000.0 / videoMode.fps;
+    long long frameIndex = (long long)(std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - epoch ).count() / interval) + 1;
+
+    while ( running ) {
+      std::chrono::duration<double, std::milli> due( (frameIndex * interval) + noise( random ) );
+      std::this_thread::sleep_until( epoch + std::chrono::duration_cast<std::chrono::steady_clock::duration>( due ) );
+
+      OniFrame* frame = getServices().acquireFrame();
+      if ( frame != 0 ) {
+        if ( fill( frame, (int)frameIndex ) ) {
+          raiseNewFrame( frame );
+        }
+        getServices().releaseFrame( frame );
+      }
+
+      ++frameIndex;
+    }
+  }
+
+  // フレームの情報とデータを書き込む
+  bool fill( OniFrame* frame, int frameIndex )
+  {
+    OniVideoMode mode;
+    bool mirror;
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      mode = videoMode;
+      mirror = mirroring;
+    }
+
+    int stride = mode.resolutionX * getBytesPerPixel( mode.pixelFormat );
+    int dataSize = stride * mode.resolutionY;
+    if ( frame->dataSize < dataSize ) {
+      return false;
+    }
+
+    frame->dataSize = dataSize;
+    frame->sensorType = sensorType;
+    frame->timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - epoch ).count();
+    frame->frameIndex = frameIndex;
+    frame->videoMode = mode;
+    frame->width = mode.resolutionX;
+    frame->height = mode.resolutionY;
+    frame->croppingEnabled = FALSE;
+    frame->cropOriginX = 0;
+    frame->cropOriginY = 0;
+    frame->stride = stride;
+
+    // ファイルから読めなければ、模様を作る
+    if ( !readFile( frame->data, dataSize ) ) {
+      generate( frame, mode, frameIndex, mirror );
+    }
+
+    return true;
+  }
+
+  // ファイルから 1 フレーム分を読む(最後まで読んだら先頭に戻る)
+  bool readFile( void* data, int dataSize )
+  {
+    if ( !file.is_open() ) {
+      return false;
+    }
+
+    if ( !file.read( (char*)data, dataSize ) ) {
+      file.clear();
+      file.seekg( 0 );
+      if ( !file.read( (char*)data, dataSize ) ) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // 奥の壁の前を、人に見立てた箱が左右に動く模様を作る
+  void generate( OniFrame* frame, const OniVideoMode& mode, int frameIndex, bool mirror )
+  {
+    int width = mode.resolutionX;
+    int height = mode.resolutionY;
+
+    // 箱の位置(デバイスごとに動きをずらす)
+    double phase = (frameIndex / (double)mode.fps) + deviceIndex;
+    int boxWidth = width / 6;
+    int boxLeft = (int)((width / 2) + ((width / 3) * std::sin( phase )) - (boxWidth / 2));
+    if ( mirror ) {
+      boxLeft = width - boxLeft - boxWidth;
+    }
+    int boxTop = height / 4;
+    int boxBottom = height - (height / 8);
+
+    for ( int y = 0; y < height; ++y ) {
+      bool inRows = (y >= boxTop) && (y < boxBottom);
+      for ( int x = 0; x < width; ++x ) {
+        bool inBox = inRows && (x >= boxLeft) && (x < (boxLeft + boxWidth));
+
+        // 箱の左側には、実際のセンサーと同じように影(距離のないところ)を作る
+        bool shadow = inRows && (x >= (boxLeft - 6)) && (x < boxLeft);
+
+        int index = (y * width) + x;
+        if ( sensorType == ONI_SENSOR_DEPTH ) {
+          OniDepthPixel* depth = (OniDepthPixel*)frame->data;
+          depth[index] = shadow ? 0 : inBox ? 1500 : (OniDepthPixel)(3000 - ((y * 1000) / height));
+        }
+        else if ( sensorType == ONI_SENSOR_COLOR ) {
+          unsigned char* rgb = (unsigned char*)frame->data + (index * 3);
+          rgb[0] = inBox ? 220 : (unsigned char)((x * 255) / width);
+          rgb[1] = inBox ? 80 : (unsigned char)((y * 255) / height);
+          rgb[2] = inBox ? 60 : 128;
+        }
+        else {
+          unsigned short* ir = (unsigned short*)frame->data;
+          ir[index] = inBox ? 800 : (unsigned short)(300 + ((y * 200) / height));
+        }
+      }
+    }
+  }
+
+private:
+
+  OniSensorType sensorType;                     // センサーの種類
+  OniVideoMode videoMode;                       // ビデオモード
+  int deviceIndex;                              // デバイスの番号
+  std::chrono::steady_clock::time_point epoch;  // タイムスタンプの基準
+  double jitter;                                // フレームの間隔のゆらぎ(ミリ秒)
+  bool mirroring;                               // 左右を反転するか
+
+  std::ifstream file;                           // フレームを読むファイル
+  std::thread thread;                           // フレームを作るスレッド
+  std::mutex mutex;
+  std::atomic<bool> running;                    // 動作中かどうか
+};
+
+// 模擬デバイス(Depth、カラー、IR のセンサーを持つ)
+class MockDevice : public oni::driver::DeviceBase
+{
+public:
+
+  MockDevice( const MockConfig& config, int index )
+    : config( config )
+    , index( index )
+    , epoch( std::chrono::steady_clock::now() )
+  {
+    // 設定の解像度と、QVGA、VGA に対応する
+    addSensor( ONI_SENSOR_DEPTH, ONI_PIXEL_FORMAT_DEPTH_1_MM );
+    addSensor( ONI_SENSOR_COLOR, ONI_PIXEL_FORMAT_RGB888 );
+    addSensor( ONI_SENSOR_IR, ONI_PIXEL_FORMAT_GRAY16 );
+
+    for ( int i = 0; i < SENSOR_COUNT; ++i ) {
+      sensors[i].pSupportedVideoModes = &modes[i][0];
+    }
+  }
+
+  OniStatus getSensorInfoList( OniSensorInfo** pSensorInfos, int* numSensors )
+  {
+    *pSensorInfos = sensors;
+    *numSensors = SENSOR_COUNT;
+    return ONI_STATUS_OK;
+  }
+
+  oni::driver::StreamBase* createStream( OniSensorType sensorType )
+  {
+    for ( int i = 0; i < SENSOR_COUNT; ++i ) {
+      if ( sensors[i].sensorType == sensorType ) {
+        return new MockStream( sensorType, modes[i][0], config, index, epoch );
+      }
+    }
+
+    return 0;
+  }
+
+  void destroyStream( oni::driver::StreamBase* pStream )
+  {
+    delete pStream;
+  }
+
+  OniBool isPropertySupported( int propertyId )
+  {
+    return (propertyId == ONI_DEVICE_PROPERTY_SERIAL_NUMBER) ||
+           (propertyId == ONI_DEVICE_PROPERTY_FIRMWARE_VERSION) ||
+           (propertyId == ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION);
+  }
+
+  OniStatus getProperty( int propertyId, void* data, int* pDataSize )
+  {
+    if ( (propertyId == ONI_DEVICE_PROPERTY_SERIAL_NUMBER) ||
+         (propertyId == ONI_DEVICE_PROPERTY_FIRMWARE_VERSION) ) {
+      // シリアル番号はデバイスの番号から作る
+      char text[32];
+      if ( propertyId == ONI_DEVICE_PROPERTY_SERIAL_NUMBER ) {
+        sprintf( text, "MOCK%04d", index );
+      }
+      else {
+        strcpy( text, "mock-1.0" );
+      }
+
+      int length = (int)strlen( text ) + 1;
+      if ( *pDataSize < length ) {
+        return ONI_STATUS_BAD_PARAMETER;
+      }
+
+      memcpy( data, text, length );
+      *pDataSize = length;
+      return ONI_STATUS_OK;
+    }
+    else if ( propertyId == ONI_DEVICE_PROPERTY_IMAGE_REGISTRATION ) {
+      if ( *pDataSize != sizeof(OniImageRegistrationMode) ) {
+        return ONI_STATUS_BAD_PARAMETER;
+      }
+
+      *(OniImageRegistrationMode*)data = ONI_IMAGE_REGISTRATION_OFF;
+      return ONI_STATUS_OK;
+    }
+
+    return ONI_STATUS_NOT_SUPPORTED;
+  }
+
+  // Depth とカラーの位置合わせはしない(ソフトウェアで行うこと)
+  OniBool isImageRegistrationModeSupported( OniImageRegistrationMode mode )
+  {
+    return mode == ONI_IMAGE_REGISTRATION_OFF;
+  }
+
+private:
+
+  enum { SENSOR_COUNT = 3, MODE_COUNT = 3 };
+
+  void addSensor( OniSensorType sensorType, OniPixelFormat pixelFormat )
+  {
+    int i = (sensorType == ONI_SENSOR_DEPTH) ? 0 : (sensorType == ONI_SENSOR_COLOR) ? 1 : 2;
+
+    const int resolutions[MODE_COUNT][3] = {
+      { config.width, config.height, config.fps },
+      { 320, 240, 30 },
+      { 640, 480, 30 },
+    };
+    for ( int m = 0; m < MODE_COUNT; ++m ) {
+      modes[i][m].pixelFormat = pixelFormat;
+      modes[i][m].resolutionX = resolutions[m][0];
+      modes[i][m].resolutionY = resolutions[m][1];
+      modes[i][m].fps = resolutions[m][2];
+    }
+
+    sensors[i].sensorType = sensorType;
+    sensors[i].numSupportedVideoModes = MODE_COUNT;
+  }
+
+private:
+
+  MockConfig config;                            // 設定
+  int index;                                    // デバイスの番号
+  std::chrono::steady_clock::time_point epoch;  // タイムスタンプの基準
+
+  OniSensorInfo sensors[SENSOR_COUNT];          // センサーの情報
+  OniVideoMode modes[SENSOR_COUNT][MODE_COUNT]; // センサーごとのビデオモード
+};
+
+// 模擬デバイスのドライバ
+class MockDriver : public oni::driver::DriverBase
+{
+public:
+
+  MockDriver( OniDriverServices* pDriverServices )
+    : DriverBase( pDriverServices )
+    , exiting( false )
+  {
+  }
+
+  OniStatus initialize( oni::driver::DeviceConnectedCallback connectedCallback,
+                        oni::driver::DeviceDisconnectedCallback disconnectedCallback,
+                        oni::driver::DeviceStateChangedCallback deviceStateChangedCallback,
+                        void* pCookie )
+  {
+    OniStatus ret = DriverBase::initialize( connectedCallback, disconnectedCallback,
+                                            deviceStateChangedCallback, pCookie );
+    if ( ret != ONI_STATUS_OK ) {
+      return ret;
+    }
+
+    // 環境変数の設定を読む
+    const char* env = std::getenv( "OPENNI2_MOCK" );
+    if ( env != 0 ) {
+      config.parse( env );
+    }
+
+    // 起動時に接続されているデバイスを通知する
+    for ( int i = 0; i < config.devices; ++i ) {
+      connect( "mock://" + std::to_string( (long long)i ) );
+    }
+
+    // 切断と接続を繰り返す
+    if ( (config.hotplug > 0) && (config.devices > 0) ) {
+      hotplugThread = std::thread( &MockDriver::hotplug, this );
+    }
+
+    return ONI_STATUS_OK;
+  }
+
+  // 一覧にない URI を開こうとしたときに呼ばれる
+  OniStatus tryDevice( const char* uri )
+  {
+    if ( strncmp( uri, "mock://", 7 ) != 0 ) {
+      return ONI_STATUS_ERROR;
+    }
+
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( devices.find( uri ) == devices.end() ) {
+      connectLocked( uri );
+    }
+
+    return ONI_STATUS_OK;
+  }
+
+  oni::driver::DeviceBase* deviceOpen( const char* uri, const char* )
+  {
+    if ( strncmp( uri, "mock://", 7 ) != 0 ) {
+      return 0;
+    }
+
+    // デバイスの番号とクエリの設定を読む("mock://番号?設定")
+    std::string text = uri + 7;
+    size_t question = text.find( '?' );
+
+    MockConfig deviceConfig = config;
+    if ( question != std::string::npos ) {
+      deviceConfig.parse( text.substr( question + 1 ) );
+    }
+
+    return new MockDevice( deviceConfig, std::atoi( text.substr( 0, question ).c_str() ) );
+  }
+
+  void deviceClose( oni::driver::DeviceBase* pDevice )
+  {
+    delete pDevice;
+  }
+
+  void shutdown()
+  {
+    if ( hotplugThread.joinable() ) {
+      exiting = true;
+      hotplugThread.join();
+    }
+  }
+
+private:
+
+  void connect( const std::string& uri )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    connectLocked( uri );
+  }
+
+  void connectLocked( const std::string& uri )
+  {
+    OniDeviceInfo info;
+    memset( &info, 0, sizeof(info) );
+    strncpy( info.uri, uri.c_str(), ONI_MAX_STR - 1 );
+    strncpy( info.vendor, "OpenNI2 Book", ONI_MAX_STR - 1 );
+    strncpy( info.name, "Mock Device", ONI_MAX_STR - 1 );
+
+    devices[uri] = info;
+    deviceConnected( &devices[uri] );
+  }
+
+  // 最後のデバイスの切断と接続を繰り返す
+  void hotplug()
+  {
+    std::string uri = "mock://" + std::to_string( (long long)(config.devices - 1) );
+    bool connected = true;
+
+    while ( !exiting ) {
+      // 終了を待たせないよう、短い間隔で確認しながら待つ
+      std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds( (long long)(config.hotplug * 1000) );
+      while ( !exiting && (std::chrono::steady_clock::now() < due) ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+      }
+
+      if ( exiting ) {
+        break;
+      }
+
+      std::lock_guard<std::mutex> lock( mutex );
+      if ( connected ) {
+        deviceDisconnected( &devices[uri] );
+      }
+      else {
+        deviceConnected( &devices[uri] );
+      }
+      connected = !connected;
+    }
+  }
+
+private:
+
+  MockConfig config;                              // 環境変数の設定
+  std::map<std::string, OniDeviceInfo> devices;   // 通知したデバイス
+  std::mutex mutex;
+
+  std::thread hotplugThread;                      // 切断と接続を繰り返すスレッド
+  std::atomic<bool> exiting;                      // 終了するかどうか
+};
+
+ONI_EXPORT_DRIVER( MockDriver );
@@ -0,0 +1,268 @@
+#ifndef _BACKGROUND_MODEL_H_
+#define _BACKGROUND_MODEL_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <OpenNI.h>
+#include <opencv2/opencv.hpp>
+
+// Depth データから背景を学習し、前景(背景より手前にあるもの)を取り出す
+//
+// ピクセルごとに、背景の距離と、その距離がどれだけ続いて観測されたか(確からしさ)を
+// 16bit の 2 枚の画像で持つ。背景と同じ距離が観測されれば確からしさを上げ、
+// 手前のものが観測されれば下げる。確からしさが 0 になったら、そのものを背景として取り込む
+// (置かれたままの物は、いずれ背景になる)。背景より奥が観測されたときは、
+// 隠れていた背景が見えたとして、すぐに置き換える
+//
+// 前景はセル(8x8 ピクセル)単位でまとめ、つながったセルをひとかたまり(ブロブ)とする
+class BackgroundModel
+{
+public:
+
+  // 前景のかたまり
+  struct Blob
+  {
+    cv::Rect rect;    // 外接矩形
+    int pixels;       // 前景のピクセル数
+  };
+
+  BackgroundModel()
+    : tolerance( 50 )
+    , minConfidence( 10 )
+    , maxConfidence( 300 )
+    , learningFrames( 30 )
+    , cellSize( 8 )
+    , minBlobPixels( 400 )
+    , width( 0 )
+    , height( 0 )
+    , cellsX( 0 )
+    , cellsY( 0 )
+    , frameCount( 0 )
+  {
+  }
+
+  // 背景と同じとみなす距離の差(mm、距離に応じて広げる)
+  void setTolerance( int tolerance )
+  {
+    this->tolerance = tolerance;
+  }
+
+  // 前景が背景に取り込まれるまでの最大のフレーム数
+  void setAbsorbFrames( int frames )
+  {
+    maxConfidence = (std::min)( (std::max)( frames, minConfidence ), 65535 );
+  }
+
+  // ブロブとする最小のピクセル数
+  void setMinBlobPixels( int pixels )
+  {
+    minBlobPixels = pixels;
+  }
+
+  // 学習をやり直す
+  void reset()
+  {
+    width = height = 0;
+  }
+
+  // 背景の学習中かどうか(学習中は前景を出さない)
+  bool isLearning() const
+  {
+    return frameCount < learningFrames;
+  }
+
+  // Depth データで背景を更新し、前景とブロブを求める
+  void update( const openni::DepthPixel* depth, int width, int height )
+  {
+    if ( (width != this->width) || (height != this->height) ) {
+      resize( width, height );
+    }
+
+    bool learning = isLearning();
+    std::fill( cellCounts.begin(), cellCounts.end(), 0 );
+
+    for ( int y = 0; y < height; ++y ) {
+      const openni::DepthPixel* src = &depth[y * width];
+      unsigned short* bg = &background[y * width];
+      unsigned short* conf = &confidence[y * width];
+      uchar* mask = foreground.ptr( y );
+      int* counts = &cellCounts[(y / cellSize) * cellsX];
+
+      for ( int x = 0; x < width; ++x ) {
+        int d = src[x];
+        int b = bg[x];
+        int c = conf[x];
+        int fg = 0;
+
+        if ( d == 0 ) {
+          // 距離のないピクセルは学習しない
+        }
+        else if ( b == 0 ) {
+          // はじめて距離が得られた
+          bg[x] = (unsigned short)d;
+          conf[x] = 1;
+        }
+        else {
+          // 距離のノイズは遠いほど大きいので、許容する差を広げる
+          int tol = tolerance + (d >> 6);
+          int diff = b - d;
+
+          if ( (diff <= tol) && (diff >= -tol) ) {
+            // 背景と同じ : 確からしさを上げ、背景の距離を少しずつ追従させる
+            conf[x] = (unsigned short)(std::min)( c + 1, maxConfidence );
+            bg[x] = (unsigned short)(b + (d > b) - (d < b));
+          }
+          else if ( diff < 0 ) {
+            // 背景より奥 : 隠れていた背景が見えた
+            bg[x] = (unsigned short)d;
+            conf[x] = 1;
+          }
+          else {
+            // 背景より手前 : 前景。置かれたままなら背景に取り込む
+            fg = (!learning && (c >= minConfidence)) ? 1 : 0;
+            if ( c <= 1 ) {
+              bg[x] = (unsigned short)d;
+              conf[x] = 1;
+            }
+            else {
+              conf[x] = (unsigned short)(c - 1);
+            }
+          }
+        }
+
+        mask[x] = (uchar)(fg * 255);
+        counts[x / cellSize] += fg;
+      }
+    }
+
+    if ( learning ) {
+      ++frameCount;
+    }
+
+    findBlobs();
+  }
+
+  // 前景のマスク(255:前景 0:それ以外)
+  const cv::Mat& getMask() const
+  {
+    return foreground;
+  }
+
+  // 前景のかたまり
+  const std::vector<Blob>& getBlobs() const
+  {
+    return blobs;
+  }
+
+private:
+
+  void resize( int width, int height )
+  {
+    this->width = width;
+    this->height = height;
+    cellsX = (width + cellSize - 1) / cellSize;
+    cellsY = (height + cellSize - 1) / cellSize;
+
+    background.assign( width * height, 0 );
+    confidence.assign( width * height, 0 );
+    foreground = cv::Mat::zeros( height, width, CV_8UC1 );
+    cellCounts.assign( cellsX * cellsY, 0 );
+    cellLabels.assign( cellsX * cellsY, 0 );
+    frameCount = 0;
+  }
+
+  // 前景が 1/4 以上あるセルを、上下左右につながるものごとにまとめる
+  void findBlobs()
+  {
+    blobs.clear();
+    std::fill( cellLabels.begin(), cellLabels.end(), 0 );
+
+    int threshold = (cellSize * cellSize) / 4;
+    int label = 0;
+    for ( int i = 0; i < (int)cellCounts.size(); ++i ) {
+      if ( (cellCounts[i] < threshold) || (cellLabels[i] != 0) ) {
+        continue;
+      }
+
+      // つながっているセルをたどる
+      ++label;
+      int left = cellsX, top = cellsY, right = 0, bottom = 0;
+      int pixels = 0;
+
+      stack.clear();
+      stack.push_back( i );
+      cellLabels[i] = label;
+      while ( !stack.empty() ) {
+        int cell = stack.back();
+        stack.pop_back();
+
+        int cx = cell % cellsX;
+        int cy = cell / cellsX;
+        left = (std::min)( left, cx );
+        top = (std::min)( top, cy );
+        right = (std::max)( right, cx );
+        bottom = (std::max)( bottom, cy );
+        pixels += cellCounts[cell];
+
+        if ( cx > 0 ) {
+          visit( cell - 1, threshold, label );
+        }
+        if ( cx < (cellsX - 1) ) {
+          visit( cell + 1, threshold, label );
+        }
+        if ( cy > 0 ) {
+          visit( cell - cellsX, threshold, label );
+        }
+        if ( cy < (cellsY - 1) ) {
+          visit( cell + cellsX, threshold, label );
+        }
+      }
+
+      if ( pixels < minBlobPixels ) {
+        continue;
+      }
+
+      Blob blob;
+      blob.rect = cv::Rect( left * cellSize, top * cellSize,
+                            (right - left + 1) * cellSize, (bottom - top + 1) * cellSize ) &
+                  cv::Rect( 0, 0, width, height );
+      blob.pixels = pixels;
+      blobs.push_back( blob );
+    }
+  }
+
+  void visit( int cell, int threshold, int label )
+  {
+    if ( (cellCounts[cell] >= threshold) && (cellLabels[cell] == 0) ) {
+      cellLabels[cell] = label;
+      stack.push_back( cell );
+    }
+  }
+
+private:
+
+  int tolerance;                              // 背景と同じとみなす距離の差(mm)
+  int minConfidence;                          // 前景とするのに必要な背景の確からしさ
+  int maxConfidence;                          // 確からしさの上限(取り込むまでのフレーム数)
+  int learningFrames;                         // 学習だけを行うフレーム数
+  int cellSize;                               // ブロブを求めるセルの大きさ
+  int minBlobPixels;                          // ブロブとする最小のピクセル数
+
+  int width;                                  // 画面の幅
+  int height;                                 // 画面の高さ
+  int cellsX;                                 // 横方向のセル数
+  int cellsY;                                 // 縦方向のセル数
+  int frameCount;                             // 学習したフレーム数
+
+  std::vector<unsigned short> background;     // 背景の距離
+  std::vector<unsigned short> confidence;     // 背景の確からしさ
+  cv::Mat foreground;                         // 前景のマスク
+
+  std::vector<int> cellCounts;                // セルごとの前景のピクセル数
+  std::vector<int> cellLabels;                // セルごとのブロブの番号
+  std::vector<int> stack;                     // つながったセルをたどるためのスタック
+  std::vector<Blob> blobs;                    // 前景のかたまり
+};
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef _OCCUPANCY_MAP_H_
+#define _OCCUPANCY_MAP_H_
+
+#include <cmath>
+#include <vector>
+
+#include <NiTE.h>
+#include <opencv2/opencv.hpp>
+
+// ユーザーと前景を床の上から見たグリッドに投影し、滞在のヒートマップと線の通過数を数える
+//
+// ヒートマップは時間とともに薄くする(減衰)。セルごとに減衰させると毎フレーム全体を
+// 書き換えることになるので、全体に共通の倍率 gain を持ち、
+//   実際の値 = 保存した値 × gain
+// とする。減衰は gain を小さくするだけで、値を足すときは gain で割ってから足す。
+// gain が小さくなりすぎたら、まれに全体に掛けて 1 に戻す。
+// これで 1 フレームの処理は足した点の数だけになり、履歴の長さによらない。
+// メモリはグリッドとユーザーの数で決まり、動作中に増えない
+class OccupancyMap
+{
+public:
+
+  // 通過数を数える線(床の上の座標、mm)
+  struct Line
+  {
+    cv::Point2f a;
+    cv::Point2f b;
+    int forward;          // a から b を見て左から右へ通過した数
+    int backward;         // 右から左へ通過した数
+  };
+
+  // 前回の取り出しから変わったセル
+  struct Cell
+  {
+    int x;
+    int z;
+    float dwell;          // ユーザーの滞在
+    float foreground;     // 前景の点
+  };
+
+  // 差分のスナップショット
+  // 受け取る側は、全セルに decay を掛けてから cells を上書きすれば、今の値になる
+  struct Snapshot
+  {
+    unsigned int frame;
+    double decay;                 // 前回からの減衰
+    std::vector<Cell> cells;      // 点の足されたセル
+    std::vector<Line> lines;      // 線ごとの通過数(累計)
+  };
+
+  // cols, rows  : グリッドの大きさ(セル)
+  // cellSize    : セルの大きさ(mm)
+  // halfLife    : 値が半分になるフレーム数
+  OccupancyMap( int cols = 100, int rows = 100, float cellSize = 100, double halfLife = 300 )
+    : cols( cols )
+    , rows( rows )
+    , cellSize( cellSize )
+    , decayPerFrame( std::pow( 0.5, 1.0 / halfLife ) )
+    , gain( 1 )
+    , snapshotDecay( 1 )
+    , frame( 0 )
+    , dwell( cols * rows, 0 )
+    , foreground( cols * rows, 0 )
+    , dirty( cols * rows, 0 )
+    , tracks( MAX_USERS )
+  {
+    dirtyCells.reserve( cols * rows );
+  }
+
+  // 通過数を数える線を追加する
+  void addLine( const cv::Point2f& a, const cv::Point2f& b )
+  {
+    Line line = { a, b, 0, 0 };
+    lines.push_back( line );
+  }
+
+  // フレームの始めに呼ぶ(全体を 1 フレーム分減衰させる)
+  void beginFrame()
+  {
+    ++frame;
+    gain *= decayPerFrame;
+    snapshotDecay *= decayPerFrame;
+
+    // 保存した値が大きくなりすぎないよう、まれに gain を 1 に戻す
+    if ( gain < 1e-6 ) {
+      for ( size_t i = 0; i < dwell.size(); ++i ) {
+        dwell[i] = (float)(dwell[i] * gain);
+        foreground[i] = (float)(foreground[i] * gain);
+      }
+      gain = 1;
+    }
+  }
+
+  // ユーザーの重心を滞在として足し、線の通過を調べる
+  void addUsers( const nite::Array<nite::UserData>& users )
+  {
+    for ( int i = 0; i < users.getSize(); ++i ) {
+      const nite::UserData& user = users[i];
+      Track& track = tracks[user.getId() % MAX_USERS];
+      if ( !user.isVisible() || user.isLost() ) {
+        track.frame = 0;
+        continue;
+      }
+
+      // 重心が求まっていないとき(0, 0, 0)は使わない
+      const nite::Point3f& center = user.getCenterOfMass();
+      if ( center.z == 0 ) {
+        continue;
+      }
+
+      cv::Point2f position( center.x, center.z );
+      add( dwell, position, 1 );
+
+      // 前のフレームの位置から線をまたいだか調べる
+      if ( (track.id == user.getId()) && (track.frame == (frame - 1)) ) {
+        for ( size_t l = 0; l < lines.size(); ++l ) {
+          countCrossing( lines[l], track.position, position );
+        }
+      }
+
+      track.id = user.getId();
+      track.frame = frame;
+      track.position = position;
+    }
+  }
+
+  // 前景の点を足す(label が 0 でないピクセルを前景とする)
+  // fx は Depth の横の焦点距離(ピクセル)、step は点を間引く間隔
+  // (上から見るので高さは使わない)
+  template<typename Label>
+  void addForeground( const openni::DepthPixel* depth, const Label* labels, int width, int height,
+                      float fx, int step )
+  {
+    float weight = (float)(step * step) / (width * height);
+    for ( int y = 0; y < height; y += step ) {
+      int row = y * width;
+      for ( int x = 0; x < width; x += step ) {
+        if ( (labels[row + x] == 0) || (depth[row + x] == 0) ) {
+          continue;
+        }
+
+        float z = depth[row + x];
+        add( foreground, cv::Point2f( ((x - (width / 2.0f)) / fx) * z, z ), weight );
+      }
+    }
+  }
+
+  // 前回の取り出しから変わったセルを取り出す
+  void getSnapshot( Snapshot* snapshot )
+  {
+    snapshot->frame = frame;
+    snapshot->decay = snapshotDecay;
+    snapshot->cells.clear();
+    for ( size_t i = 0; i < dirtyCells.size(); ++i ) {
+      int index = dirtyCells[i];
+      Cell cell = { index % cols, index / cols,
+                    (float)(dwell[index] * gain), (float)(foreground[index] * gain) };
+      snapshot->cells.push_back( cell );
+      dirty[index] = 0;
+    }
+    snapshot->lines = lines;
+
+    dirtyCells.clear();
+    snapshotDecay = 1;
+  }
+
+  // ヒートマップを画像にする(滞在は赤、前景は緑、max で最大の明るさ)
+  void draw( cv::Mat& image, float maxDwell, float maxForeground ) const
+  {
+    image.create( rows, cols, CV_8UC3 );
+    for ( int z = 0; z < rows; ++z ) {
+      // 手前(センサーの近く)を下にする
+      cv::Vec3b* dst = image.ptr<cv::Vec3b>( rows - 1 - z );
+      for ( int x = 0; x < cols; ++x ) {
+        int index = (z * cols) + x;
+        dst[x][0] = 0;
+        dst[x][1] = toByte( foreground[index] * gain / maxForeground );
+        dst[x][2] = toByte( dwell[index] * gain / maxDwell );
+      }
+    }
+  }
+
+  // 床の上の座標(mm)を画像の位置にする
+  cv::Point toImage( const cv::Point2f& position ) const
+  {
+    return cv::Point( (int)((position.x / cellSize) + (cols / 2)), rows - 1 - (int)(position.y / cellSize) );
+  }
+
+  const std::vector<Line>& getLines() const
+  {
+    return lines;
+  }
+
+private:
+
+  enum { MAX_USERS = 32 };
+
+  // ユーザーごとの前のフレームの位置
+  struct Track
+  {
+    Track()
+      : id( 0 ), frame( 0 )
+    {
+    }
+
+    nite::UserId id;
+    unsigned int frame;
+    cv::Point2f position;
+  };
+
+  static unsigned char toByte( double value )
+  {
+    return (unsigned char)((value >= 1) ? 255 : (value <= 0) ? 0 : (value * 255));
+  }
+
+  // 床の上の位置(x は左右、y は奥行き。センサーの真下が原点)のセルに値を足す
+  void add( std::vector<float>& plane, const cv::Point2f& position, float value )
+  {
+    int x = (int)std::floor( position.x / cellSize ) + (cols / 2);
+    int z = (int)std::floor( position.y / cellSize );
+    if ( (x < 0) || (x >= cols) || (z < 0) || (z >= rows) ) {
+      return;
+    }
+
+    int index = (z * cols) + x;
+    plane[index] += (float)(value / gain);
+    if ( !dirty[index] ) {
+      dirty[index] = 1;
+      dirtyCells.push_back( index );
+    }
+  }
+
+  // 線分 p0-p1 が線をまたいでいたら、向きごとに数える
+  static void countCrossing( Line& line, const cv::Point2f& p0, const cv::Point2f& p1 )
+  {
+    float side0 = cross( line.b - line.a, p0 - line.a );
+    float side1 = cross( line.b - line.a, p1 - line.a );
+    if ( (side0 == 0) || ((side0 > 0) == (side1 > 0)) ) {
+      return;
+    }
+
+    // 線の延長ではなく、線分の間をまたいだか
+    float t0 = cross( p1 - p0, line.a - p0 );
+    float t1 = cross( p1 - p0, line.b - p0 );
+    if ( (t0 > 0) == (t1 > 0) ) {
+      return;
+    }
+
+    if ( side0 > 0 ) {
+      ++line.forward;
+    }
+    else {
+      ++line.backward;
+    }
+  }
+
+  static float cross( const cv::Point2f& a, const cv::Point2f& b )
+  {
+    return (a.x * b.y) - (a.y * b.x);
+  }
+
+private:
+
+  int cols;                         // グリッドの横のセル数
+  int rows;                         // グリッドの奥行きのセル数
+  float cellSize;                   // セルの大きさ(mm)
+  double decayPerFrame;             // 1 フレームの減衰
+  double gain;                      // 保存した値に掛ける倍率
+  double snapshotDecay;             // 前回の取り出しからの減衰
+  unsigned int frame;               // フレーム番号
+
+  std::vector<float> dwell;         // 滞在のヒートマップ(gain で割った値)
+  std::vector<float> foreground;    // 前景のヒートマップ(gain で割った値)
+  std::vector<unsigned char> dirty; // 取り出していない変更があるか
+  std::vector<int> dirtyCells;      // 変更のあったセル
+
+  std::vector<Track> tracks;        // ユーザーごとの前のフレームの位置
+  std::vector<Line> lines;          // 通過数を数える線
+};
+
+#endif
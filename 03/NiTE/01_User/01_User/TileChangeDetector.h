@@ -0,0 +1,178 @@
+#ifndef _TILE_CHANGE_DETECTOR_H_
+#define _TILE_CHANGE_DETECTOR_H_
+
+#include <cstring>
+#include <vector>
+
+#include <NiTE.h>
+#include <opencv2/opencv.hpp>
+
+// 前フレームの Depth データとユーザーマップを比較し、変化したタイルを求める
+//
+// 画面を 16x16 のタイルに分け、ユーザー番号が変わったか、距離が
+// しきい値以上変わったピクセルを含むタイルを「更新あり」とする。
+// 比較の基準は最後に更新ありとしたときの値なので、少しずつの変化も
+// いずれ検出される
+class TileChangeDetector
+{
+public:
+
+  TileChangeDetector()
+    : tileSize( 16 )
+    , threshold( 40 )
+    , width( 0 )
+    , height( 0 )
+    , tilesX( 0 )
+    , tilesY( 0 )
+  {
+  }
+
+  // 更新ありとする距離の変化量(mm)
+  // 可視化では 10000mm を 255 諧調にする(1 諧調は約 39mm)ので、40mm 未満の変化で
+  // 更新しなかったタイルの表示のずれは、1 諧調以内に収まる
+  void setThreshold( int threshold )
+  {
+    this->threshold = threshold;
+  }
+
+  // 次のフレームではすべてのタイルを更新ありにする
+  void invalidate()
+  {
+    width = height = 0;
+  }
+
+  // 前フレームと比較して、更新のあったタイルを求める
+  void update( const openni::DepthPixel* depth, const nite::UserId* labels,
+               int width, int height )
+  {
+    // 解像度が変わったら、すべてのタイルを更新ありにする
+    bool all = (width != this->width) || (height != this->height);
+    if ( all ) {
+      resize( width, height );
+    }
+
+    dirtyRects.clear();
+    for ( int ty = 0; ty < tilesY; ++ty ) {
+      for ( int tx = 0; tx < tilesX; ++tx ) {
+        cv::Rect tile = getTileRect( tx, ty );
+        bool dirty = all || isChanged( depth, labels, tile );
+
+        dirtyMap[(ty * tilesX) + tx] = dirty ? 1 : 0;
+        if ( dirty ) {
+          // 比較の基準を更新する
+          store( depth, labels, tile );
+          dirtyRects.push_back( tile );
+        }
+      }
+    }
+  }
+
+  // 更新のあったタイルの矩形
+  const std::vector<cv::Rect>& getDirtyRects() const
+  {
+    return dirtyRects;
+  }
+
+  // タイルごとの更新の有無(1:更新あり 0:更新なし、横 getTilesX() 個ずつ並ぶ)
+  // 差分を送るエンコーダーやストリーマーに渡すためのもの
+  const std::vector<unsigned char>& getDirtyMap() const
+  {
+    return dirtyMap;
+  }
+
+  int getTileSize() const
+  {
+    return tileSize;
+  }
+
+  int getTilesX() const
+  {
+    return tilesX;
+  }
+
+  int getTilesY() const
+  {
+    return tilesY;
+  }
+
+private:
+
+  void resize( int width, int height )
+  {
+    this->width = width;
+    this->height = height;
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+
+    prevDepth.assign( width * height, 0 );
+    prevLabels.assign( width * height, 0 );
+    dirtyMap.assign( tilesX * tilesY, 1 );
+  }
+
+  cv::Rect getTileRect( int tx, int ty ) const
+  {
+    return cv::Rect( tx * tileSize, ty * tileSize, tileSize, tileSize ) &
+           cv::Rect( 0, 0, width, height );
+  }
+
+  // タイル内に変化したピクセルがあるかどうか
+  bool isChanged( const openni::DepthPixel* depth, const nite::UserId* labels,
+                  const cv::Rect& tile ) const
+  {
+    for ( int y = tile.y; y < (tile.y + tile.height); ++y ) {
+      int offset = (y * width) + tile.x;
+
+      // ユーザー番号は 1 つでも違えば更新あり
+      if ( std::memcmp( &labels[offset], &prevLabels[offset],
+                        tile.width * sizeof(nite::UserId) ) != 0 ) {
+        return true;
+      }
+
+      // 1 行分の差の最大値を求める(分岐のないループなのでベクトル化される)
+      const openni::DepthPixel* current = &depth[offset];
+      const openni::DepthPixel* previous = &prevDepth[offset];
+      int maxDiff = 0;
+      for ( int x = 0; x < tile.width; ++x ) {
+        int diff = (int)current[x] - (int)previous[x];
+        diff = (diff < 0) ? -diff : diff;
+        maxDiff = (diff > maxDiff) ? diff : maxDiff;
+      }
+
+      if ( maxDiff >= threshold ) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void store( const openni::DepthPixel* depth, const nite::UserId* labels,
+              const cv::Rect& tile )
+  {
+    for ( int y = tile.y; y < (tile.y + tile.height); ++y ) {
+      int offset = (y * width) + tile.x;
+      std::memcpy( &prevDepth[offset], &depth[offset],
+                   tile.width * sizeof(openni::DepthPixel) );
+      std::memcpy( &prevLabels[offset], &labels[offset],
+                   tile.width * sizeof(nite::UserId) );
+    }
+  }
+
+private:
+
+  int tileSize;                               // タイルの大きさ
+  int threshold;                              // 更新ありとする距離の変化量
+
+  int width;                                  // 画面の幅
+  int height;                                 // 画面の高さ
+  int tilesX;                                 // 横方向のタイル数
+  int tilesY;                                 // 縦方向のタイル数
+
+  std::vector<openni::DepthPixel> prevDepth;  // 比較の基準の Depth データ
+  std::vector<nite::UserId> prevLabels;       // 比較の基準のユーザーマップ
+
+  std::vector<unsigned char> dirtyMap;        // タイルごとの更新の有無
+  std::vector<cv::Rect> dirtyRects;           // 更新のあったタイルの矩形
+};
+
+#endif
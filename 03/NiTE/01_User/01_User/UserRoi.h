@@ -0,0 +1,142 @@
+#ifndef _USER_ROI_H_
+#define _USER_ROI_H_
+
+#include <algorithm>
+#include <vector>
+
+#include <NiTE.h>
+#include <opencv2/opencv.hpp>
+
+// ユーザーの外接矩形から処理する領域(ROI)を求める
+//
+// 矩形は余白を付けてタイル単位に切りそろえ、重なるものは 1 つにまとめる。
+// ROI が画面の大部分を占める場合は、画面全体を処理する方が速いので
+// isFullFrame() が true になる
+class UserRoi
+{
+public:
+
+  UserRoi()
+    : margin( 16 )
+    , tileSize( 16 )
+    , fullFrameRatio( 0.5f )
+    , fullFrame( true )
+    , width( 0 )
+    , height( 0 )
+  {
+  }
+
+  // 外接矩形の周りに付ける余白(ピクセル)
+  void setMargin( int margin )
+  {
+    this->margin = margin;
+  }
+
+  // 画面全体の処理に切り替える ROI の面積の割合
+  void setFullFrameRatio( float ratio )
+  {
+    fullFrameRatio = ratio;
+  }
+
+  // NiTE が求めたユーザーの外接矩形から ROI を更新する
+  void update( const nite::UserTrackerFrameRef& userFrame )
+  {
+    const nite::UserMap& userMap = userFrame.getUserMap();
+    begin( userMap.getWidth(), userMap.getHeight() );
+
+    const nite::Array<nite::UserData>& users = userFrame.getUsers();
+    for ( int i = 0; i < users.getSize(); ++i ) {
+      const nite::UserData& user = users[i];
+      if ( !user.isVisible() || user.isLost() ) {
+        continue;
+      }
+
+      // 外接矩形の min/max は Depth 画像の座標になっている
+      const nite::BoundingBox& box = user.getBoundingBox();
+      addRect( cv::Rect( cv::Point( (int)box.min.x, (int)box.min.y ),
+                         cv::Point( (int)box.max.x + 1, (int)box.max.y + 1 ) ) );
+    }
+
+    end();
+  }
+
+  // 処理する領域
+  const std::vector<cv::Rect>& getRects() const
+  {
+    return rects;
+  }
+
+  // 画面全体を処理するかどうか
+  bool isFullFrame() const
+  {
+    return fullFrame;
+  }
+
+private:
+
+  void begin( int width, int height )
+  {
+    this->width = width;
+    this->height = height;
+    rects.clear();
+  }
+
+  // 余白を付けてタイル単位にそろえた矩形を追加し、重なる矩形はまとめる
+  void addRect( const cv::Rect& rect )
+  {
+    int left = ((std::max)( rect.x - margin, 0 ) / tileSize) * tileSize;
+    int top = ((std::max)( rect.y - margin, 0 ) / tileSize) * tileSize;
+    int right = (((rect.x + rect.width + margin) + tileSize - 1) / tileSize) * tileSize;
+    int bottom = (((rect.y + rect.height + margin) + tileSize - 1) / tileSize) * tileSize;
+
+    cv::Rect roi = cv::Rect( cv::Point( left, top ), cv::Point( right, bottom ) ) &
+                   cv::Rect( 0, 0, width, height );
+    if ( roi.area() == 0 ) {
+      return;
+    }
+
+    // 重なる矩形を取り込まなくなるまでまとめる
+    bool merged = true;
+    while ( merged ) {
+      merged = false;
+      for ( std::vector<cv::Rect>::iterator it = rects.begin(); it != rects.end(); ++it ) {
+        if ( (roi & *it).area() != 0 ) {
+          roi |= *it;
+          rects.erase( it );
+          merged = true;
+          break;
+        }
+      }
+    }
+
+    rects.push_back( roi );
+  }
+
+  void end()
+  {
+    int area = 0;
+    for ( size_t i = 0; i < rects.size(); ++i ) {
+      area += rects[i].area();
+    }
+
+    // ROI が大きい場合は、画面全体を 1 つの領域として扱う
+    fullFrame = area > (width * height * fullFrameRatio);
+    if ( fullFrame ) {
+      rects.assign( 1, cv::Rect( 0, 0, width, height ) );
+    }
+  }
+
+private:
+
+  std::vector<cv::Rect> rects;  // 処理する領域
+
+  int margin;                   // 外接矩形の周りの余白
+  int tileSize;                 // ROI をそろえるタイルの大きさ
+  float fullFrameRatio;         // 画面全体の処理に切り替える面積の割合
+  bool fullFrame;               // 画面全体を処理するかどうか
+
+  int width;                    // 画面の幅
+  int height;                   // 画面の高さ
+};
+
+#endif
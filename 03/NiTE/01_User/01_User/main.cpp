@@ -1,35 +1,375 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 #include <NiTE.h>
 #include <opencv2/opencv.hpp>
 
+#include "BackgroundModel.h"
+#include "FrameArena.h"
+#include "OccupancyMap.h"
+#include "ThreadPool.h"
+#include "TileChangeDetector.h"
+#include "UserRoi.h"
+
 class NiteApp
 {
 public:
   
+  NiteApp()
+    : roiEnabled( false )
+    , incrementalEnabled( false )
+    , gatingEnabled( false )
+    , idleFrames( 0 )
+    , occupancyEnabled( false )
+    , depthFx( 0 )
+  {
+  }
+  
   // 初期化
   void initialize()
   {
+    // デバイスを取得する(UserTracker を止めている間は、自分で Depth を取得する)
+    openni::Status ret = device.open( openni::ANY_DEVICE );
+    if ( ret != openni::STATUS_OK ) {
+      throw std::runtime_error( "openni::Device::open() failed." );
+    }
+    
+    depthStream.create( device, openni::SENSOR_DEPTH );
+    
     // UserTracker を作成する
-    userTracker.create();
+    userTracker.create( &device );
+    
+    // 前景の点を床の上に投影するための焦点距離
+    depthFx = (depthStream.getVideoMode().getResolutionX() / 2.0f) /
+              std::tan( depthStream.getHorizontalFieldOfView() / 2 );
+    
+    // センサーの 2m 先を横切る線(幅 2m)を通過した人数を数える
+    occupancyMap.addLine( cv::Point2f( -1000, 2000 ), cv::Point2f( 1000, 2000 ) );
   }
   
   // フレーム更新処理
   void update()
   {
+    // 前のフレームの間だけ使ったメモリをまとめて捨てる
+    arena.reset();
+    
+    // UserTracker を止めている間は、背景差分で前景を調べる
+    if ( !userTracker.isValid() ) {
+      updateBackground();
+      return;
+    }
+    
     nite::UserTrackerFrameRef userFrame;
     userTracker.readFrame( &userFrame );
     
+    // ユーザーのいる領域を求める
+    userRoi.update( userFrame );
+    
+    // ユーザーと前景を床の上のヒートマップに足す
+    if ( occupancyEnabled ) {
+      updateOccupancy( userFrame );
+    }
+    
+    // 誰もいなくなったら UserTracker を止める
+    if ( gatingEnabled ) {
+      updateIdle( userFrame );
+    }
+    
     depthImage = showUser( userFrame );
     cv::imshow( "User", depthImage );
   }
   
+  // ユーザーのいる領域だけを処理するかどうかを切り替える
+  void changeRoiMode()
+  {
+    roiEnabled = !roiEnabled;
+  }
+  
+  // 変化したタイルだけを処理するかどうかを切り替える
+  void changeIncrementalMode()
+  {
+    incrementalEnabled = !incrementalEnabled;
+    
+    // 画像の内容が前フレームと一致しているとは限らないので、全体を更新させる
+    changeDetector.invalidate();
+  }
+  
+  // 前景がないときに UserTracker を止めるかどうかを切り替える
+  void changeGatingMode()
+  {
+    gatingEnabled = !gatingEnabled;
+    backgroundModel.reset();
+    idleFrames = 0;
+    
+    // 止めていた UserTracker を再開する
+    if ( !gatingEnabled && !userTracker.isValid() ) {
+      startUserTracker();
+    }
+    
+    std::cout << "Gating : " << (gatingEnabled ? "on" : "off") << std::endl;
+  }
+  
+  // 床の上のヒートマップと通過数を数えるかどうかを切り替える
+  void changeOccupancyMode()
+  {
+    occupancyEnabled = !occupancyEnabled;
+    if ( !occupancyEnabled ) {
+      cv::destroyWindow( "Occupancy" );
+    }
+    
+    std::cout << "Occupancy : " << (occupancyEnabled ? "on" : "off") << std::endl;
+  }
+  
+  // 前回から変わったヒートマップのセルと通過数をファイルに追記する
+  void exportOccupancy()
+  {
+    occupancyMap.getSnapshot( &snapshot );
+    
+    std::ofstream file( "OccupancySnapshot.txt", std::ios::app );
+    file << "frame " << snapshot.frame << " decay " << snapshot.decay
+         << " cells " << snapshot.cells.size() << std::endl;
+    for ( size_t i = 0; i < snapshot.cells.size(); ++i ) {
+      const OccupancyMap::Cell& cell = snapshot.cells[i];
+      file << cell.x << " " << cell.z << " " << cell.dwell << " " << cell.foreground << std::endl;
+    }
+    for ( size_t i = 0; i < snapshot.lines.size(); ++i ) {
+      file << "line " << i << " " << snapshot.lines[i].forward << " "
+           << snapshot.lines[i].backward << std::endl;
+    }
+    
+    std::cout << "Occupancy : export " << snapshot.cells.size() << " cells" << std::endl;
+  }
+  
+  // 最後のフレームで変化したタイル(タイルごとの更新の有無と矩形)をファイルに追記する
+  // 差分を送るエンコーダーやストリーマーに渡す形の確認用
+  void exportDirtyTiles()
+  {
+    // 変化したタイルを求めるのは、変化したタイルだけを処理しているときだけ
+    if ( !incrementalEnabled ) {
+      std::cout << "Dirty tiles : incremental mode is off" << std::endl;
+      return;
+    }
+    
+    const std::vector<unsigned char>& dirtyMap = changeDetector.getDirtyMap();
+    const std::vector<cv::Rect>& rects = changeDetector.getDirtyRects();
+    int tilesX = changeDetector.getTilesX();
+    
+    std::ofstream file( "DirtyTiles.txt", std::ios::app );
+    file << "tiles " << tilesX << " " << changeDetector.getTilesY()
+         << " size " << changeDetector.getTileSize() << " rects " << rects.size() << std::endl;
+    for ( size_t i = 0; i < dirtyMap.size(); ++i ) {
+      file << (dirtyMap[i] ? '1' : '0');
+      if ( ((i + 1) % tilesX) == 0 ) {
+        file << std::endl;
+      }
+    }
+    for ( size_t i = 0; i < rects.size(); ++i ) {
+      file << rects[i].x << " " << rects[i].y << " "
+           << rects[i].width << " " << rects[i].height << std::endl;
+    }
+    
+    std::cout << "Dirty tiles : export " << rects.size() << " rects" << std::endl;
+  }
+  
 private:
   
+  // UserTracker を止めている間の更新処理
+  void updateBackground()
+  {
+    openni::VideoFrameRef depthFrame;
+    depthStream.readFrame( &depthFrame );
+    
+    backgroundModel.update( (const openni::DepthPixel*)depthFrame.getData(),
+                            depthFrame.getWidth(), depthFrame.getHeight() );
+    
+    depthImage = showForeground( depthFrame );
+    cv::imshow( "User", depthImage );
+    
+    // ユーザーは検出していないので、前景だけを足す
+    if ( occupancyEnabled && depthFrame.isValid() ) {
+      occupancyMap.beginFrame();
+      occupancyMap.addForeground( (const openni::DepthPixel*)depthFrame.getData(),
+                                  backgroundModel.getMask().ptr(),
+                                  depthFrame.getWidth(), depthFrame.getHeight(), depthFx, 4 );
+      showOccupancy();
+    }
+    
+    // 前景が現れたら UserTracker を再開する
+    if ( !backgroundModel.getBlobs().empty() ) {
+      startUserTracker();
+    }
+  }
+  
+  // UserTracker の動作中も背景を学習し、ユーザーも前景もない状態が続いたら止める
+  void updateIdle( nite::UserTrackerFrameRef& userFrame )
+  {
+    openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
+    if ( !depthFrame.isValid() ) {
+      return;
+    }
+    
+    backgroundModel.update( (const openni::DepthPixel*)depthFrame.getData(),
+                            depthFrame.getWidth(), depthFrame.getHeight() );
+    
+    bool visible = false;
+    const nite::Array<nite::UserData>& users = userFrame.getUsers();
+    for ( int i = 0; i < users.getSize(); ++i ) {
+      visible = visible || users[i].isVisible();
+    }
+    
+    idleFrames = (visible || !backgroundModel.getBlobs().empty() ||
+                  backgroundModel.isLearning()) ? 0 : (idleFrames + 1);
+    if ( idleFrames >= 90 ) {
+      stopUserTracker();
+    }
+  }
+  
+  // ユーザーの重心と、ユーザーとして検出したピクセルを足す
+  void updateOccupancy( nite::UserTrackerFrameRef& userFrame )
+  {
+    openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
+    if ( !depthFrame.isValid() ) {
+      return;
+    }
+    
+    occupancyMap.beginFrame();
+    occupancyMap.addUsers( userFrame.getUsers() );
+    occupancyMap.addForeground( (const openni::DepthPixel*)depthFrame.getData(),
+                                userFrame.getUserMap().getPixels(),
+                                depthFrame.getWidth(), depthFrame.getHeight(), depthFx, 4 );
+    showOccupancy();
+  }
+  
+  // ヒートマップと通過数を表示する
+  void showOccupancy()
+  {
+    // 滞在はおよそ 10 秒、前景はセルの 1/10 程度の点で最大の明るさにする
+    occupancyMap.draw( occupancyImage, 300, 0.02f );
+    cv::resize( occupancyImage, occupancyImage, cv::Size(), 4, 4, cv::INTER_NEAREST );
+    
+    const std::vector<OccupancyMap::Line>& lines = occupancyMap.getLines();
+    for ( size_t i = 0; i < lines.size(); ++i ) {
+      cv::Point a = occupancyMap.toImage( lines[i].a ) * 4;
+      cv::Point b = occupancyMap.toImage( lines[i].b ) * 4;
+      cv::line( occupancyImage, a, b, cv::Scalar( 255, 255, 0 ) );
+      
+      // 文字列はフレームの間だけ使うメモリに作る
+      char* text = arena.allocate<char>( 32 );
+      sprintf( text, "%d / %d", lines[i].forward, lines[i].backward );
+      cv::putText( occupancyImage, text, b, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar( 255, 255, 0 ) );
+    }
+    
+    cv::imshow( "Occupancy", occupancyImage );
+  }
+  
+  void startUserTracker()
+  {
+    depthStream.stop();
+    userTracker.create( &device );
+    idleFrames = 0;
+    changeDetector.invalidate();
+    std::cout << "UserTracker : start" << std::endl;
+  }
+  
+  void stopUserTracker()
+  {
+    userTracker.destroy();
+    depthStream.start();
+    changeDetector.invalidate();
+    std::cout << "UserTracker : stop" << std::endl;
+  }
+  
+  // 背景差分の前景とブロブを表示する
+  cv::Mat showForeground( const openni::VideoFrameRef& depthFrame )
+  {
+    cv::Mat& depthImage = userImage;
+    if ( !depthFrame.isValid() ) {
+      return depthImage;
+    }
+    
+    depthImage.create( depthFrame.getHeight(), depthFrame.getWidth(), CV_8UC4 );
+    
+    const openni::DepthPixel* depth = (const openni::DepthPixel*)depthFrame.getData();
+    const cv::Mat& mask = backgroundModel.getMask();
+    for ( int y = 0; y < depthImage.rows; ++y ) {
+      const uchar* fg = mask.ptr( y );
+      uchar* data = depthImage.ptr( y );
+      for ( int x = 0; x < depthImage.cols; ++x ) {
+        // 前景は赤、それ以外は Depth データを書きこむ
+        int gray = ~((depth[(y * depthImage.cols) + x] * 255) / 10000) & 0xff;
+        data[(x * 4) + 0] = fg[x] ? 0 : gray;
+        data[(x * 4) + 1] = fg[x] ? 0 : gray;
+        data[(x * 4) + 2] = gray;
+      }
+    }
+    
+    const std::vector<BackgroundModel::Blob>& blobs = backgroundModel.getBlobs();
+    for ( size_t i = 0; i < blobs.size(); ++i ) {
+      cv::rectangle( depthImage, blobs[i].rect, cv::Scalar( 0, 255, 0, 255 ) );
+    }
+    
+    return depthImage;
+  }
+  
   // ユーザーの検出
   cv::Mat showUser( nite::UserTrackerFrameRef& userFrame )
   {
-    // ユーザーにつける色
+    // 変化したタイルだけを更新できるよう、画像はフレーム間で使いまわす
+    cv::Mat& depthImage = userImage;
+    
+    // Depth フレームを取得する
+    openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
+    if ( depthFrame.isValid() ) {
+      depthImage.create( depthFrame.getHeight(),
+                        depthFrame.getWidth(),
+                        CV_8UC4 );
+      
+      // Depth データおよびユーザーインデックスを取得する
+      openni::DepthPixel* depth = (openni::DepthPixel*)depthFrame.getData();
+      const nite::UserId* pLabels = userFrame.getUserMap().getPixels();
+      
+      // ユーザーのいる領域だけを処理する
+      if ( roiEnabled && !userRoi.isFullFrame() ) {
+        // 領域の外側は処理しないので黒で塗りつぶしておく
+        depthImage = cv::Scalar::all( 0 );
+        
+        const std::vector<cv::Rect>& rects = userRoi.getRects();
+        for ( size_t r = 0; r < rects.size(); ++r ) {
+          drawUser( depthImage, depth, pLabels, rects[r] );
+          cv::rectangle( depthImage, rects[r], cv::Scalar( 0, 255, 0, 255 ) );
+        }
+        
+        // 画像の内容が変わったので、次に差分更新するときは全体を更新させる
+        changeDetector.invalidate();
+      }
+      // 前フレームから変化したタイルだけを処理する
+      else if ( incrementalEnabled ) {
+        changeDetector.update( depth, pLabels, depthImage.cols, depthImage.rows );
+        
+        const std::vector<cv::Rect>& rects = changeDetector.getDirtyRects();
+        for ( size_t r = 0; r < rects.size(); ++r ) {
+          drawUser( depthImage, depth, pLabels, rects[r] );
+        }
+      }
+      // 画面全体を処理する
+      else {
+        drawUser( depthImage, depth, pLabels,
+                 cv::Rect( 0, 0, depthImage.cols, depthImage.rows ) );
+      }
+    }
+    
+    return depthImage;
+  }
+  
+  // 指定した領域のユーザーと距離データを画像化する
+  // (領域の行をキャッシュに収まるバンドに分けて、並列に処理する)
+  void drawUser( cv::Mat& depthImage, const openni::DepthPixel* depth,
+                 const nite::UserId* pLabels, const cv::Rect& rect )
+  {
+    // ユーザーにつける色(処理スレッドで初期化しないよう、ここで作る)
     static const cv::Scalar colors[] = {
       cv::Scalar( 0, 0, 1 ),
       cv::Scalar( 1, 0, 0 ),
@@ -42,59 +382,100 @@ private:
       cv::Scalar( 0, 0, 0.5 ),
       cv::Scalar( 0.5, 0.5, 0 ),
     };
+    static const int colorCount = sizeof(colors) / sizeof(colors[0]);
     
-    cv::Mat depthImage;
+    threadPool.parallelFor( rect.height, ThreadPool::getBandRows( rect.width * 4 ),
+                            DrawUserBand( depthImage, depth, pLabels, rect, colors, colorCount ) );
+  }
+  
+  // バンドごとのユーザーと距離データの画像化
+  struct DrawUserBand
+  {
+    DrawUserBand( cv::Mat& depthImage, const openni::DepthPixel* depth,
+                  const nite::UserId* pLabels, const cv::Rect& rect,
+                  const cv::Scalar* colors, int colorCount )
+      : depthImage( depthImage ), depth( depth ), pLabels( pLabels ), rect( rect )
+      , colors( colors ), colorCount( colorCount )
+    {
+    }
     
-    // Depth フレームを取得する
-    openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
-    if ( depthFrame.isValid() ) {
-      depthImage = cv::Mat( depthFrame.getHeight(),
-                           depthFrame.getWidth(),
-                           CV_8UC4 );
-      
-      // Depth データおよびユーザーインデックスを取得する
-      openni::DepthPixel* depth = (openni::DepthPixel*)depthFrame.getData();
-      const nite::UserId* pLabels = userFrame.getUserMap().getPixels();
-      
+    // 領域の begin 行目から end 行目の手前までを処理する
+    void operator()( int begin, int end ) const
+    {
       // 1ピクセルずつ調べる
-      for ( int i = 0; i < (depthFrame.getDataSize() / sizeof(openni::DepthPixel)); ++i ) {
-        // カラー画像インデックスを生成
-        int index = i * 4;
-        
-        // 距離データを画像化する
-        uchar* data = &depthImage.data[index];
-        if ( pLabels[i] != 0 ) {
-          // 人を検出したピクセルにはユーザー番号で色を付ける
-          data[0] *= colors[pLabels[i]][0];
-          data[1] *= colors[pLabels[i]][1];
-          data[2] *= colors[pLabels[i]][2];
-        }
-        else {
-          // 人を検出しなかったピクセルは Depth データを書きこむ
+      for ( int y = rect.y + begin; y < (rect.y + end); ++y ) {
+        for ( int x = rect.x; x < (rect.x + rect.width); ++x ) {
+          int i = (y * depthImage.cols) + x;
+          
+          // カラー画像インデックスを生成
+          int index = i * 4;
+          
           // 0-255のグレーデータを作成する
           // distance : 10000 = gray : 255
-          int gray = ~((depth[i] * 255) / 10000);
-          data[0] = gray;
-          data[1] = gray;
-          data[2] = gray;
+          int gray = ~((depth[i] * 255) / 10000) & 0xff;
+          
+          // 距離データを画像化する
+          uchar* data = &depthImage.data[index];
+          if ( pLabels[i] != 0 ) {
+            // 人を検出したピクセルにはユーザー番号で色を付ける
+            const cv::Scalar& color = colors[pLabels[i] % colorCount];
+            data[0] = (uchar)(gray * color[0]);
+            data[1] = (uchar)(gray * color[1]);
+            data[2] = (uchar)(gray * color[2]);
+          }
+          else {
+            // 人を検出しなかったピクセルは Depth データを書きこむ
+            data[0] = gray;
+            data[1] = gray;
+            data[2] = gray;
+          }
         }
       }
     }
     
-    return depthImage;
-  }
+    cv::Mat& depthImage;
+    const openni::DepthPixel* depth;
+    const nite::UserId* pLabels;
+    cv::Rect rect;
+    const cv::Scalar* colors;
+    int colorCount;
+  };
   
 private:
   
-  nite::UserTracker userTracker;  // ユーザー検出
+  openni::Device device;              // 使用するデバイス
+  openni::VideoStream depthStream;    // UserTracker を止めている間の Depth ストリーム
+  
+  nite::UserTracker userTracker;      // ユーザー検出
+  UserRoi userRoi;                    // ユーザーのいる領域
+  bool roiEnabled;                    // ユーザーのいる領域だけを処理するか
+  
+  TileChangeDetector changeDetector;  // 変化したタイルの検出
+  bool incrementalEnabled;            // 変化したタイルだけを処理するか
+  
+  BackgroundModel backgroundModel;    // 背景差分による前景の検出
+  bool gatingEnabled;                 // 前景がないときに UserTracker を止めるか
+  int idleFrames;                     // ユーザーも前景もないフレーム数
   
-  cv::Mat depthImage;             // 可視化した Depth データ
+  OccupancyMap occupancyMap;          // 床の上のヒートマップと通過数
+  OccupancyMap::Snapshot snapshot;    // 書き出す差分(フレーム間で使いまわす)
+  bool occupancyEnabled;              // ヒートマップと通過数を数えるか
+  float depthFx;                      // Depth の横の焦点距離(ピクセル)
+  cv::Mat occupancyImage;             // 可視化したヒートマップ
+  
+  FrameArena arena;                   // フレームの間だけ使うメモリ
+  
+  ThreadPool threadPool;              // 画像化を並列に行うスレッド
+  
+  cv::Mat userImage;                  // ユーザーを描画する画像(フレーム間で使いまわす)
+  cv::Mat depthImage;                 // 可視化した Depth データ
 };
 
 int main(int argc, const char * argv[])
 {
   try {
-    // NiTE を初期化する
+    // OpenNI と NiTE を初期化する
+    openni::OpenNI::initialize();
     nite::NiTE::initialize();
     
     // アプリケーションの初期化
@@ -109,6 +490,30 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // ユーザーのいる領域だけを処理するかを切り替える
+      else if ( key == 'r' ) {
+        app.changeRoiMode();
+      }
+      // 変化したタイルだけを処理するかを切り替える
+      else if ( key == 'd' ) {
+        app.changeIncrementalMode();
+      }
+      // 前景がないときに UserTracker を止めるかを切り替える
+      else if ( key == 'g' ) {
+        app.changeGatingMode();
+      }
+      // 床の上のヒートマップと通過数を数えるかを切り替える
+      else if ( key == 'h' ) {
+        app.changeOccupancyMode();
+      }
+      // 前回から変わったヒートマップと通過数を書き出す
+      else if ( key == 'e' ) {
+        app.exportOccupancy();
+      }
+      // 最後のフレームで変化したタイルを書き出す
+      else if ( key == 't' ) {
+        app.exportDirtyTiles();
+      }
     }
   }
   catch ( std::exception& ) {
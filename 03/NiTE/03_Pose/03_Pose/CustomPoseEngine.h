@@ -0,0 +1,400 @@
+#ifndef _CUSTOM_POSE_ENGINE_H_
+#define _CUSTOM_POSE_ENGINE_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <NiTE.h>
+
+// スケルトンの関節数(JOINT_HEAD - JOINT_RIGHT_FOOT)
+static const int CUSTOM_POSE_JOINT_COUNT = 15;
+
+// 独自ポーズの状態(nite::PoseData と同じ使い方ができる)
+class CustomPoseData
+{
+public:
+
+  CustomPoseData()
+    : type( -1 )
+    , state( STATE_NONE )
+    , matchCount( 0 )
+    , missCount( 0 )
+  {
+  }
+
+  // ポーズの種類(CustomPoseEngine::addPose() の戻り値)
+  int getType() const { return type; }
+
+  // ポーズ認識開始
+  bool isEntered() const { return state == STATE_ENTERED; }
+
+  // ポーズ認識中
+  bool isHeld() const { return state == STATE_HELD; }
+
+  // ポーズ認識終了
+  bool isExited() const { return state == STATE_EXITED; }
+
+private:
+
+  friend class CustomPoseEngine;
+
+  enum State {
+    STATE_NONE,
+    STATE_ENTERED,
+    STATE_HELD,
+    STATE_EXITED,
+  };
+
+  int type;
+  State state;
+  int matchCount;   // 条件を連続して満たしたフレーム数
+  int missCount;    // 条件を連続して満たさなかったフレーム数
+};
+
+// 関節角度と関節の相対位置の条件で定義する独自ポーズの認識エンジン
+//
+// ポーズの条件は addPose() で登録した後、compile() で 1 本の条件テーブルに
+// まとめられ、update() で全ユーザー分を 1 回の走査で評価する
+class CustomPoseEngine
+{
+private:
+
+  enum ConstraintType {
+    CONSTRAINT_ANGLE,
+    CONSTRAINT_RELATIVE,
+    CONSTRAINT_DISTANCE,
+  };
+
+  // 条件テーブルの 1 要素
+  struct Constraint
+  {
+    ConstraintType type;
+    int pose;
+    int joint[3];
+    int axis;
+    float min;
+    float max;
+  };
+
+public:
+
+  // 相対位置の軸
+  enum Axis {
+    AXIS_X,
+    AXIS_Y,
+    AXIS_Z,
+  };
+
+  // ポーズ定義の組み立て
+  class PoseBuilder
+  {
+  public:
+
+    // 関節 b を頂点とした a-b-c の角度が min - max 度の範囲にある
+    PoseBuilder& angle( nite::JointType a, nite::JointType b, nite::JointType c,
+                        float minDegree, float maxDegree )
+    {
+      // acos を使わずに済むよう、余弦の範囲に変換しておく
+      Constraint constraint = makeConstraint( CONSTRAINT_ANGLE, a, b, c );
+      constraint.min = std::cos( toRadian( maxDegree ) );
+      constraint.max = std::cos( toRadian( minDegree ) );
+      engine.addConstraint( constraint );
+      return *this;
+    }
+
+    // 関節 a から見た関節 b の位置(mm)が、指定軸で min - max の範囲にある
+    PoseBuilder& relative( nite::JointType a, nite::JointType b, Axis axis,
+                           float min, float max )
+    {
+      Constraint constraint = makeConstraint( CONSTRAINT_RELATIVE, a, b, b );
+      constraint.axis = axis;
+      constraint.min = min;
+      constraint.max = max;
+      engine.addConstraint( constraint );
+      return *this;
+    }
+
+    // 関節 a と関節 b の距離(mm)が min - max の範囲にある
+    PoseBuilder& distance( nite::JointType a, nite::JointType b, float min, float max )
+    {
+      // 平方根を使わずに済むよう、二乗で比較する
+      Constraint constraint = makeConstraint( CONSTRAINT_DISTANCE, a, b, b );
+      constraint.min = min * min;
+      constraint.max = max * max;
+      engine.addConstraint( constraint );
+      return *this;
+    }
+
+  private:
+
+    friend class CustomPoseEngine;
+
+    PoseBuilder( CustomPoseEngine& engine, int pose )
+      : engine( engine )
+      , pose( pose )
+    {
+    }
+
+    Constraint makeConstraint( ConstraintType type,
+                               nite::JointType a, nite::JointType b, nite::JointType c )
+    {
+      Constraint constraint;
+      constraint.type = type;
+      constraint.pose = pose;
+      constraint.joint[0] = a;
+      constraint.joint[1] = b;
+      constraint.joint[2] = c;
+      constraint.axis = AXIS_X;
+      constraint.min = 0;
+      constraint.max = 0;
+      return constraint;
+    }
+
+    static float toRadian( float degree )
+    {
+      return degree * 3.14159265f / 180.0f;
+    }
+
+    CustomPoseEngine& engine;
+    int pose;
+  };
+
+  CustomPoseEngine()
+    : confidence( 0.5f )
+    , enterFrames( 3 )
+    , exitFrames( 3 )
+    , compiled( false )
+  {
+  }
+
+  // ポーズを登録し、条件を追加するためのビルダーを返す
+  PoseBuilder addPose( const std::string& name )
+  {
+    names.push_back( name );
+    compiled = false;
+    return PoseBuilder( *this, (int)names.size() - 1 );
+  }
+
+  // 登録済みのポーズ数
+  int getPoseCount() const
+  {
+    return (int)names.size();
+  }
+
+  // ポーズの種類を文字列にする
+  const std::string& getPoseName( int type ) const
+  {
+    return names[type];
+  }
+
+  // 認識に使う関節の信頼度のしきい値
+  void setConfidence( float confidence )
+  {
+    this->confidence = confidence;
+  }
+
+  // 認識開始/終了とみなすまでの連続フレーム数
+  void setHysteresis( int enterFrames, int exitFrames )
+  {
+    this->enterFrames = enterFrames;
+    this->exitFrames = exitFrames;
+  }
+
+  // 登録された条件を、ポーズ順に並んだ 1 本のテーブルにまとめる
+  void compile()
+  {
+    table.clear();
+    poseBegin.assign( names.size() + 1, 0 );
+
+    for ( int p = 0; p < getPoseCount(); ++p ) {
+      poseBegin[p] = (int)table.size();
+      for ( size_t i = 0; i < constraints.size(); ++i ) {
+        if ( constraints[i].pose == p ) {
+          table.push_back( constraints[i] );
+        }
+      }
+    }
+    poseBegin[names.size()] = (int)table.size();
+
+    // ポーズ数が変わったので、ユーザーごとの状態を作り直す
+    for ( size_t u = 0; u < users.size(); ++u ) {
+      resetUser( users[u] );
+    }
+
+    compiled = true;
+  }
+
+  // フレームごとに、全ユーザーのポーズを評価する
+  void update( const nite::Array<nite::UserData>& userList )
+  {
+    if ( !compiled ) {
+      compile();
+    }
+
+    for ( int i = 0; i < userList.getSize(); ++i ) {
+      const nite::UserData& user = userList[i];
+      UserState& state = getUserState( user.getId() );
+
+      // 消失したユーザーの状態は破棄する
+      if ( user.isLost() ) {
+        resetUser( state );
+        continue;
+      }
+
+      // スケルトンを追跡していなければ、すべてのポーズは不成立とする
+      const nite::Skeleton& skeleton = user.getSkeleton();
+      bool tracked = skeleton.getState() == nite::SKELETON_TRACKED;
+      if ( tracked ) {
+        loadJoints( skeleton, state );
+      }
+
+      // 条件テーブルを順に評価する(ポーズ内で 1 つでも不成立なら残りは飛ばす)
+      for ( int p = 0; p < getPoseCount(); ++p ) {
+        bool matched = tracked;
+        for ( int c = poseBegin[p]; matched && (c < poseBegin[p + 1]); ++c ) {
+          matched = evaluate( table[c], state );
+        }
+
+        updateState( state.poses[p], matched );
+      }
+    }
+  }
+
+  // ユーザーのポーズ状態を取得する
+  const CustomPoseData& getPose( nite::UserId userId, int type ) const
+  {
+    static const CustomPoseData none;
+    if ( (userId < 0) || (userId >= (int)users.size()) ||
+         (type < 0) || (type >= (int)users[userId].poses.size()) ) {
+      return none;
+    }
+
+    return users[userId].poses[type];
+  }
+
+private:
+
+  // ユーザーごとの関節位置とポーズの状態
+  struct UserState
+  {
+    float position[CUSTOM_POSE_JOINT_COUNT][3];
+    bool valid[CUSTOM_POSE_JOINT_COUNT];
+    std::vector<CustomPoseData> poses;
+  };
+
+  void addConstraint( const Constraint& constraint )
+  {
+    constraints.push_back( constraint );
+    compiled = false;
+  }
+
+  UserState& getUserState( nite::UserId userId )
+  {
+    if ( userId >= (int)users.size() ) {
+      size_t first = users.size();
+      users.resize( userId + 1 );
+      for ( size_t u = first; u < users.size(); ++u ) {
+        resetUser( users[u] );
+      }
+    }
+
+    return users[userId];
+  }
+
+  void resetUser( UserState& state )
+  {
+    state.poses.assign( names.size(), CustomPoseData() );
+    for ( size_t p = 0; p < state.poses.size(); ++p ) {
+      state.poses[p].type = (int)p;
+    }
+  }
+
+  // 関節位置を取り出しておき、条件の評価ではこの配列だけを参照する
+  void loadJoints( const nite::Skeleton& skeleton, UserState& state )
+  {
+    for ( int j = 0; j < CUSTOM_POSE_JOINT_COUNT; ++j ) {
+      const nite::SkeletonJoint& joint = skeleton.getJoint( (nite::JointType)j );
+      const nite::Point3f& position = joint.getPosition();
+      state.position[j][0] = position.x;
+      state.position[j][1] = position.y;
+      state.position[j][2] = position.z;
+      state.valid[j] = joint.getPositionConfidence() >= confidence;
+    }
+  }
+
+  bool evaluate( const Constraint& c, const UserState& state ) const
+  {
+    const float* a = state.position[c.joint[0]];
+    const float* b = state.position[c.joint[1]];
+    const float* o = state.position[c.joint[2]];
+    if ( !state.valid[c.joint[0]] || !state.valid[c.joint[1]] || !state.valid[c.joint[2]] ) {
+      return false;
+    }
+
+    if ( c.type == CONSTRAINT_RELATIVE ) {
+      float value = b[c.axis] - a[c.axis];
+      return (c.min <= value) && (value <= c.max);
+    }
+    else if ( c.type == CONSTRAINT_DISTANCE ) {
+      float dx = b[0] - a[0], dy = b[1] - a[1], dz = b[2] - a[2];
+      float value = (dx * dx) + (dy * dy) + (dz * dz);
+      return (c.min <= value) && (value <= c.max);
+    }
+
+    // CONSTRAINT_ANGLE : b を頂点とするベクトル b->a と b->c のなす角
+    float ux = a[0] - b[0], uy = a[1] - b[1], uz = a[2] - b[2];
+    float vx = o[0] - b[0], vy = o[1] - b[1], vz = o[2] - b[2];
+    float length = std::sqrt( ((ux * ux) + (uy * uy) + (uz * uz)) *
+                              ((vx * vx) + (vy * vy) + (vz * vz)) );
+    if ( length <= 0 ) {
+      return false;
+    }
+
+    float cosine = ((ux * vx) + (uy * vy) + (uz * vz)) / length;
+    return (c.min <= cosine) && (cosine <= c.max);
+  }
+
+  // nite::PoseData と同じく entered -> held -> exited と遷移させる
+  void updateState( CustomPoseData& pose, bool matched )
+  {
+    if ( matched ) {
+      pose.missCount = 0;
+      ++pose.matchCount;
+    }
+    else {
+      pose.matchCount = 0;
+      ++pose.missCount;
+    }
+
+    switch ( pose.state ) {
+    case CustomPoseData::STATE_NONE:
+    case CustomPoseData::STATE_EXITED:
+      pose.state = (pose.matchCount >= enterFrames) ?
+        CustomPoseData::STATE_ENTERED : CustomPoseData::STATE_NONE;
+      break;
+    case CustomPoseData::STATE_ENTERED:
+    case CustomPoseData::STATE_HELD:
+      pose.state = (pose.missCount >= exitFrames) ?
+        CustomPoseData::STATE_EXITED : CustomPoseData::STATE_HELD;
+      break;
+    }
+  }
+
+private:
+
+  std::vector<std::string> names;         // ポーズ名
+  std::vector<Constraint> constraints;    // 登録順の条件
+
+  std::vector<Constraint> table;          // ポーズ順に並べた条件テーブル
+  std::vector<int> poseBegin;             // ポーズごとの条件テーブルの開始位置
+
+  std::vector<UserState> users;           // ユーザーID ごとの状態
+
+  float confidence;                       // 関節の信頼度のしきい値
+  int enterFrames;                        // 認識開始までのフレーム数
+  int exitFrames;                         // 認識終了までのフレーム数
+  bool compiled;                          // 条件テーブルが最新かどうか
+};
+
+#endif
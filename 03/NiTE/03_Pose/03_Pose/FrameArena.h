@@ -0,0 +1,236 @@
+#ifndef _FRAME_ARENA_H_
+#define _FRAME_ARENA_H_
+
+#include <cstddef>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// 1 フレームの間だけ使うメモリを、まとめて確保しておいた領域から先頭から順に切り出す
+//
+// 解放は個別に行わず、フレームの終わりに reset() で全体を捨てる(ポインタを戻すだけ)。
+// ロックしないので、スレッドごとに 1 つ持って、処理の段階に参照で渡して使う。
+// 領域が足りなくなったら、そのフレームの間だけヒープから確保し(はみ出し)、
+// reset() で領域をはみ出した分まで広げるので、次のフレームからははみ出さない。
+// デバッグを有効にすると、使った量の最大値(ハイウォーターマーク)が増えたときと、
+// はみ出しがあったときに表示する
+class FrameArena
+{
+public:
+
+  // capacity : 最初に確保する領域の大きさ(バイト)
+  FrameArena( size_t capacity = 64 * 1024 )
+    : buffer( capacity )
+    , used( 0 )
+    , highWater( 0 )
+    , frameOverflow( 0 )
+    , overflowCount( 0 )
+    , totalOverflowCount( 0 )
+    , debug( false )
+  {
+  }
+
+  ~FrameArena()
+  {
+    releaseOverflow();
+  }
+
+  // メモリを切り出す(フレームの終わりまで有効)
+  // alignment は 2 の累乗。領域の先頭がそろっているとは限らないので、アドレスでそろえる
+  void* allocate( size_t size, size_t alignment = sizeof(void*) )
+  {
+    size_t base = (size_t)buffer.data();
+    size_t offset = ((base + used + (alignment - 1)) & ~(alignment - 1)) - base;
+    if ( (offset + size) <= buffer.size() ) {
+      used = offset + size;
+      return &buffer[offset];
+    }
+
+    // 足りなければ、このフレームの間だけヒープから確保する
+    char* block = new char[size];
+    overflowBlocks.push_back( block );
+    frameOverflow += size;
+    ++overflowCount;
+    return block;
+  }
+
+  // 型を指定して切り出す(コンストラクタは呼ばない)
+  template<typename T>
+  T* allocate( size_t count )
+  {
+    return (T*)allocate( sizeof(T) * count );
+  }
+
+  // 切り出したメモリを指す画像を作る(フレームの終わりまで有効)
+  cv::Mat allocateMat( int rows, int cols, int type )
+  {
+    size_t step = cols * CV_ELEM_SIZE( type );
+    return cv::Mat( rows, cols, type, allocate( step * rows, 16 ), step );
+  }
+
+  // フレームの終わりに呼ぶ(切り出したメモリはすべて無効になる)
+  void reset()
+  {
+    size_t frameUsed = used + frameOverflow;
+    bool raised = frameUsed > highWater;
+    highWater = raised ? frameUsed : highWater;
+
+    if ( debug && (raised || (overflowCount > 0)) ) {
+      std::cout << "FrameArena high water : " << highWater << " bytes"
+                << "  capacity : " << buffer.size() << " bytes";
+      if ( overflowCount > 0 ) {
+        std::cout << "  escaped : " << overflowCount << " allocations ("
+                  << frameOverflow << " bytes)";
+      }
+      std::cout << std::endl;
+    }
+
+    // はみ出した分まで広げる(余裕を 1/4 持たせる)
+    if ( frameOverflow > 0 ) {
+      buffer.resize( frameUsed + (frameUsed / 4) );
+    }
+
+    totalOverflowCount += overflowCount;
+    releaseOverflow();
+    used = 0;
+  }
+
+  void setDebug( bool debug )
+  {
+    this->debug = debug;
+  }
+
+  bool isDebug() const
+  {
+    return debug;
+  }
+
+  size_t getCapacity() const
+  {
+    return buffer.size();
+  }
+
+  // 1 フレームで使った量の最大値(はみ出した分も含む)
+  size_t getHighWater() const
+  {
+    return highWater;
+  }
+
+  // これまでにヒープにはみ出した数
+  int getOverflowCount() const
+  {
+    return totalOverflowCount;
+  }
+
+private:
+
+  FrameArena( const FrameArena& );
+  FrameArena& operator = ( const FrameArena& );
+
+  void releaseOverflow()
+  {
+    for ( size_t i = 0; i < overflowBlocks.size(); ++i ) {
+      delete [] overflowBlocks[i];
+    }
+    overflowBlocks.clear();
+    frameOverflow = 0;
+    overflowCount = 0;
+  }
+
+private:
+
+  std::vector<char> buffer;             // 切り出す領域
+  size_t used;                          // 切り出した量
+  size_t highWater;                     // 1 フレームで使った量の最大値
+  std::vector<char*> overflowBlocks;    // このフレームでヒープにはみ出したメモリ
+  size_t frameOverflow;                 // このフレームでヒープにはみ出した量
+  int overflowCount;                    // このフレームでヒープにはみ出した数
+  int totalOverflowCount;               // これまでにヒープにはみ出した数
+  bool debug;                           // 使った量を表示するか
+};
+
+// FrameArena から切り出す STL のアロケーター(解放は何もしない)
+template<typename T>
+class ArenaAllocator
+{
+public:
+
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<typename U>
+  struct rebind
+  {
+    typedef ArenaAllocator<U> other;
+  };
+
+  ArenaAllocator( FrameArena& arena )
+    : arena( &arena )
+  {
+  }
+
+  template<typename U>
+  ArenaAllocator( const ArenaAllocator<U>& rhs )
+    : arena( rhs.getArena() )
+  {
+  }
+
+  T* allocate( size_t count, const void* = 0 )
+  {
+    return arena->allocate<T>( count );
+  }
+
+  void deallocate( T*, size_t )
+  {
+  }
+
+  void construct( T* p, const T& value )
+  {
+    new ((void*)p) T( value );
+  }
+
+  void destroy( T* p )
+  {
+    p->~T();
+  }
+
+  size_t max_size() const
+  {
+    return (std::numeric_limits<size_t>::max)() / sizeof(T);
+  }
+
+  FrameArena* getArena() const
+  {
+    return arena;
+  }
+
+private:
+
+  FrameArena* arena;
+};
+
+template<typename T, typename U>
+bool operator == ( const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs )
+{
+  return lhs.getArena() == rhs.getArena();
+}
+
+template<typename T, typename U>
+bool operator != ( const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs )
+{
+  return lhs.getArena() != rhs.getArena();
+}
+
+// フレームの間だけ使う文字列
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+#endif
@@ -3,6 +3,10 @@
 #include <NiTE.h>
 #include <opencv2/opencv.hpp>
 
+#include "CustomPoseEngine.h"
+#include "FrameArena.h"
+#include "OverlayRenderer.h"
+
 class NiteApp
 {
 public:
@@ -12,6 +16,9 @@ public:
   {
     // UserTracker を作成する
     userTracker.create();
+    
+    // 独自ポーズを登録する
+    initializeCustomPose();
   }
   
   // フレーム更新処理
@@ -21,11 +28,15 @@ public:
     nite::UserTrackerFrameRef userFrame;
     userTracker.readFrame( &userFrame );
     
-    // ユーザー位置を描画する
-    depthImage = drawUser( userFrame );
+    // ユーザー位置を描画する(画像はフレームの間だけ使うメモリに作る)
+    cv::Mat depthImage = drawUser( userFrame );
     
     // 検出したユーザーを取得する
     const nite::Array<nite::UserData>& users = userFrame.getUsers();
+    
+    // 独自ポーズを全ユーザー分まとめて評価する
+    customPose.update( users );
+    
     for ( int i = 0; i < users.getSize(); ++i ) {
       const nite::UserData& user = users[i];
       
@@ -41,18 +52,75 @@ public:
       // 検出中のユーザー
       else if ( !user.isLost() ) {
         // スケルトンの位置を表示する
-        showSkeleton( depthImage, userTracker, user );
+        showSkeleton( userTracker, user );
         
         // ポーズの状態を表示する
-        showPose( depthImage, user );
+        showPose( user );
       }
     }
     
+    // ためておいた重ね描きをまとめて描く
+    overlay.render( depthImage );
+    
     cv::imshow( "Pose", depthImage );
+    
+    // フレームの間だけ使ったメモリをまとめて捨てる
+    arena.reset();
+  }
+  
+  // フレームの間だけ使うメモリの量を表示するかを切り替える
+  void changeArenaDebug()
+  {
+    arena.setDebug( !arena.isDebug() );
+    std::cout << "FrameArena debug : " << (arena.isDebug() ? "on" : "off")
+              << "  high water : " << arena.getHighWater() << " bytes"
+              << "  escaped : " << arena.getOverflowCount() << std::endl;
+  }
+  
+  // スケルトンとポーズの重ね描きをするかを切り替える
+  void changeOverlay()
+  {
+    overlay.setEnabled( !overlay.isEnabled() );
+    std::cout << "Overlay : " << (overlay.isEnabled() ? "on" : "off")
+              << "  cached : " << overlay.getCachedCount() << std::endl;
   }
   
 private:
   
+  // 独自ポーズの登録
+  void initializeCustomPose()
+  {
+    // 両手を頭の上に上げる
+    customPose.addPose( "Hands Up" )
+      .relative( nite::JOINT_HEAD, nite::JOINT_LEFT_HAND, CustomPoseEngine::AXIS_Y, 100, 1000 )
+      .relative( nite::JOINT_HEAD, nite::JOINT_RIGHT_HAND, CustomPoseEngine::AXIS_Y, 100, 1000 );
+    
+    // 両腕を水平に伸ばす
+    customPose.addPose( "T Pose" )
+      .angle( nite::JOINT_LEFT_SHOULDER, nite::JOINT_LEFT_ELBOW, nite::JOINT_LEFT_HAND, 150, 180 )
+      .angle( nite::JOINT_RIGHT_SHOULDER, nite::JOINT_RIGHT_ELBOW, nite::JOINT_RIGHT_HAND, 150, 180 )
+      .relative( nite::JOINT_LEFT_SHOULDER, nite::JOINT_LEFT_HAND, CustomPoseEngine::AXIS_Y, -150, 150 )
+      .relative( nite::JOINT_RIGHT_SHOULDER, nite::JOINT_RIGHT_HAND, CustomPoseEngine::AXIS_Y, -150, 150 );
+    
+    // 右手だけを上げる
+    customPose.addPose( "Right Hand Up" )
+      .relative( nite::JOINT_HEAD, nite::JOINT_RIGHT_HAND, CustomPoseEngine::AXIS_Y, 100, 1000 )
+      .relative( nite::JOINT_TORSO, nite::JOINT_LEFT_HAND, CustomPoseEngine::AXIS_Y, -1000, 0 );
+    
+    // 左手だけを上げる
+    customPose.addPose( "Left Hand Up" )
+      .relative( nite::JOINT_HEAD, nite::JOINT_LEFT_HAND, CustomPoseEngine::AXIS_Y, 100, 1000 )
+      .relative( nite::JOINT_TORSO, nite::JOINT_RIGHT_HAND, CustomPoseEngine::AXIS_Y, -1000, 0 );
+    
+    // 両手を胸の前で合わせる
+    customPose.addPose( "Hands Together" )
+      .distance( nite::JOINT_LEFT_HAND, nite::JOINT_RIGHT_HAND, 0, 150 )
+      .relative( nite::JOINT_TORSO, nite::JOINT_LEFT_HAND, CustomPoseEngine::AXIS_Z, -1000, -200 );
+    
+    // 条件テーブルを作成する
+    customPose.compile();
+  }
+  
   // ユーザーの検出
   cv::Mat drawUser( nite::UserTrackerFrameRef& userFrame )
   {
@@ -75,9 +143,9 @@ private:
     // Depth フレームを取得する
     openni::VideoFrameRef depthFrame = userFrame.getDepthFrame();
     if ( depthFrame.isValid() ) {
-      depthImage = cv::Mat( depthFrame.getHeight(),
-                           depthFrame.getWidth(),
-                           CV_8UC4 );
+      depthImage = arena.allocateMat( depthFrame.getHeight(),
+                                      depthFrame.getWidth(),
+                                      CV_8UC4 );
       
       // Depth データおよびユーザーインデックスを取得する
       openni::DepthPixel* depth = (openni::DepthPixel*)depthFrame.getData();
@@ -112,8 +180,13 @@ private:
   }
   
   // スケルトンの検出
-  void showSkeleton( cv::Mat& depthImage, nite::UserTracker& userTracker, const nite::UserData& user )
+  void showSkeleton( nite::UserTracker& userTracker, const nite::UserData& user )
   {
+    // 重ね描きしないときは、座標の変換もしない
+    if ( !overlay.isEnabled() ) {
+      return;
+    }
+    
     // スケルトンを取得し、追跡状態を確認する
     const nite::Skeleton& skeelton = user.getSkeleton();
     if ( skeelton.getState() != nite::SKELETON_TRACKED ) {
@@ -135,57 +208,86 @@ private:
                                                  position.x, position.y, position.z, &x, &y );
       
       // 円を表示する
-      cv::circle( depthImage, cvPoint( (int)x, (int)y ),
-                 5, cv::Scalar( 0, 0, 255 ), -1 );
+      overlay.addCircle( cv::Point( (int)x, (int)y ), 5, cv::Scalar( 0, 0, 255 ) );
     }
   }
   
   // ポーズの種類を文字列にする
-  std::string PoseToString( nite::PoseType type )
+  const char* PoseToString( nite::PoseType type )
   {
     if ( type == nite::POSE_CROSSED_HANDS ) {
-      return std::string( "Cross Hands" );
+      return "Cross Hands";
     }
     else if ( type == nite::POSE_PSI ) {
-      return std::string( "Psi" );
+      return "Psi";
     }
     
-    return std::string( "Unknown Pose" );
+    return "Unknown Pose";
   }
   
   // ポーズの描画
-  void showPose( cv::Mat& depthImage, const nite::UserData& user )
+  void showPose( const nite::UserData& user )
   {
+    // 重ね描きしないときは、文字列も作らない
+    if ( !overlay.isEnabled() ) {
+      return;
+    }
+    
     for ( int p = 0; p < 2; ++p ) {
       // ポーズの状態を取得する
       const nite::PoseData& pose = user.getPose( (nite::PoseType)p );
       
-      std::string message;
+      // 文字列はフレームの間だけ使うメモリに作る
+      ArenaString message( (ArenaAllocator<char>( arena )) );
       
       // ポーズ認識開始
       if ( pose.isEntered() ) {
-        message = PoseToString( pose.getType() ) + " is entered";
+        message.append( PoseToString( pose.getType() ) ).append( " is entered" );
       }
       // ポーズ認識中
       else if ( pose.isHeld() ) {
-        message = PoseToString( pose.getType() ) + " is held";
+        message.append( PoseToString( pose.getType() ) ).append( " is held" );
       }
       // ポーズ認識終了
       else if ( pose.isExited() ) {
-        message = PoseToString( pose.getType() ) + " is exited";
+        message.append( PoseToString( pose.getType() ) ).append( " is exited" );
       }
       
       // 状態を表示する
-      cv::putText( depthImage, message.c_str(), cv::Point( 0, 50 ),
-                  cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar( 255, 0, 0 ), 1 );
+      overlay.addText( message.c_str(), cv::Point( 0, 50 ), 1.0, cv::Scalar( 255, 0, 0 ) );
+    }
+    
+    // 独自ポーズの状態を表示する
+    for ( int p = 0; p < customPose.getPoseCount(); ++p ) {
+      const CustomPoseData& pose = customPose.getPose( user.getId(), p );
+      
+      ArenaString message( (ArenaAllocator<char>( arena )) );
+      
+      // ポーズ認識開始
+      if ( pose.isEntered() ) {
+        message.append( customPose.getPoseName( p ).c_str() ).append( " is entered" );
+      }
+      // ポーズ認識中
+      else if ( pose.isHeld() ) {
+        message.append( customPose.getPoseName( p ).c_str() ).append( " is held" );
+      }
+      // ポーズ認識終了
+      else if ( pose.isExited() ) {
+        message.append( customPose.getPoseName( p ).c_str() ).append( " is exited" );
+      }
+      
+      // 状態を表示する(NiTE のポーズの下に 1 行ずつ並べる)
+      overlay.addText( message.c_str(), cv::Point( 0, 90 + (p * 30) ), 0.8, cv::Scalar( 255, 0, 0 ) );
     }
   }
   
 private:
   
   nite::UserTracker userTracker;  // ユーザー検出
+  CustomPoseEngine customPose;    // 独自ポーズの認識
   
-  cv::Mat depthImage;             // 可視化した Depth データ
+  FrameArena arena;               // フレームの間だけ使うメモリ
+  OverlayRenderer overlay;        // 重ね描き(フレームの終わりにまとめて描く)
 };
 
 int main(int argc, const char * argv[])
@@ -206,6 +308,14 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // フレームの間だけ使うメモリの量を表示するかを切り替える
+      else if ( key == 'm' ) {
+        app.changeArenaDebug();
+      }
+      // スケルトンとポーズの重ね描きを切り替える
+      else if ( key == 'o' ) {
+        app.changeOverlay();
+      }
     }
   }
   catch ( std::exception& ) {
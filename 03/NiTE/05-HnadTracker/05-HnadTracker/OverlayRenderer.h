@@ -0,0 +1,218 @@
+#ifndef _OVERLAY_RENDERER_H_
+#define _OVERLAY_RENDERER_H_
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// 関節の円、軌跡の線、文字などの重ね描きを 1 フレーム分ためて、最後にまとめて描く
+//
+// 文字と塗りつぶした円は、形(マスク)を一度だけ描いてキャッシュし、
+// 以降のフレームではマスクを使って色を塗るだけにする(毎フレーム文字を描かない)。
+// 線は同じ色と太さが続く分を 1 回の cv::polylines で描く。
+// 命令をためる配列はフレーム間で使いまわすので、フレームごとにメモリを確保しない。
+// 無効にすると(表示しないとき)、命令の追加はすぐに戻り、何も描かない
+class OverlayRenderer
+{
+public:
+
+  OverlayRenderer()
+    : enabled( true )
+  {
+  }
+
+  // 重ね描きするかどうか
+  void setEnabled( bool enabled )
+  {
+    this->enabled = enabled;
+    clear();
+  }
+
+  bool isEnabled() const
+  {
+    return enabled;
+  }
+
+  // 塗りつぶした円
+  void addCircle( const cv::Point& center, int radius, const cv::Scalar& color )
+  {
+    if ( !enabled ) {
+      return;
+    }
+
+    Stamp stamp = { &getCircleSprite( radius ), center, color };
+    stamps.push_back( stamp );
+  }
+
+  // 線
+  void addLine( const cv::Point& start, const cv::Point& end, const cv::Scalar& color, int thickness )
+  {
+    if ( !enabled ) {
+      return;
+    }
+
+    Line line = { { start, end }, color, thickness };
+    lines.push_back( line );
+  }
+
+  // 文字(origin は cv::putText と同じく文字の左下)
+  void addText( const char* text, const cv::Point& origin, double fontScale,
+                const cv::Scalar& color, int thickness = 1 )
+  {
+    if ( !enabled || (text[0] == 0) ) {
+      return;
+    }
+
+    Stamp stamp = { &getTextSprite( text, fontScale, thickness ), origin, color };
+    stamps.push_back( stamp );
+  }
+
+  // ためた命令をまとめて描き、次のフレームのために空にする
+  void render( cv::Mat& image )
+  {
+    if ( !enabled || image.empty() ) {
+      clear();
+      return;
+    }
+
+    // 同じ色と太さが続く線は、まとめて 1 回で描く
+    for ( size_t begin = 0; begin < lines.size(); ) {
+      size_t end = begin + 1;
+      while ( (end < lines.size()) && (lines[end].color == lines[begin].color) &&
+              (lines[end].thickness == lines[begin].thickness) ) {
+        ++end;
+      }
+
+      points.clear();
+      counts.clear();
+      for ( size_t i = begin; i < end; ++i ) {
+        points.push_back( lines[i].points );
+        counts.push_back( 2 );
+      }
+      cv::polylines( image, &points[0], &counts[0], (int)(end - begin), false,
+                     lines[begin].color, lines[begin].thickness );
+      begin = end;
+    }
+
+    // 円と文字は、キャッシュしたマスクで色を塗る
+    for ( size_t i = 0; i < stamps.size(); ++i ) {
+      blit( image, *stamps[i].sprite, stamps[i].position, stamps[i].color );
+    }
+
+    clear();
+
+    // 表示する文字列はそれほど変わらないので、増えすぎたら捨てて作りなおす
+    // (命令がマスクを指しているので、描き終わってから捨てる)
+    if ( textSprites.size() >= 256 ) {
+      textSprites.clear();
+    }
+  }
+
+  // キャッシュしている文字と円の数
+  size_t getCachedCount() const
+  {
+    return textSprites.size() + circleSprites.size();
+  }
+
+private:
+
+  // 一度だけ描いた形(マスク)
+  struct Sprite
+  {
+    std::string text;     // 文字のときはその文字列(ハッシュの衝突を確かめる)
+    cv::Mat mask;         // 形(CV_8UC1)
+    cv::Point offset;     // 描く位置からマスクの左上まで
+  };
+
+  // 形を描く命令
+  struct Stamp
+  {
+    const Sprite* sprite;
+    cv::Point position;
+    cv::Scalar color;
+  };
+
+  // 線を描く命令
+  struct Line
+  {
+    cv::Point points[2];
+    cv::Scalar color;
+    int thickness;
+  };
+
+  void clear()
+  {
+    stamps.clear();
+    lines.clear();
+  }
+
+  const Sprite& getCircleSprite( int radius )
+  {
+    Sprite& sprite = circleSprites[radius];
+    if ( sprite.mask.empty() ) {
+      int size = (radius * 2) + 1;
+      sprite.mask = cv::Mat::zeros( size, size, CV_8UC1 );
+      cv::circle( sprite.mask, cv::Point( radius, radius ), radius, cv::Scalar( 255 ), -1 );
+      sprite.offset = cv::Point( -radius, -radius );
+    }
+
+    return sprite;
+  }
+
+  const Sprite& getTextSprite( const char* text, double fontScale, int thickness )
+  {
+    // 文字列と大きさのハッシュ(FNV-1a)で探す(見つかればメモリを確保しない)
+    unsigned long long key = 14695981039346656037ull;
+    for ( const char* c = text; *c != 0; ++c ) {
+      key = (key ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    key = (key ^ (unsigned long long)(fontScale * 100)) * 1099511628211ull;
+    key = (key ^ (unsigned long long)thickness) * 1099511628211ull;
+
+    std::unordered_map<unsigned long long, Sprite>::iterator it = textSprites.find( key );
+    if ( (it != textSprites.end()) && (std::strcmp( it->second.text.c_str(), text ) == 0) ) {
+      return it->second;
+    }
+
+    Sprite& sprite = textSprites[key];
+    sprite.text = text;
+
+    int baseline = 0;
+    cv::Size size = cv::getTextSize( sprite.text, cv::FONT_HERSHEY_SIMPLEX, fontScale, thickness, &baseline );
+    sprite.mask = cv::Mat::zeros( size.height + baseline + thickness, size.width + thickness, CV_8UC1 );
+    cv::putText( sprite.mask, sprite.text, cv::Point( 0, size.height ),
+                 cv::FONT_HERSHEY_SIMPLEX, fontScale, cv::Scalar( 255 ), thickness );
+    sprite.offset = cv::Point( 0, -size.height );
+    return sprite;
+  }
+
+  // マスクのある所を色で塗る(画像の外にはみ出す所は塗らない)
+  static void blit( cv::Mat& image, const Sprite& sprite, const cv::Point& position, const cv::Scalar& color )
+  {
+    cv::Rect rect( position + sprite.offset, sprite.mask.size() );
+    cv::Rect clipped = rect & cv::Rect( 0, 0, image.cols, image.rows );
+    if ( clipped.area() == 0 ) {
+      return;
+    }
+
+    cv::Rect maskRect( clipped.x - rect.x, clipped.y - rect.y, clipped.width, clipped.height );
+    image( clipped ).setTo( color, sprite.mask( maskRect ) );
+  }
+
+private:
+
+  bool enabled;                                   // 重ね描きするか
+
+  std::vector<Stamp> stamps;                      // 円と文字の命令
+  std::vector<Line> lines;                        // 線の命令
+  std::vector<const cv::Point*> points;           // まとめて描く線の座標
+  std::vector<int> counts;                        // まとめて描く線の点の数
+
+  std::unordered_map<int, Sprite> circleSprites;                  // 半径ごとの円
+  std::unordered_map<unsigned long long, Sprite> textSprites;     // 文字ごとのマスク
+};
+
+#endif
@@ -1,13 +1,22 @@
 #include <iostream>
-#include <list>
 
 #include <NiTE.h>
 #include <opencv2/opencv.hpp>
 
+#include "FrameArena.h"
+#include "OverlayRenderer.h"
+
 class GestureApp
 {
 public:
   
+  GestureApp()
+    : detectGesture( "" )
+    , handPointCount( 0 )
+    , handPointHead( 0 )
+  {
+  }
+  
   void initialize()
   {
     // ハンドトラッカーを作成する
@@ -24,16 +33,39 @@ public:
     nite::HandTrackerFrameRef handTrackerFrame;
     handTracker.readFrame( &handTrackerFrame );
     
-    // Depth データを可視化する
-    depthImage = showDepthStream( handTrackerFrame.getDepthFrame() );
+    // Depth データを可視化する(画像はフレームの間だけ使うメモリに作る)
+    cv::Mat depthImage = showDepthStream( handTrackerFrame.getDepthFrame() );
     
     // 検出したジェスチャーを表示する
-    showGesture( depthImage, handTrackerFrame );
+    showGesture( handTrackerFrame );
     
     // 手の追跡を表示する
-    showHandTracker( depthImage, handTrackerFrame );
+    showHandTracker( handTrackerFrame );
+    
+    // ためておいた重ね描きをまとめて描く
+    overlay.render( depthImage );
     
     cv::imshow( "Hand Tracker", depthImage );
+    
+    // フレームの間だけ使ったメモリをまとめて捨てる
+    arena.reset();
+  }
+  
+  // フレームの間だけ使うメモリの量を表示するかを切り替える
+  void changeArenaDebug()
+  {
+    arena.setDebug( !arena.isDebug() );
+    std::cout << "FrameArena debug : " << (arena.isDebug() ? "on" : "off")
+              << "  high water : " << arena.getHighWater() << " bytes"
+              << "  escaped : " << arena.getOverflowCount() << std::endl;
+  }
+  
+  // ジェスチャーと手の軌跡の重ね描きをするかを切り替える
+  void changeOverlay()
+  {
+    overlay.setEnabled( !overlay.isEnabled() );
+    std::cout << "Overlay : " << (overlay.isEnabled() ? "on" : "off")
+              << "  cached : " << overlay.getCachedCount() << std::endl;
   }
   
 private:
@@ -41,9 +73,9 @@ private:
   // Depth ストリームを表示できる形に変換する
   cv::Mat showDepthStream( const openni::VideoFrameRef& depthFrame )
   {
-    cv::Mat depthImage = cv::Mat( depthFrame.getHeight(),
-                                 depthFrame.getWidth(),
-                                 CV_8UC4 );
+    cv::Mat depthImage = arena.allocateMat( depthFrame.getHeight(),
+                                            depthFrame.getWidth(),
+                                            CV_8UC4 );
     
     openni::DepthPixel* depth = (openni::DepthPixel*)depthFrame.getData();
     for ( int i = 0; i < (depthFrame.getDataSize()/sizeof(openni::DepthPixel)); ++i ) {
@@ -65,7 +97,7 @@ private:
   }
   
   // 検出したジェスチャーを表示する
-  void showGesture( cv::Mat depthImage, const nite::HandTrackerFrameRef& handTrackerFrame )
+  void showGesture( const nite::HandTrackerFrameRef& handTrackerFrame )
   {
     // 認識したジェスチャー名を表示する
     const nite::Array<nite::GestureData>& gestures = handTrackerFrame.getGestures();
@@ -85,36 +117,41 @@ private:
     }
     
     // 検出したジェスチャーを表示する
-    cv::putText( depthImage, detectGesture.c_str(), cv::Point( 0, 50 ),
-                cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar( 255, 0, 0 ), 1 );
+    overlay.addText( detectGesture, cv::Point( 0, 50 ), 1.0, cv::Scalar( 255, 0, 0 ) );
   }
   
   // 手の追跡を表示する
-  void showHandTracker( cv::Mat depthImage, const nite::HandTrackerFrameRef& handTrackerFrame )
+  void showHandTracker( const nite::HandTrackerFrameRef& handTrackerFrame )
   {
     // 手を追跡していたら、その点を記録する(30点を保持する)
+    // 点は固定の大きさのリングバッファに入れ、古い点に上書きする(フレームごとに確保しない)
     const nite::Array<nite::HandData>& hands = handTrackerFrame.getHands();
     for (int i = 0; i < hands.getSize(); ++i) {
       if ( hands[i].isTracking() ) {
-        handPoints.push_back( hands[i].getPosition() );
-        if ( handPoints.size() > 30 ) {
-          handPoints.pop_front();
+        handPoints[(handPointHead + handPointCount) % HAND_POINT_MAX] = hands[i].getPosition();
+        if ( handPointCount < HAND_POINT_MAX ) {
+          ++handPointCount;
+        }
+        else {
+          handPointHead = (handPointHead + 1) % HAND_POINT_MAX;
         }
       }
     }
     
-    // 手の軌跡を表示する
-    for ( std::list<nite::Point3f>::iterator it = handPoints.begin(); it != handPoints.end();  ) {
-      // 線の開始位置を取得する
-      cv::Point start = convertHandCoordinatesToDepth( *it );
-      if ( ++it == handPoints.end() ) {
-        // 最後の点であれば終了
-        break;
-      }
-      
-      // 終点を取得して線を引く
-      cv::Point end = convertHandCoordinatesToDepth( *it );
-      cv::line( depthImage, start, end, cv::Scalar( 0, 255, 0 ), 3 );
+    // 重ね描きしないときは、座標の変換もしない
+    if ( !overlay.isEnabled() ) {
+      return;
+    }
+    
+    // 軌跡の 2 次元の座標は、フレームの間だけ使うメモリに作る
+    cv::Point* points = arena.allocate<cv::Point>( handPointCount );
+    for ( int i = 0; i < handPointCount; ++i ) {
+      points[i] = convertHandCoordinatesToDepth( handPoints[(handPointHead + i) % HAND_POINT_MAX] );
+    }
+    
+    // 手の軌跡を表示する(同じ色と太さの線は、まとめて 1 回で描かれる)
+    for ( int i = 1; i < handPointCount; ++i ) {
+      overlay.addLine( points[i - 1], points[i], cv::Scalar( 0, 255, 0 ), 3 );
     }
   }
   
@@ -130,10 +167,15 @@ private:
   
   nite::HandTracker handTracker;        // 手の追跡
   
-  cv::Mat depthImage;                   // Depth データを可視化したもの
-  std::string detectGesture;            // 検出したジェスチャー
+  const char* detectGesture;            // 検出したジェスチャー
+  
+  static const int HAND_POINT_MAX = 30;
+  nite::Point3f handPoints[HAND_POINT_MAX]; // 手の軌跡(リングバッファ)
+  int handPointCount;                   // 記録した点の数
+  int handPointHead;                    // 一番古い点の位置
   
-  std::list<nite::Point3f> handPoints;  // 手の軌跡
+  FrameArena arena;                     // フレームの間だけ使うメモリ
+  OverlayRenderer overlay;              // 重ね描き(フレームの終わりにまとめて描く)
 };
 
 int main(int argc, const char * argv[])
@@ -154,6 +196,14 @@ int main(int argc, const char * argv[])
       if ( key == 'q' ) {
         break;
       }
+      // フレームの間だけ使うメモリの量を表示するかを切り替える
+      else if ( key == 'm' ) {
+        app.changeArenaDebug();
+      }
+      // ジェスチャーと手の軌跡の重ね描きを切り替える
+      else if ( key == 'o' ) {
+        app.changeOverlay();
+      }
     }
   }
   catch ( std::exception& ) {
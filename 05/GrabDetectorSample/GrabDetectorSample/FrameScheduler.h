@@ -0,0 +1,170 @@
+#ifndef _FRAME_SCHEDULER_H_
+#define _FRAME_SCHEDULER_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2\opencv.hpp>
+
+// t[Ƃ̏(Xe[W)AڕW̎spxƗDxAc莞ԂԈ
+//
+// eXe[W̏ԂvĂAt[̎c莞ԂŏȂꍇ
+// Dx̒ႢXe[WsBc莞Ԃ肸Ɍ肪Xe[ẂA
+// Œ̕pxۂ߂Ɏc莞ԂɊ֌WȂs
+// (ڕW̎spx̂߂̌́Ả񐔂ɂׂɂ錩̐ɂ܂߂Ȃ)
+class FrameScheduler
+{
+public:
+
+  // Xe[W̗Dx
+  enum Priority {
+    PRIORITY_REQUIRED,    // Ks
+    PRIORITY_HIGH,        // c莞ԂɎ܂Ύs
+    PRIORITY_NORMAL,      // c莞Ԃ 3/4 Ɏ܂Ύs
+    PRIORITY_LOW,         // c莞Ԃ 1/2 Ɏ܂Ύs
+  };
+
+  // frameBudget : 1 t[ŏɎg鎞(ms)
+  FrameScheduler( double frameBudget )
+    : frameBudget( frameBudget )
+    , frameStart( 0 )
+    , frameCount( 0 )
+  {
+  }
+
+  // Xe[Wo^
+  // targetRate : ڕW̎spx(/bA0 Ȃ疈t[)
+  // maxSkip    : c莞ԂȂĂẢ񐔑Čs
+  int addStage( const std::string& name, double targetRate, Priority priority, int maxSkip = 30 )
+  {
+    Stage stage;
+    stage.name = name;
+    stage.interval = (targetRate > 0) ? (cv::getTickFrequency() / targetRate) : 0;
+    stage.priority = priority;
+    stage.maxSkip = maxSkip;
+    stages.push_back( stage );
+    return (int)stages.size() - 1;
+  }
+
+  // t[̏Jn
+  void beginFrame()
+  {
+    frameStart = cv::getTickCount();
+    ++frameCount;
+  }
+
+  // Xe[Ws邩ǂ𔻒fAsꍇ͌vJn
+  bool begin( int index )
+  {
+    Stage& stage = stages[index];
+    int64 now = cv::getTickCount();
+
+    Decision decision = decide( stage, now );
+    if ( decision == SKIP_RATE ) {
+      ++stage.rateSkipCount;
+      return false;
+    }
+    if ( decision == SKIP_BUDGET ) {
+      ++stage.skipped;
+      ++stage.skipCount;
+      return false;
+    }
+
+    stage.skipped = 0;
+    stage.start = now;
+    stage.lastRun = now;
+    return true;
+  }
+
+  // Xe[W̏IAԂL^
+  void end( int index )
+  {
+    Stage& stage = stages[index];
+    double cost = toMilliseconds( cv::getTickCount() - stage.start );
+
+    // Ԃ͎wړςŕ
+    stage.cost = (stage.runCount == 0) ? cost : ((stage.cost * 0.9) + (cost * 0.1));
+    ++stage.runCount;
+  }
+
+  // Xe[WƂ̎s󋵂\
+  void printStats( std::ostream& out ) const
+  {
+    out << "frames : " << frameCount << std::endl;
+    for ( size_t i = 0; i < stages.size(); ++i ) {
+      const Stage& stage = stages[i];
+      out << " " << stage.name << " : cost " << stage.cost << " ms"
+          << ", run " << stage.runCount << ", skip " << stage.skipCount
+          << " (rate " << stage.rateSkipCount << ")" << std::endl;
+    }
+  }
+
+private:
+
+  struct Stage
+  {
+    Stage()
+      : interval( 0 ), priority( PRIORITY_REQUIRED ), maxSkip( 0 )
+      , cost( 0 ), start( 0 ), lastRun( 0 ), skipped( 0 ), runCount( 0 ), skipCount( 0 )
+      , rateSkipCount( 0 )
+    {
+    }
+
+    std::string name;     // Xe[W
+    double interval;      // sԊu(tick)
+    Priority priority;    // Dx
+    int maxSkip;          // Čő̉
+
+    double cost;          // (msAwړ)
+    int64 start;          // ̊Jn
+    int64 lastRun;        // ŌɎs
+    int skipped;          // c莞Ԃ肸ɑČ
+    int runCount;         // s
+    int skipCount;        // c莞Ԃ肸Ɍ
+    int rateSkipCount;    // ڕW̎spx̂߂Ɍ
+  };
+
+  // s邩ǂƁA闝R
+  enum Decision {
+    RUN,                  // s
+    SKIP_RATE,            // ڕW̎spx葁̂Ō
+    SKIP_BUDGET,          // c莞ԂȂ̂Ō
+  };
+
+  Decision decide( const Stage& stage, int64 now ) const
+  {
+    if ( stage.priority == PRIORITY_REQUIRED ) {
+      return RUN;
+    }
+
+    // ڕW̎spx葁Ό
+    if ( (stage.lastRun != 0) && ((now - stage.lastRun) < stage.interval) ) {
+      return SKIP_RATE;
+    }
+
+    // c莞Ԃ肸Ɍ肪Ăꍇ́AŒ̕pxۂ߂Ɏs
+    if ( stage.skipped >= stage.maxSkip ) {
+      return RUN;
+    }
+
+    // c莞Ԃ̂ADxɉɎ܂Ύs
+    static const double allowance[] = { 1.0, 1.0, 0.75, 0.5 };
+    double remaining = frameBudget - toMilliseconds( now - frameStart );
+    return (stage.cost <= (remaining * allowance[stage.priority])) ? RUN : SKIP_BUDGET;
+  }
+
+  static double toMilliseconds( int64 ticks )
+  {
+    return ticks * 1000.0 / cv::getTickFrequency();
+  }
+
+private:
+
+  std::vector<Stage> stages;  // o^Xe[W
+  double frameBudget;         // 1 t[ŏɎg鎞(ms)
+  int64 frameStart;           // t[̏̊Jn
+  int frameCount;             // t[
+};
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef _GRAB_DETECTOR_SERVICE_H_
+#define _GRAB_DETECTOR_SERVICE_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <OpenNI.h>
+#include <NiTE.h>
+#include <opencv2\opencv.hpp>
+
+#include "GrabDetector.h"
+
+// 育Ƃ GrabDetector 蓖āA[J[XbhŔ񓯊Ɍo
+//
+// GrabDetector ͎̈ʒu 1 ĂȂ̂ŁA育Ƃ 1 pӂB
+// ̒ǐՂI GrabDetector ̓Zbgăv[ɖ߂A̎Ŏg܂킷B
+// t[͎育ƂɍŐV 1 gێAǂȂꍇ
+// Ât[̂Ă(̂Ă͓vɎc)
+class GrabDetectorService
+{
+public:
+
+  // o
+  struct GrabEvent
+  {
+    nite::HandId handId;
+    PSLabs::IGrabEventListener::GrabEventType type;
+    double latency;       // t[nĂ猟oI܂ł̎(ms)
+  };
+
+  // 育Ƃ̏Ԃ̓v
+  struct LatencyStats
+  {
+    LatencyStats()
+      : count( 0 ), total( 0 ), maxLatency( 0 ), dropped( 0 )
+    {
+    }
+
+    double getAverage() const
+    {
+      return (count != 0) ? (total / count) : 0;
+    }
+
+    int count;            // t[
+    double total;         // Ԃ̍v(ms)
+    double maxLatency;    // ő̏(ms)
+    int dropped;          // ǂɎ̂Ăt[
+  };
+
+  GrabDetectorService( openni::Device& device, int workerCount = 2 )
+    : device( device )
+    , exiting( false )
+  {
+    for ( int i = 0; i < workerCount; ++i ) {
+      workers.push_back( std::thread( &GrabDetectorService::run, this ) );
+    }
+  }
+
+  ~GrabDetectorService()
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      exiting = true;
+    }
+    wakeup.notify_all();
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+      workers[i].join();
+    }
+
+    // GrabDetector 
+    for ( std::map<nite::HandId, Slot*>::iterator it = slots.begin(); it != slots.end(); ++it ) {
+      pool.push_back( it->second );
+    }
+    for ( size_t i = 0; i < pool.size(); ++i ) {
+      if ( pool[i]->detector != 0 ) {
+        PSLabs::ReleaseGrabDetector( pool[i]->detector );
+      }
+      delete pool[i];
+    }
+  }
+
+  // ̈ʒuƃt[n(̓[J[Xbhōs)
+  void submit( nite::HandId handId, const nite::Point3f& position,
+               const openni::VideoFrameRef& depthFrame, const openni::VideoFrameRef& colorFrame )
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      Slot* slot = getSlot( handId );
+
+      // Õt[܂ĂȂ΁AVt[Œu
+      if ( slot->pending ) {
+        ++slot->stats.dropped;
+      }
+      else if ( !slot->busy ) {
+        ready.push_back( slot );
+      }
+
+      slot->pending = true;
+      slot->position = position;
+      slot->depthFrame = depthFrame;
+      slot->colorFrame = colorFrame;
+      slot->submitted = cv::getTickCount();
+    }
+    wakeup.notify_one();
+  }
+
+  // ǐՂ̏I GrabDetector v[ɖ߂
+  void remove( nite::HandId handId )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    std::map<nite::HandId, Slot*>::iterator it = slots.find( handId );
+    if ( it == slots.end() ) {
+      return;
+    }
+
+    Slot* slot = it->second;
+    slots.erase( it );
+
+    // ҂̃t[͎̂Ă
+    if ( slot->pending ) {
+      slot->pending = false;
+      ready.erase( std::remove( ready.begin(), ready.end(), slot ), ready.end() );
+      slot->depthFrame.release();
+      slot->colorFrame.release();
+    }
+
+    // ł΁AI[J[Xbhv[ɖ߂
+    slot->removed = true;
+    if ( !slot->busy ) {
+      recycle( slot );
+    }
+  }
+
+  // oʂo(ʂȂ false)
+  bool pollEvent( GrabEvent* event )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    if ( events.empty() ) {
+      return false;
+    }
+
+    *event = events.front();
+    events.pop_front();
+    return true;
+  }
+
+  // 育Ƃ̏Ԃ̓v
+  LatencyStats getStats( nite::HandId handId )
+  {
+    std::lock_guard<std::mutex> lock( mutex );
+    std::map<nite::HandId, Slot*>::iterator it = slots.find( handId );
+    return (it != slots.end()) ? it->second->stats : LatencyStats();
+  }
+
+private:
+
+  // 1  GrabDetector ƁA蓖Ă̏
+  class Slot : public PSLabs::IGrabEventListener
+  {
+  public:
+
+    Slot( GrabDetectorService& service )
+      : service( service )
+      , detector( 0 )
+      , handId( 0 )
+      , pending( false )
+      , busy( false )
+      , removed( false )
+      , submitted( 0 )
+      , processing( 0 )
+    {
+    }
+
+    // z֐NXpĂ̂ŁAfXgN^zɂ
+    virtual ~Slot()
+    {
+    }
+
+    // GrabEvent ̒ʒm(UpdateFrame() ̒ŁA[J[XbhĂ΂)
+    void DLL_CALL ProcessGrabEvent( const EventParams& params )
+    {
+      GrabEvent event;
+      event.handId = handId;
+      event.type = params.Type;
+      event.latency = (cv::getTickCount() - processing) * 1000.0 / cv::getTickFrequency();
+
+      std::lock_guard<std::mutex> lock( service.mutex );
+      service.events.push_back( event );
+    }
+
+    GrabDetectorService& service;
+    PSLabs::IGrabDetector* detector;
+
+    nite::HandId handId;                // 蓖Ă
+    bool pending;                       // ҂̃t[邩
+    bool busy;                          // [J[Xbh
+    bool removed;                       // ̒ǐՂI
+
+    nite::Point3f position;             // ̈ʒu
+    openni::VideoFrameRef depthFrame;   // ҂ Depth t[
+    openni::VideoFrameRef colorFrame;   // ҂̃J[t[
+    int64 submitted;                    // t[󂯎
+    int64 processing;                   // ̃t[󂯎
+
+    LatencyStats stats;                 // Ԃ̓v
+  };
+
+  // Ɋ蓖Ă GrabDetector 擾(Ȃ΃v[犄蓖Ă)
+  Slot* getSlot( nite::HandId handId )
+  {
+    std::map<nite::HandId, Slot*>::iterator it = slots.find( handId );
+    if ( it != slots.end() ) {
+      return it->second;
+    }
+
+    Slot* slot = 0;
+    if ( !pool.empty() ) {
+      slot = pool.back();
+      pool.pop_back();
+    }
+    else {
+      slot = new Slot( *this );
+    }
+
+    slot->handId = handId;
+    slot->removed = false;
+    slot->stats = LatencyStats();
+    slots[handId] = slot;
+    return slot;
+  }
+
+  // GrabDetector Zbgăv[ɖ߂
+  void recycle( Slot* slot )
+  {
+    if ( slot->detector != 0 ) {
+      slot->detector->Reset();
+    }
+
+    pool.push_back( slot );
+  }
+
+  // [J[Xbh
+  void run()
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( true ) {
+      while ( !exiting && ready.empty() ) {
+        wakeup.wait( lock );
+      }
+
+      if ( exiting ) {
+        return;
+      }
+
+      // ҂̃t[o
+      Slot* slot = ready.front();
+      ready.pop_front();
+
+      slot->pending = false;
+      slot->busy = true;
+      nite::Point3f position = slot->position;
+      openni::VideoFrameRef depthFrame = slot->depthFrame;
+      openni::VideoFrameRef colorFrame = slot->colorFrame;
+      slot->depthFrame.release();
+      slot->colorFrame.release();
+      slot->processing = slot->submitted;
+
+      lock.unlock();
+
+      // GrabDetector ͏߂ĎgƂɍ쐬
+      if ( slot->detector == 0 ) {
+        std::lock_guard<std::mutex> createLock( createMutex );
+        slot->detector = PSLabs::CreateGrabDetector( device );
+        if ( slot->detector != 0 ) {
+          slot->detector->AddListener( slot );
+        }
+      }
+
+      // ̈ʒuƃt[nČo
+      if ( slot->detector != 0 ) {
+        slot->detector->SetHandPosition( position.x, position.y, position.z );
+        slot->detector->UpdateFrame( depthFrame, colorFrame );
+      }
+
+      double latency = (cv::getTickCount() - slot->processing) * 1000.0 / cv::getTickFrequency();
+
+      lock.lock();
+
+      slot->busy = false;
+      ++slot->stats.count;
+      slot->stats.total += latency;
+      slot->stats.maxLatency = (std::max)( slot->stats.maxLatency, latency );
+
+      // Ɏ̒ǐՂIĂ΁Av[ɖ߂
+      if ( slot->removed ) {
+        recycle( slot );
+      }
+      // Ɏ̃t[͂Ă΁Aď
+      else if ( slot->pending ) {
+        ready.push_back( slot );
+        wakeup.notify_one();
+      }
+    }
+  }
+
+private:
+
+  openni::Device& device;
+
+  std::vector<std::thread> workers;           // [J[Xbh
+  std::mutex mutex;
+  std::mutex createMutex;                     // GrabDetector ̍쐬̔r
+  std::condition_variable wakeup;             // ҂̃t[̒ʒm
+  bool exiting;                               // I邩ǂ
+
+  std::map<nite::HandId, Slot*> slots;        // Ɋ蓖Ă GrabDetector
+  std::vector<Slot*> pool;                    // 󂢂Ă GrabDetector
+  std::deque<Slot*> ready;                    // ҂̃t[
+  std::deque<GrabEvent> events;               // o
+};
+
+#endif
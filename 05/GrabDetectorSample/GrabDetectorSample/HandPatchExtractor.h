@@ -0,0 +1,159 @@
+#ifndef _HAND_PATCH_EXTRACTOR_H_
+#define _HAND_PATCH_EXTRACTOR_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <OpenNI.h>
+#include <NiTE.h>
+#include <opencv2\opencv.hpp>
+
+// ̈ʒu𒆐SɁADepth f[^܂傫Ő؂o
+//
+// ؂o͈͎͂Ԃł̑傫(ň 300mm)ɂA
+// 肪Ă߂Ă傫( 64x64)̉摜ɂȂ悤ɂB
+// ͎̒S 128 ƂAO depthRange(mm)  1-255 ɐKB
+// S̉摜 1 ̘Aobt@ɏcɕׁAt[ԂŎg܂킷
+class HandPatchExtractor
+{
+public:
+
+  HandPatchExtractor( int patchSize = 64, float patchMillimeters = 300, float depthRange = 150 )
+    : patchSize( patchSize )
+    , patchMillimeters( patchMillimeters )
+    , depthRange( depthRange )
+    , focalLength( 0 )
+    , count( 0 )
+  {
+  }
+
+  // 1 t[̐؂oJn
+  void begin( const openni::VideoFrameRef& depthFrame, float horizontalFov )
+  {
+    this->depthFrame = depthFrame;
+    count = 0;
+
+    // pœ_(sNZ)߂
+    focalLength = (depthFrame.getWidth() / 2.0f) / std::tan( horizontalFov / 2.0f );
+  }
+
+  // ̈ʒu(Depth WƋ)𒆐Sɐ؂o
+  void add( nite::HandId id, const cv::Point& center, float z )
+  {
+    if ( !depthFrame.isValid() || (z <= 0) ) {
+      return;
+    }
+
+    // obt@Ȃ΍L(g͎̃t[łg܂킷)
+    if ( pool.rows < ((count + 1) * patchSize) ) {
+      cv::Mat grown( (count + 1) * patchSize, patchSize, CV_8UC1 );
+      if ( count != 0 ) {
+        cv::Mat used = grown.rowRange( 0, count * patchSize );
+        pool.rowRange( 0, count * patchSize ).copyTo( used );
+      }
+      pool = grown;
+    }
+
+    // Ԃň̑傫ɂȂ悤A؂osNZ߂
+    float window = (focalLength * patchMillimeters) / z;
+    float step = window / patchSize;
+    float left = center.x - (window / 2);
+    float top = center.y - (window / 2);
+
+    // ̃Tvʒu͑SsŋʂȂ̂ŁAɋ߂Ă
+    int width = depthFrame.getWidth();
+    int height = depthFrame.getHeight();
+    columns.resize( patchSize );
+    for ( int x = 0; x < patchSize; ++x ) {
+      columns[x] = (int)(left + (x * step));
+    }
+
+    const openni::DepthPixel* depth = (const openni::DepthPixel*)depthFrame.getData();
+    float scale = 127.0f / depthRange;
+    for ( int y = 0; y < patchSize; ++y ) {
+      uchar* dst = pool.ptr( (count * patchSize) + y );
+      int sy = (int)(top + (y * step));
+      if ( (sy < 0) || (sy >= height) ) {
+        std::fill( dst, dst + patchSize, 0 );
+        continue;
+      }
+
+      const openni::DepthPixel* row = &depth[sy * width];
+      for ( int x = 0; x < patchSize; ++x ) {
+        int sx = columns[x];
+        int d = ((sx < 0) || (sx >= width)) ? 0 : row[sx];
+
+        // ̂ȂsNZ 0AȊO͎̒S̑O 1-255 ɂ
+        int value = (int)(128 + ((d - z) * scale));
+        dst[x] = (d == 0) ? 0 : (uchar)(std::min)( (std::max)( value, 1 ), 255 );
+      }
+    }
+
+    if ( (int)hands.size() <= count ) {
+      hands.resize( count + 1 );
+    }
+    hands[count].id = id;
+    hands[count].center = center;
+    hands[count].z = z;
+    ++count;
+  }
+
+  // ؂o̐
+  int getCount() const
+  {
+    return count;
+  }
+
+  // S̐؂o摜(getCount() cɕׂA摜)
+  cv::Mat getBatch() const
+  {
+    return pool.rowRange( 0, count * patchSize );
+  }
+
+  // index Ԗڂ̎̐؂o摜(obt@̂܂܎QƂ)
+  cv::Mat getPatch( int index ) const
+  {
+    return pool.rowRange( index * patchSize, (index + 1) * patchSize );
+  }
+
+  // index Ԗڂ̎ ID
+  nite::HandId getHandId( int index ) const
+  {
+    return hands[index].id;
+  }
+
+  // index Ԗڂ̎̒S(Depth W)
+  const cv::Point& getCenter( int index ) const
+  {
+    return hands[index].center;
+  }
+
+  int getPatchSize() const
+  {
+    return patchSize;
+  }
+
+private:
+
+  // ؂ȍ
+  struct Hand
+  {
+    nite::HandId id;
+    cv::Point center;
+    float z;
+  };
+
+  int patchSize;                    // ؂o摜̑傫(sNZ)
+  float patchMillimeters;           // ؂o͈͂̎Ԃł̑傫(mm)
+  float depthRange;                 // KŐ(mm)
+  float focalLength;                // Depth J̏œ_(sNZ)
+
+  openni::VideoFrameRef depthFrame; // ؂õt[
+  cv::Mat pool;                     // ؂o摜̃obt@
+  std::vector<int> columns;         // ̃Tvʒu
+  std::vector<Hand> hands;          // ؂ȍ
+  int count;                        // ؂o̐
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 摜̍s(oh)ɕāÃXbhŏ邽߂̃Xbhv[
+//
+// Xbh͍ŏɍ̂g܂킵A1  parallelFor() Ƃ
+// NɂĂBeXbh(ĂяõXbh܂)
+// ĂȂoh 1 ɂ̂ŁAIXbh
+// c̃oh󂯂邱ƂɂȂB
+// oh́u(parallelFor() ̌Ăяo)ƃoh̔ԍv 1  64 rbg̒lŎ荇̂ŁA
+// ǑĂяõoȟĂяoŎĂ܂Ƃ͂ȂB
+// parallelFor() ́AQXbhׂď𔲂܂Ŗ߂Ȃ
+class ThreadPool
+{
+public:
+
+  // oh̏(begin sڂ end sڂ̎O܂)
+  typedef std::function<void( int begin, int end )> BandFunction;
+
+  explicit ThreadPool( int threadCount = 0 )
+    : activeThreads( 0 )
+    , body( 0 )
+    , generation( 0 )
+    , bandCount( 0 )
+    , bandRows( 1 )
+    , rows( 0 )
+    , nextBand( 0 )
+    , finished( 0 )
+    , busy( 0 )
+    , exiting( false )
+  {
+    // w肪Ȃ CPU ̃RAg(ĂяõXbh)
+    if ( threadCount <= 0 ) {
+      threadCount = (std::max)( (int)std::thread::hardware_concurrency(), 1 );
+    }
+
+    for ( int i = 1; i < threadCount; ++i ) {
+      workers.push_back( std::thread( &ThreadPool::run, this, i ) );
+    }
+
+    activeThreads = threadCount;
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      exiting = true;
+    }
+    wakeup.notify_all();
+
+    for ( size_t i = 0; i < workers.size(); ++i ) {
+      workers[i].join();
+    }
+  }
+
+  // gXbh̐(ĂяõXbh܂)
+  int getThreadCount() const
+  {
+    return (int)workers.size() + 1;
+  }
+
+  // ɎQXbh̐𐧌(\̌vp)
+  void setActiveThreads( int count )
+  {
+    activeThreads = (std::min)( (std::max)( count, 1 ), getThreadCount() );
+  }
+
+  int getActiveThreads() const
+  {
+    return activeThreads;
+  }
+
+  // 1 s̃oCgALbVɎ܂oh̍s߂
+  static int getBandRows( int bytesPerRow, int cacheBytes = 64 * 1024 )
+  {
+    return (std::max)( cacheBytes / (std::max)( bytesPerRow, 1 ), 1 );
+  }
+
+  // rows s bandRows s̃ohɕāAɏ
+  void parallelFor( int rows, int bandRows, const BandFunction& body )
+  {
+    int bands = (rows + bandRows - 1) / bandRows;
+
+    // 1 Xbh܂̓oh 1 ȂAĂяõXbhŏ
+    if ( (activeThreads <= 1) || (bands <= 1) ) {
+      body( 0, rows );
+      return;
+    }
+
+    // ݒ͎QĂXbhȂƂɕς
+    // (ǑĂяoIĂNXbhA܂cĂ邱ƂB
+    //  Xbh̓bNĂN̂ŁAŐݒ肵l)
+    unsigned int current;
+    {
+      std::unique_lock<std::mutex> lock( mutex );
+      while ( busy > 0 ) {
+        done.wait( lock );
+      }
+
+      current = ++generation;
+      finished = 0;
+      this->body = &body;
+      this->rows = rows;
+      this->bandRows = bandRows;
+      bandCount = bands;
+      nextBand = (unsigned long long)current << 32;
+    }
+    wakeup.notify_all();
+
+    // ĂяõXbhoh
+    int count = processBands( current );
+
+    // ׂẴohIAQXbhׂĔ̂҂
+    // (܂ body ĂłXbh邤ɖ߂ƁAbody ɏĂ܂)
+    std::unique_lock<std::mutex> lock( mutex );
+    finished += count;
+    while ( (finished < bandCount) || (busy > 0) ) {
+      done.wait( lock );
+    }
+    this->body = 0;
+  }
+
+private:
+
+  void run( int index )
+  {
+    unsigned int seen = 0;
+    while ( true ) {
+      {
+        std::unique_lock<std::mutex> lock( mutex );
+        while ( !exiting && (generation == seen) ) {
+          wakeup.wait( lock );
+        }
+
+        if ( exiting ) {
+          return;
+        }
+
+        seen = generation;
+
+        // QȂXbh͎̏҂
+        if ( index >= activeThreads ) {
+          continue;
+        }
+
+        // QXbh𐔂(܂ parallelFor() ͖߂Ȃ)
+        ++busy;
+      }
+
+      int count = processBands( seen );
+
+      std::lock_guard<std::mutex> lock( mutex );
+      finished += count;
+      --busy;
+      if ( (finished >= bandCount) && (busy == 0) ) {
+        done.notify_one();
+      }
+    }
+  }
+
+  //  current ̏ĂȂohoďAԂ
+  int processBands( unsigned int current )
+  {
+    int count = 0;
+    unsigned long long claim = nextBand.load();
+    while ( true ) {
+      // オႦ΁ǍĂяõoh͂cĂȂ
+      if ( (unsigned int)(claim >> 32) != current ) {
+        break;
+      }
+
+      int band = (int)(claim & 0xffffffffull);
+      if ( band >= bandCount ) {
+        break;
+      }
+
+      // ƃoh̔ԍ܂Ƃ߂Ď(ق̃XbhɎꂽȂ)
+      if ( !nextBand.compare_exchange_weak( claim, claim + 1 ) ) {
+        continue;
+      }
+
+      int begin = band * bandRows;
+      (*body)( begin, (std::min)( begin + bandRows, rows ) );
+      ++count;
+      claim = nextBand.load();
+    }
+
+    return count;
+  }
+
+private:
+
+  std::vector<std::thread> workers;       // Xbh
+  std::atomic<int> activeThreads;         // ɎQXbh̐
+
+  std::mutex mutex;
+  std::condition_variable wakeup;         // ̊Jn̒ʒm
+  std::condition_variable done;           // ̏I̒ʒm
+
+  // ȉ 4 ́AQXbhȂƂ mutex ̒Őݒ肷
+  const BandFunction* body;               // oh̏
+  unsigned int generation;                // parallelFor() ̌Ăяo()
+  int bandCount;                          // oh̐
+  int bandRows;                           // 1 oh̍s
+  int rows;                               // Ŝ̍s
+
+  std::atomic<unsigned long long> nextBand; // ɏoh( 32 rbg)
+  int finished;                           // ̏Ioh̐
+  int busy;                               // ĂXbh̐(Ăяo)
+  bool exiting;                           // I邩ǂ
+};
+
+#endif
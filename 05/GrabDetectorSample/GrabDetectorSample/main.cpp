@@ -3,14 +3,33 @@
 
 #include <OpenNI.h>
 #include <NiTE.h>
-#include "GrabDetector.h"
+#include "FrameScheduler.h"
+#include "GrabDetectorService.h"
+#include "HandPatchExtractor.h"
+#include "ThreadPool.h"
 
 #include <opencv2\opencv.hpp>
 
-class GrabDetectorSample : PSLabs::IGrabEventListener
+class GrabDetectorSample
 {
 public:
 
+  GrabDetectorSample()
+    : grabDetector( 0 )
+    , mirror( true )
+    , scheduler( (1000.0 / 30) - 10 )   // cv::waitKey( 10 ) ̕
+  {
+    // d́ACPU ɗ]TȂΗDx̒Ⴂ̂Ԉ
+    grabStage = scheduler.addStage( "grab", 0, FrameScheduler::PRIORITY_HIGH );
+    patchStage = scheduler.addStage( "patch", 15, FrameScheduler::PRIORITY_NORMAL );
+    drawStage = scheduler.addStage( "draw", 15, FrameScheduler::PRIORITY_LOW );
+  }
+
+  ~GrabDetectorSample()
+  {
+    delete grabDetector;
+  }
+
   // 
   void initialize()
   {
@@ -88,7 +107,8 @@ public:
       throw std::runtime_error( "stream.setVideoMode" );
     }
 
-    stream.setMirroringEnabled(true);
+    // E̔]̓Xg[ł͍s킸A\̕ϊōs
+    // (Grab Detector ̒ǐՂɂ́A]ĂȂf[^n)
   }
 
   // NiTE ̏
@@ -113,12 +133,8 @@ public:
   // Grab Detector ̏
   void initGrabDetector()
   {
-    grabDetector = PSLabs::CreateGrabDetector( device );
-    if ( grabDetector == 0 ) {
-      throw std::runtime_error( "PSLabs::CreateGrabDetector" );
-    }
-
-    grabDetector->AddListener( this );
+    // 育Ƃ GrabDetector ́AoƂɃ[J[Xbhō쐬
+    grabDetector = new GrabDetectorService( device );
   }
 
   // C[v
@@ -134,10 +150,12 @@ public:
         continue;
       }
 
+      // t[̏Ԃ̌vJn
+      scheduler.beginFrame();
+
       // depth  color t[擾
       openni::VideoFrameRef depthFrame;
       depthStream.readFrame( &depthFrame );
-      depthImage = convertDepthToColor( depthFrame );
 
       openni::VideoFrameRef colorFrame;
       colorStream.readFrame( &colorFrame );
@@ -156,25 +174,77 @@ public:
         }
       }
 
-      // ǐՂĂAGrabDetectorɃt[̃f[^n
       const nite::Array<nite::HandData>& hands = handTrackerFrame.getHands();
-      for (int i = 0; i < hands.getSize(); ++i) {
-        if ( hands[i].isTracking() ) {
-          auto position = hands[i].getPosition();
-          cv::circle( depthImage, convertHandCoordinatesToDepth( position ),
-            2, cv::Scalar( 0, 255, 0 ), 3 );
-
-          grabDetector->SetHandPosition( position.x, position.y, position.z );
-          grabDetector->UpdateFrame( depthFrame, colorFrame );
+
+      // ǐՂĂAGrabDetectorɃt[̃f[^n
+      if ( scheduler.begin( grabStage ) ) {
+        for ( int i = 0; i < hands.getSize(); ++i ) {
+          if ( hands[i].isTracking() ) {
+            // 育Ƃ GrabDetector Ƀt[n(o͔񓯊ɍs)
+            grabDetector->submit( hands[i].getId(), hands[i].getPosition(),
+                                  depthFrame, colorFrame );
+          }
+        }
+        scheduler.end( grabStage );
+      }
+
+      // ǐՂ̏I GrabDetector (ԈȂ)
+      for ( int i = 0; i < hands.getSize(); ++i ) {
+        if ( hands[i].isLost() ) {
+          grabDetector->remove( hands[i].getId() );
         }
       }
 
-      cv::imshow( "Grab Detector Sample", depthImage );
+      // oʂ\
+      showGrabEvents();
+
+      // ̎ Depth f[^؂oĕ\
+      if ( scheduler.begin( patchStage ) ) {
+        handPatches.begin( depthFrame, depthStream.getHorizontalFieldOfView() );
+        for ( int i = 0; i < hands.getSize(); ++i ) {
+          if ( hands[i].isTracking() ) {
+            auto position = hands[i].getPosition();
+            handPatches.add( hands[i].getId(),
+                             convertHandCoordinatesToDepth( position ), position.z );
+          }
+        }
+
+        if ( handPatches.getCount() != 0 ) {
+          cv::imshow( "Hand Patches", handPatches.getBatch() );
+        }
+        scheduler.end( patchStage );
+      }
+
+      // Depth ̉摜Ǝ̈ʒu\(ԈƂ͑Ỏ摜̂܂)
+      if ( scheduler.begin( drawStage ) ) {
+        depthImage = convertDepthToColor( depthFrame, mirror );
+        for ( int i = 0; i < hands.getSize(); ++i ) {
+          if ( hands[i].isTracking() ) {
+            // ̈ʒu͔]ĂȂWȂ̂ŁA\ɍ킹
+            auto point = convertHandCoordinatesToDepth( hands[i].getPosition() );
+            if ( mirror ) {
+              point.x = depthImage.cols - 1 - point.x;
+            }
+            cv::circle( depthImage, point, 2, cv::Scalar( 0, 255, 0 ), 3 );
+          }
+        }
+
+        cv::imshow( "Grab Detector Sample", depthImage );
+        scheduler.end( drawStage );
+      }
 
       int key = cv::waitKey( 10 );
       if ( key == 'q' ) {
         break;
       }
+      else if ( key == 's' ) {
+        // Ƃ̎s󋵂\
+        scheduler.printStats( std::cout );
+      }
+      else if ( key == 'm' ) {
+        // \̍E]؂ւ
+        mirror = !mirror;
+      }
     }
   }
 
@@ -188,38 +258,72 @@ public:
   };
 
   // Depth f[^J[摜ɕϊ
-  cv::Mat convertDepthToColor( openni::VideoFrameRef& depthFrame )
+  // mirror ̂Ƃ͍sƂɉE珑ŁAϊƓɍE𔽓]
+  // (sLbVɎ܂ohɕāAɏ)
+  cv::Mat convertDepthToColor( openni::VideoFrameRef& depthFrame, bool mirror )
   {
     cv::Mat depthImage = cv::Mat( depthFrame.getVideoMode().getResolutionY(),
       depthFrame.getVideoMode().getResolutionX(),
       CV_8UC4 );
 
-    openni::DepthPixel* depth = (openni::DepthPixel*)depthFrame.getData();
-    for ( int i = 0; i < (depthFrame.getDataSize()/sizeof(openni::DepthPixel)); ++i ) {
-      // 摜CfbNX𐶐
-      int index = i * 4;
-
-      // f[^摜
-      UCHAR* data = &depthImage.data[index];
-      // 0-255̃O[f[^쐬
-      // distance : 10000 = gray : 255
-      int gray = ~((depth[i] * 255) / 10000);
-      data[0] = gray;
-      data[1] = gray;
-      data[2] = gray;
-    }
+    const openni::DepthPixel* depth = (const openni::DepthPixel*)depthFrame.getData();
+    threadPool.parallelFor( depthImage.rows, ThreadPool::getBandRows( depthImage.cols * 4 ),
+                            DepthToColorBand( depth, depthImage, mirror ) );
 
     return depthImage;
   }
 
-  // GrabEvent ̒ʒm(PSLabs::IGrabEventListener::ProcessGrabEvent I[o[Ch)
-  void DLL_CALL ProcessGrabEvent( const EventParams& params )
+  // ohƂ Depth f[^̃J[摜ւ̕ϊ
+  struct DepthToColorBand
   {
-    if ( params.Type == PSLabs::IGrabEventListener::GRAB_EVENT ) {
-      std::cout << "Grab" << std::endl;
+    DepthToColorBand( const openni::DepthPixel* depth, cv::Mat& depthImage, bool mirror )
+      : depth( depth ), depthImage( depthImage ), mirror( mirror )
+    {
     }
-    else if ( params.Type == PSLabs::IGrabEventListener::RELEASE_EVENT ) {
-      std::cout << "Release" << std::endl;
+
+    void operator()( int begin, int end ) const
+    {
+      int step = mirror ? -4 : 4;
+      for ( int y = begin; y < end; ++y ) {
+        const openni::DepthPixel* src = depth + (y * depthImage.cols);
+
+        // ݂n߂ʒu
+        UCHAR* data = depthImage.ptr( y ) + (mirror ? ((depthImage.cols - 1) * 4) : 0);
+        for ( int x = 0; x < depthImage.cols; ++x, ++src, data += step ) {
+          // 0-255̃O[f[^쐬
+          // distance : 10000 = gray : 255
+          int gray = ~((*src * 255) / 10000);
+          data[0] = gray;
+          data[1] = gray;
+          data[2] = gray;
+        }
+      }
+    }
+
+    const openni::DepthPixel* depth;
+    cv::Mat& depthImage;
+    bool mirror;
+  };
+
+  // GrabEvent ̕\([J[XbhŌoꂽʂo)
+  void showGrabEvents()
+  {
+    GrabDetectorService::GrabEvent event;
+    while ( grabDetector->pollEvent( &event ) ) {
+      auto stats = grabDetector->getStats( event.handId );
+      if ( event.type == PSLabs::IGrabEventListener::GRAB_EVENT ) {
+        std::cout << "Grab";
+      }
+      else if ( event.type == PSLabs::IGrabEventListener::RELEASE_EVENT ) {
+        std::cout << "Release";
+      }
+      else {
+        continue;
+      }
+
+      std::cout << " (hand " << event.handId << ", latency " << event.latency << " ms"
+                << ", avg " << stats.getAverage() << " ms, max " << stats.maxLatency << " ms"
+                << ", dropped " << stats.dropped << ")" << std::endl;
     }
   }
 
@@ -233,7 +337,18 @@ private:
 
   nite::HandTracker handTracker;
 
-  PSLabs::IGrabDetector* grabDetector;
+  GrabDetectorService* grabDetector;
+
+  HandPatchExtractor handPatches;
+
+  bool mirror;                    // \E]邩
+
+  ThreadPool threadPool;          // Depth 摜̕ϊɍsXbh
+
+  FrameScheduler scheduler;
+  int grabStage;                  // Grab ̌o
+  int patchStage;                 // ̎̐؂o
+  int drawStage;                  // Depth 摜̕\
 };
 
 void main()